@@ -0,0 +1,624 @@
+// blockcache.cc
+//	Routines to manage the kernel buffer cache of disk sectors.
+//
+//	Every buffer is either free (sector -1), or holds one sector and
+//	is in the hash index under that sector number.  A thread that
+//	wants a sector makes its buffer busy, so it can drop the lock
+//	while the buffer is being read or written back, and other threads
+//	asking for the same sector wait on bufferFree instead of reading
+//	it a second time.
+//
+//	Replacement is CLOCK: the hand sweeps the buffers, clearing the
+//	reference bit of every used buffer it passes, and evicts the
+//	first one whose bit was already clear.
+//
+//	Dirty buffers are written back when they are evicted and when
+//	Flush is called, in runs: the dirty buffers for the neighbouring
+//	sectors go out in the same disk request.  Flush must run before
+//	the machine halts: see Interrupt::Halt.
+//
+//	ReadSectors reads every run of sectors that are not cached with
+//	one disk request, straight into the caller's buffer; the run is
+//	copied into the cache only as far as clean buffers are free, so a
+//	large read never has to wait for dirty buffers to be written.
+//
+//	Prefetch reserves clean buffers for an uncached run the same way,
+//	and submits the read to the disk without waiting.  The buffers
+//	stay busy until the read is done and Reap copies the data in;
+//	Reap runs at the start of every cache operation, and whenever a
+//	thread has waited for a read-ahead.  Read-aheads together keep
+//	no more than half the buffers busy.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "blockcache.h"
+#include "synchdisk.h"
+#include "main.h"
+
+// Hash index helpers: buffers are keyed by the sector they hold.
+
+static int BufferSector(CacheBuffer *buffer) { return buffer->sector; }
+static unsigned HashSector(int sector) { return (unsigned)sector; }
+
+//----------------------------------------------------------------------
+// BlockCache::BlockCache
+// 	Initialize an empty cache on top of a synchronous disk.
+//
+//	"disk" -- where cached sectors are read from and written to
+//	"numBuffers" -- how many sectors the cache holds
+//----------------------------------------------------------------------
+
+BlockCache::BlockCache(SynchDisk *disk, int numBuffers)
+{
+    ASSERT(numBuffers > 0);
+
+    this->disk = disk;
+    this->numBuffers = numBuffers;
+    buffers = new CacheBuffer[numBuffers];
+    for (int i = 0; i < numBuffers; i++)
+    {
+        buffers[i].sector = -1;
+        buffers[i].valid = FALSE;
+        buffers[i].dirty = FALSE;
+        buffers[i].referenced = FALSE;
+        buffers[i].busy = FALSE;
+        buffers[i].filling = NULL;
+    }
+    hand = 0;
+
+    index = new HashTable<int, CacheBuffer *>(BufferSector, HashSector);
+    prefetches = new List<PrefetchRun *>;
+    prefetching = 0;
+    lock = new Lock("block cache lock");
+    bufferFree = new Condition("block cache buffer free");
+}
+
+//----------------------------------------------------------------------
+// BlockCache::~BlockCache
+// 	De-allocate the cache.  Anything still dirty is lost: we may be
+//	halting, with no way to wait for the disk, so the cache should
+//	have been flushed already.
+//----------------------------------------------------------------------
+
+BlockCache::~BlockCache()
+{
+    while (!prefetches->IsEmpty())
+        delete prefetches->RemoveFront();
+    delete prefetches;
+    for (int i = 0; i < numBuffers; i++)
+    {
+        if (buffers[i].sector != -1)
+            index->Remove(buffers[i].sector);
+    }
+    delete index;
+    delete bufferFree;
+    delete lock;
+    delete[] buffers;
+}
+
+//----------------------------------------------------------------------
+// BlockCache::ReadSector
+// 	Copy the contents of a disk sector into a buffer, going to the
+//	disk only if the sector is not cached.
+//
+//	"sectorNumber" -- the disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sector
+//----------------------------------------------------------------------
+
+void BlockCache::ReadSector(int sectorNumber, char *data)
+{
+    lock->Acquire();
+    Reap();
+    CacheBuffer *buffer = Acquire(sectorNumber);
+
+    if (buffer->valid)
+        kernel->stats->numCacheHits++;
+    else
+    {
+        kernel->stats->numCacheMisses++;
+        lock->Release(); // the buffer is busy, nobody else touches it
+        disk->ReadSector(sectorNumber, buffer->data);
+        lock->Acquire();
+        buffer->valid = TRUE;
+    }
+
+    bcopy(buffer->data, data, SectorSize);
+    Release(buffer);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::WriteSector
+// 	Replace the contents of a disk sector.  The whole sector is
+//	overwritten, so it never has to be read first; it reaches the
+//	disk when its buffer is evicted or flushed.
+//
+//	"sectorNumber" -- the disk sector to be written
+//	"data" -- the new contents of the disk sector
+//----------------------------------------------------------------------
+
+void BlockCache::WriteSector(int sectorNumber, char *data)
+{
+    lock->Acquire();
+    Reap();
+    CacheBuffer *buffer = Acquire(sectorNumber);
+
+    if (buffer->valid)
+        kernel->stats->numCacheHits++;
+    else
+        kernel->stats->numCacheMisses++;
+
+    bcopy(data, buffer->data, SectorSize);
+    buffer->valid = TRUE;
+    buffer->dirty = TRUE;
+    Release(buffer);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::ReadSectors
+// 	Copy the contents of consecutive disk sectors into a buffer.
+//	Cached sectors are copied from the cache; each run of the others
+//	is read from the disk with a single request.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"data" -- the buffer to hold them, numSectors * SectorSize bytes
+//	"numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void BlockCache::ReadSectors(int sectorNumber, char *data, int numSectors)
+{
+    CacheBuffer *buffer;
+    int i = 0;
+
+    if (numSectors == 1)
+    {
+        ReadSector(sectorNumber, data);
+        return;
+    }
+
+    lock->Acquire();
+    Reap();
+    while (i < numSectors)
+    {
+        int sector = sectorNumber + i;
+        char *into = &data[i * SectorSize];
+
+        if (index->Find(sector, &buffer))
+        {
+            if (buffer->busy)
+            {
+                WaitFor(buffer); // being filled or written back
+                continue;
+            }
+            ASSERT(buffer->valid);
+            kernel->stats->numCacheHits++;
+            bcopy(buffer->data, into, SectorSize);
+            buffer->referenced = TRUE;
+            i++;
+            continue;
+        }
+
+        int run = 1;
+        while (i + run < numSectors && !index->IsInTable(sector + run))
+            run++;
+        int filled = Reserve(sector, run);
+
+        kernel->stats->numCacheMisses += run;
+        lock->Release();
+        disk->ReadSectors(sector, into, run);
+        lock->Acquire();
+
+        for (int j = 0; j < filled; j++)
+        {
+            index->Find(sector + j, &buffer);
+            bcopy(&into[j * SectorSize], buffer->data, SectorSize);
+            buffer->valid = TRUE;
+            Release(buffer);
+        }
+        i += run;
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::WriteSectors
+// 	Replace the contents of consecutive disk sectors.  Like
+//	WriteSector, this only fills cache buffers; since the sectors
+//	are dirty together, eviction or Flush writes them as one run.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"data" -- their new contents, numSectors * SectorSize bytes
+//	"numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void BlockCache::WriteSectors(int sectorNumber, char *data, int numSectors)
+{
+    for (int i = 0; i < numSectors; i++)
+        WriteSector(sectorNumber + i, &data[i * SectorSize]);
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Prefetch
+// 	Start reading sectors into the cache, and return without waiting
+//	for the disk.  Sectors already cached are skipped; of the rest,
+//	the first uncached run is read, as far as clean buffers can be
+//	had for it.
+//
+//	"sectorNumber" -- the first disk sector wanted soon
+//	"numSectors" -- how many consecutive sectors
+//----------------------------------------------------------------------
+
+void BlockCache::Prefetch(int sectorNumber, int numSectors)
+{
+    PrefetchRun *run;
+    CacheBuffer *buffer;
+    int length = 0, reserved;
+
+    lock->Acquire();
+    Reap();
+    while (numSectors > 0 && index->IsInTable(sectorNumber))
+    {
+        sectorNumber++;
+        numSectors--;
+    }
+    while (length < numSectors && !index->IsInTable(sectorNumber + length))
+        length++;
+    length = min(length, numBuffers / 2 - prefetching);
+    if (length <= 0 || (reserved = Reserve(sectorNumber, length)) == 0)
+    {
+        lock->Release();
+        return; // nothing to read, or no room
+    }
+
+    DEBUG(dbgDisk, "Reading ahead " << reserved << " sectors from " << sectorNumber);
+    run = new PrefetchRun(sectorNumber, reserved);
+    for (int j = 0; j < reserved; j++)
+    {
+        index->Find(sectorNumber + j, &buffer);
+        buffer->filling = run;
+    }
+    prefetching += reserved;
+    prefetches->Append(run);
+    kernel->stats->numCacheReadAheads += reserved;
+    disk->Submit(run->request);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Flush
+// 	Write every dirty buffer back to disk.  The buffers stay cached.
+//----------------------------------------------------------------------
+
+void BlockCache::Flush()
+{
+    lock->Acquire();
+    Reap();
+    for (int i = 0; i < numBuffers; i++)
+    {
+        CacheBuffer *buffer = &buffers[i];
+
+        while (buffer->busy)
+            WaitFor(buffer);
+        if (buffer->dirty)
+        {
+            buffer->busy = TRUE;
+            Clean(buffer);
+            Release(buffer);
+        }
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Acquire
+// 	Return the buffer for a sector, marked busy for the caller.  If
+//	the sector is not cached, a victim buffer is cleaned and given to
+//	it, with valid FALSE so the caller knows it has to be filled.
+//
+//	Called with the lock held; it may be released and re-acquired.
+//
+//	"sectorNumber" -- the disk sector wanted
+//----------------------------------------------------------------------
+
+CacheBuffer *BlockCache::Acquire(int sectorNumber)
+{
+    CacheBuffer *buffer;
+
+    while (TRUE)
+    {
+        if (index->Find(sectorNumber, &buffer))
+        {
+            if (!buffer->busy)
+                break;
+            WaitFor(buffer); // being filled or written back
+            continue;
+        }
+
+        buffer = Victim();
+        if (buffer == NULL)
+        {
+            bufferFree->Wait(lock); // every buffer is busy
+            continue;
+        }
+
+        buffer->busy = TRUE;
+        if (buffer->dirty)
+        {
+            Clean(buffer);
+            // another thread may have brought the sector in while
+            // we were writing; the victim keeps its old sector then
+            if (index->IsInTable(sectorNumber))
+            {
+                Release(buffer);
+                continue;
+            }
+        }
+
+        if (buffer->sector != -1)
+            index->Remove(buffer->sector);
+        buffer->sector = sectorNumber;
+        buffer->valid = FALSE;
+        index->Insert(buffer);
+        return buffer;
+    }
+
+    buffer->busy = TRUE;
+    return buffer;
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Release
+// 	Mark a buffer as recently used and let other threads have it.
+//
+//	"buffer" -- a busy buffer owned by the caller
+//----------------------------------------------------------------------
+
+void BlockCache::Release(CacheBuffer *buffer)
+{
+    ASSERT(buffer->busy);
+    buffer->busy = FALSE;
+    buffer->referenced = TRUE;
+    bufferFree->Broadcast(lock);
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Victim
+// 	Advance the clock hand to the next buffer that may be evicted.
+//	Two sweeps clear every reference bit, so NULL means that all
+//	buffers are busy.
+//----------------------------------------------------------------------
+
+CacheBuffer *BlockCache::Victim()
+{
+    for (int i = 0; i < 2 * numBuffers; i++)
+    {
+        CacheBuffer *buffer = &buffers[hand];
+        hand = (hand + 1) % numBuffers;
+
+        if (buffer->busy)
+            continue;
+        if (buffer->referenced)
+        {
+            buffer->referenced = FALSE; // second chance
+            continue;
+        }
+        return buffer;
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Clean
+// 	Write a dirty buffer back to its sector.  Dirty buffers for the
+//	sectors on either side that nobody owns go along, so the whole
+//	run is one disk request.  They are all busy, so the lock can be
+//	dropped during the write.
+//
+//	"buffer" -- a busy, dirty buffer owned by the caller
+//----------------------------------------------------------------------
+
+void BlockCache::Clean(CacheBuffer *buffer)
+{
+    CacheBuffer *other;
+    int first = buffer->sector;
+    int last = buffer->sector;
+
+    ASSERT(buffer->busy && buffer->dirty);
+
+    while (index->Find(first - 1, &other) && other->dirty && !other->busy)
+    {
+        other->busy = TRUE;
+        first--;
+    }
+    while (index->Find(last + 1, &other) && other->dirty && !other->busy)
+    {
+        other->busy = TRUE;
+        last++;
+    }
+
+    if (first == last)
+    { // nothing to cluster with
+        lock->Release();
+        disk->WriteSector(buffer->sector, buffer->data);
+        lock->Acquire();
+        buffer->dirty = FALSE;
+        return;
+    }
+
+    int count = last - first + 1;
+    char *run = new char[count * SectorSize];
+    for (int s = first; s <= last; s++)
+    {
+        index->Find(s, &other);
+        bcopy(other->data, &run[(s - first) * SectorSize], SectorSize);
+    }
+
+    lock->Release();
+    disk->WriteSectors(first, run, count);
+    lock->Acquire();
+    delete[] run;
+
+    for (int s = first; s <= last; s++)
+    {
+        index->Find(s, &other);
+        other->dirty = FALSE;
+        if (other != buffer)
+            other->busy = FALSE; // not referenced: evicting them is cheap now
+    }
+    bufferFree->Broadcast(lock);
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Reserve
+// 	Give buffers to the sectors of an uncached run, from its start,
+//	for as long as the clock hand finds clean ones; a dirty victim
+//	would have to be written first, so the rest of the run is left
+//	uncached.  No more than half the cache goes to one run.
+//
+//	The buffers are busy and invalid: the caller fills and releases
+//	them.  Called with the lock held, which is not released.
+//
+//	"sectorNumber" -- the first sector of the run
+//	"numSectors" -- how many sectors, none of them cached
+//----------------------------------------------------------------------
+
+int BlockCache::Reserve(int sectorNumber, int numSectors)
+{
+    int reserved = 0;
+
+    numSectors = min(numSectors, max(numBuffers / 2, 1));
+    while (reserved < numSectors)
+    {
+        CacheBuffer *buffer = Victim();
+
+        if (buffer == NULL || buffer->dirty)
+            break;
+        if (buffer->sector != -1)
+            index->Remove(buffer->sector);
+        buffer->sector = sectorNumber + reserved;
+        buffer->valid = FALSE;
+        buffer->busy = TRUE;
+        index->Insert(buffer);
+        reserved++;
+    }
+    return reserved;
+}
+
+//----------------------------------------------------------------------
+// BlockCache::WaitFor
+// 	Wait until a busy buffer may have been let go.  A buffer being
+//	read ahead is let go by Reap, once the disk is done; so wait for
+//	the disk, then reap.  Any other busy buffer is let go by Release.
+//
+//	Called with the lock held; it is released while waiting.
+//
+//	"buffer" -- a busy buffer
+//----------------------------------------------------------------------
+
+void BlockCache::WaitFor(CacheBuffer *buffer)
+{
+    PrefetchRun *run = buffer->filling;
+
+    if (run == NULL)
+    {
+        bufferFree->Wait(lock);
+        return;
+    }
+
+    run->waiters++;
+    lock->Release();
+    run->done->P();
+    run->done->V(); // for the next waiter
+    lock->Acquire();
+    run->waiters--;
+    Reap();
+}
+
+//----------------------------------------------------------------------
+// BlockCache::Reap
+// 	Fill the buffers of every read-ahead the disk has finished, and
+//	let them go.  A run is freed once nobody is waiting on it.
+//
+//	Called with the lock held, which is not released.
+//----------------------------------------------------------------------
+
+void BlockCache::Reap()
+{
+    int n = prefetches->NumInList();
+    bool installed = FALSE;
+
+    for (int i = 0; i < n; i++)
+    {
+        PrefetchRun *run = prefetches->RemoveFront();
+
+        if (run->complete && !run->installed)
+        {
+            for (int j = 0; j < run->count; j++)
+            {
+                CacheBuffer *buffer = NULL;
+
+                index->Find(run->sector + j, &buffer);
+                ASSERT(buffer != NULL && buffer->busy && buffer->filling == run);
+                bcopy(&run->data[j * SectorSize], buffer->data, SectorSize);
+                buffer->valid = TRUE;
+                buffer->filling = NULL;
+                buffer->busy = FALSE;
+                buffer->referenced = TRUE;
+            }
+            prefetching -= run->count;
+            run->installed = TRUE;
+            installed = TRUE;
+        }
+
+        if (run->installed && run->waiters == 0)
+            delete run;
+        else
+            prefetches->Append(run);
+    }
+    if (installed)
+        bufferFree->Broadcast(lock);
+}
+
+//----------------------------------------------------------------------
+// PrefetchRun::PrefetchRun
+// 	Describe a read-ahead of consecutive sectors, and the disk
+//	request for it.
+//
+//	"sectorNumber" -- the first sector
+//	"numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+PrefetchRun::PrefetchRun(int sectorNumber, int numSectors)
+{
+    sector = sectorNumber;
+    count = numSectors;
+    data = new char[numSectors * SectorSize];
+    request = new DiskRequest(sectorNumber, numSectors, data, FALSE, this);
+    complete = FALSE;
+    installed = FALSE;
+    waiters = 0;
+    done = new Semaphore("read-ahead", 0);
+}
+
+PrefetchRun::~PrefetchRun()
+{
+    delete request;
+    delete done;
+    delete[] data;
+}
+
+//----------------------------------------------------------------------
+// PrefetchRun::CallBack
+// 	Called from the disk interrupt handler when the run has been
+//	read.  The cache installs the data later, under its lock.
+//----------------------------------------------------------------------
+
+void PrefetchRun::CallBack()
+{
+    complete = TRUE;
+    done->V();
+}
@@ -0,0 +1,136 @@
+// blockcache.h
+//	Data structures for a kernel buffer cache of disk sectors.
+//
+//	The cache sits between the file system (OpenFile, FileHeader)
+//	and the synchronous disk.  It keeps a fixed number of sector
+//	buffers, found by sector number through a hash table, and
+//	evicts with the CLOCK algorithm.  Writes only mark the buffer
+//	dirty; it is written to disk when it is evicted or flushed,
+//	together with any dirty buffers for the sectors next to it.
+//	Prefetch reads sectors ahead of need, without waiting for them.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "disk.h"
+#include "synch.h"
+#include "hash.h"
+#include "callback.h"
+
+class SynchDisk;
+class DiskRequest;
+class PrefetchRun;
+
+// Default number of sector buffers, overridden by "nachos -bc <n>".
+#define NumCacheBuffers 64
+
+// One cached sector.  A busy buffer is owned by a thread that is
+// filling, copying or writing it, and nobody else may touch it until
+// it is released.
+
+class CacheBuffer
+{
+public:
+    int sector;      // Disk sector held, -1 if none
+    bool valid;      // Does data hold the sector's contents?
+    bool dirty;      // Has data been written since it was read?
+    bool referenced; // Used since the clock hand last passed?
+    bool busy;       // Owned by a thread, see above
+    PrefetchRun *filling; // If busy, the read-ahead filling it, if any
+    char data[SectorSize];
+};
+
+// A run of sectors being read ahead: the buffers for them are busy
+// until the read completes, and the cache installs the data.  The
+// completion comes in the disk interrupt handler, which may not take
+// the cache lock, so it only notes it; threads that need one of the
+// buffers wait on "done".
+
+class PrefetchRun : public CallBackObj
+{
+public:
+    PrefetchRun(int sectorNumber, int numSectors);
+    ~PrefetchRun();
+
+    void CallBack(); // Called when the disk has read the run
+
+    int sector;           // First sector of the run
+    int count;            // How many sectors
+    char *data;           // Where the disk reads them to
+    DiskRequest *request; // The disk read
+    bool complete;        // Has the disk finished?
+    bool installed;       // Are the buffers filled from data?
+    int waiters;          // Threads waiting on done
+    Semaphore *done;      // Signalled once complete
+};
+
+// The following class defines the buffer cache.  ReadSector and
+// WriteSector have the same interface as SynchDisk's, so the file
+// system can use either.  The lock is not held during disk I/O, so
+// other threads keep hitting in the cache meanwhile.
+
+class BlockCache
+{
+public:
+    BlockCache(SynchDisk *disk, int numBuffers); // Create an empty cache
+                                                 // of numBuffers sectors
+    ~BlockCache();                               // De-allocate the cache,
+                                                 // which must be flushed
+
+    void ReadSector(int sectorNumber, char *data);
+    // Copy a sector into data, reading
+    // it from disk on a miss
+    void WriteSector(int sectorNumber, char *data);
+    // Replace a sector's contents; the
+    // disk is written later
+
+    void ReadSectors(int sectorNumber, char *data, int numSectors);
+    // Copy consecutive sectors into data;
+    // each run of misses is one disk read
+    void WriteSectors(int sectorNumber, char *data, int numSectors);
+    // Replace consecutive sectors
+
+    void Prefetch(int sectorNumber, int numSectors);
+    // Start reading consecutive sectors
+    // into the cache, without waiting
+
+    void Flush(); // Write every dirty buffer back to disk
+
+private:
+    CacheBuffer *Acquire(int sectorNumber); // Return the busy buffer
+                                            // for sectorNumber, evicting
+                                            // if it is not cached
+    void Release(CacheBuffer *buffer);      // Let others use buffer again
+    CacheBuffer *Victim();                  // Next non-busy buffer the
+                                            // clock hand finds unreferenced
+    void Clean(CacheBuffer *buffer);        // Write a busy dirty buffer
+                                            // back, lock released meanwhile
+    int Reserve(int sectorNumber, int numSectors);
+    // Give uncached sectors clean buffers
+    // to be filled, as many as are free
+    void WaitFor(CacheBuffer *buffer); // Wait until a busy buffer may
+                                       // be free; lock released meanwhile
+    void Reap();                       // Install the read-aheads the
+                                       // disk has finished
+
+    SynchDisk *disk;
+    int numBuffers;
+    CacheBuffer *buffers;
+    int hand; // Next buffer the clock looks at
+
+    HashTable<int, CacheBuffer *> *index; // Valid or filling buffers
+                                          // by sector number
+    List<PrefetchRun *> *prefetches;      // Read-aheads not yet freed
+    int prefetching;                      // Buffers they keep busy
+
+    Lock *lock;            // Protects everything above
+    Condition *bufferFree; // Signalled when a buffer stops being busy
+};
+
+#endif // BLOCKCACHE_H
@@ -0,0 +1,215 @@
+// dircache.cc
+//	Routines to cache directory lookups.
+//
+//	Entries are kept in an array, and linked by index: each in-use
+//	entry is on the hash chain of its (directory, name) pair, and all
+//	entries are on one LRU list, newest first.  Unused entries are
+//	left at the old end of the list, so that they are taken first.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "dircache.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// BucketOf
+// 	Return the hash bucket of a (directory, name) pair.
+//----------------------------------------------------------------------
+
+static int BucketOf(int parent, char *name)
+{
+    return (HashName(name) ^ ((unsigned)parent * 2654435761u)) % NumDirCacheBuckets;
+}
+
+//----------------------------------------------------------------------
+// DirCache::DirCache
+// 	Create an empty cache: every entry unused, on the LRU list.
+//----------------------------------------------------------------------
+
+DirCache::DirCache()
+{
+    entries = new DirCacheEntry[NumDirCacheEntries];
+    buckets = new int[NumDirCacheBuckets];
+    for (int i = 0; i < NumDirCacheBuckets; i++)
+        buckets[i] = -1;
+
+    newest = oldest = -1;
+    for (int i = 0; i < NumDirCacheEntries; i++)
+    {
+        entries[i].parent = -1;
+        entries[i].hashNext = -1;
+        MakeNewest(i);
+    }
+}
+
+//----------------------------------------------------------------------
+// DirCache::~DirCache
+// 	De-allocate the cache.
+//----------------------------------------------------------------------
+
+DirCache::~DirCache()
+{
+    delete[] entries;
+    delete[] buckets;
+}
+
+//----------------------------------------------------------------------
+// DirCache::Lookup
+// 	Return TRUE if the lookup of "name" in a directory is cached, and
+//	make it the most recently used.  A cached lookup tells where the
+//	file header is, or that there is no such name (sector -1).
+//
+//	"parent" -- the directory's header sector
+//	"name" -- the name looked up
+//	"sector" -- set to the file's header sector, or -1
+//	"isDir" -- if not NULL, set to whether the file is a directory
+//----------------------------------------------------------------------
+
+bool DirCache::Lookup(int parent, char *name, int *sector, bool *isDir)
+{
+    int which = Find(parent, name, BucketOf(parent, name));
+
+    if (which == -1)
+    {
+        kernel->stats->numNameCacheMisses++;
+        return FALSE;
+    }
+    if (entries[which].sector == -1)
+        kernel->stats->numNameCacheNegativeHits++;
+    else
+        kernel->stats->numNameCacheHits++;
+
+    *sector = entries[which].sector;
+    if (isDir != NULL)
+        *isDir = entries[which].isDir;
+    Unlink(which);
+    MakeNewest(which);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// DirCache::Enter
+// 	Remember the lookup of "name" in a directory, in its old entry if
+//	there is one, otherwise in the least recently used entry.
+//
+//	"parent" -- the directory's header sector
+//	"name" -- the name looked up
+//	"sector" -- the file's header sector, or -1 if there is none
+//	"isDir" -- is the file a directory?
+//----------------------------------------------------------------------
+
+void DirCache::Enter(int parent, char *name, int sector, bool isDir)
+{
+    int bucket = BucketOf(parent, name);
+    int which = Find(parent, name, bucket);
+
+    if (which == -1)
+    {
+        which = oldest;
+        if (entries[which].parent != -1)
+            Unhash(which);
+        entries[which].parent = parent;
+        strncpy(entries[which].name, name, FileNameMaxLen);
+        entries[which].name[FileNameMaxLen] = '\0';
+        entries[which].hashNext = buckets[bucket];
+        buckets[bucket] = which;
+    }
+    entries[which].sector = sector;
+    entries[which].isDir = isDir;
+    Unlink(which);
+    MakeNewest(which);
+}
+
+//----------------------------------------------------------------------
+// DirCache::Purge
+// 	Forget every lookup in a directory that has been removed, since
+//	its header sector may be reused by another directory.
+//
+//	"parent" -- the removed directory's header sector
+//----------------------------------------------------------------------
+
+void DirCache::Purge(int parent)
+{
+    for (int i = 0; i < NumDirCacheEntries; i++)
+    {
+        if (entries[i].parent != parent)
+            continue;
+        Unhash(i);
+        entries[i].parent = -1;
+        Unlink(i);
+        // unused entries go to the old end, to be reused first
+        entries[i].newer = oldest;
+        entries[i].older = -1;
+        if (oldest != -1)
+            entries[oldest].older = i;
+        else
+            newest = i;
+        oldest = i;
+    }
+}
+
+//----------------------------------------------------------------------
+// DirCache::Find
+// 	Return the entry for "name" in a directory, or -1 if none.
+//
+//	"parent" -- the directory's header sector
+//	"name" -- the name looked up
+//	"bucket" -- the pair's hash bucket
+//----------------------------------------------------------------------
+
+int DirCache::Find(int parent, char *name, int bucket)
+{
+    for (int i = buckets[bucket]; i != -1; i = entries[i].hashNext)
+        if (entries[i].parent == parent
+            && !strncmp(entries[i].name, name, FileNameMaxLen))
+            return i;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// DirCache::Unhash
+// 	Take an in-use entry off its hash chain.
+//----------------------------------------------------------------------
+
+void DirCache::Unhash(int which)
+{
+    int *link = &buckets[BucketOf(entries[which].parent, entries[which].name)];
+
+    while (*link != which)
+        link = &entries[*link].hashNext;
+    *link = entries[which].hashNext;
+    entries[which].hashNext = -1;
+}
+
+//----------------------------------------------------------------------
+// DirCache::Unlink/MakeNewest
+// 	Take an entry off the LRU list, and put it back at the new end.
+//----------------------------------------------------------------------
+
+void DirCache::Unlink(int which)
+{
+    DirCacheEntry *entry = &entries[which];
+
+    if (entry->newer != -1)
+        entries[entry->newer].older = entry->older;
+    else
+        newest = entry->older;
+    if (entry->older != -1)
+        entries[entry->older].newer = entry->newer;
+    else
+        oldest = entry->newer;
+}
+
+void DirCache::MakeNewest(int which)
+{
+    entries[which].newer = -1;
+    entries[which].older = newest;
+    if (newest != -1)
+        entries[newest].newer = which;
+    else
+        oldest = which;
+    newest = which;
+}
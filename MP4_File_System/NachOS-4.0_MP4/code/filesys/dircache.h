@@ -0,0 +1,81 @@
+// dircache.h
+//	Data structures for a cache of directory lookups.
+//
+//	Resolving a path looks up each of its components in the directory
+//	above it.  The cache remembers the answers: the file header sector
+//	a (directory, name) pair led to, or that the name was not there
+//	(a "negative" entry), so that looking the same name up again does
+//	not read the directory.  It holds a fixed number of entries, found
+//	through a hash table, and evicts the least recently used.
+//
+//	The file system keeps the cache right: it enters every name it
+//	creates or removes, and purges the entries below a directory
+//	it removes.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include "directory.h"
+
+// Number of names cached, and of hash buckets to find them by.
+#define NumDirCacheEntries 64
+#define NumDirCacheBuckets 61
+
+// One cached lookup.  Entries are threaded on a hash chain, when in
+// use, and on the LRU list, always.
+
+class DirCacheEntry
+{
+public:
+    int parent;                    // Header sector of the directory,
+                                   //  -1 if the entry is unused
+    char name[FileNameMaxLen + 1]; // Name looked up in it
+    int sector;                    // Header sector of the file, or -1
+                                   //  if there is no such name
+    bool isDir;                    // Is the file a directory?
+
+    int hashNext;     // Next entry in the same bucket, or -1
+    int newer, older; // Neighbours on the LRU list, or -1
+};
+
+// The following class defines the directory lookup cache.  It does
+// no disk I/O itself.
+
+class DirCache
+{
+public:
+    DirCache();  // Create an empty cache
+    ~DirCache(); // De-allocate the cache
+
+    bool Lookup(int parent, char *name, int *sector, bool *isDir);
+    // Is the lookup of name in parent
+    //  cached?  If so, set the answer,
+    //  with sector -1 if there is no name
+    void Enter(int parent, char *name, int sector, bool isDir);
+    // Remember an answer, replacing any
+    //  earlier one for the same name
+    void Purge(int parent); // Forget every name in directory
+                            //  parent, which is gone
+
+private:
+    int Find(int parent, char *name, int bucket); // Entry for the name,
+                                                  //  or -1
+    void Unhash(int which);                       // Take an entry off
+                                                  //  its hash chain
+    void Unlink(int which);                       // Take an entry off
+                                                  //  the LRU list
+    void MakeNewest(int which);                   // Put an entry at the
+                                                  //  head of the LRU list
+
+    DirCacheEntry *entries;
+    int *buckets;       // First entry of each hash chain, or -1
+    int newest, oldest; // Ends of the LRU list
+};
+
+#endif // DIRCACHE_H
@@ -1,19 +1,22 @@
 // directory.cc
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
-//	entry represents a single file, and contains the file name,
-//	and the location of the file header on disk.  The fixed size
-//	of each directory entry means that we have the restriction
-//	of a fixed maximum size for file names.
+//	The directory is an extendible hash table of fixed length
+//	entries; each entry represents a single file, and contains the
+//	file name, and the location of the file header on disk.  The
+//	fixed size of each directory entry means that we have the
+//	restriction of a fixed maximum size for file names.
 //
-//	The constructor initializes an empty directory of a certain size;
-//	we use ReadFrom/WriteBack to fetch the contents of the directory
-//	from disk, and to write back any modifications back to disk.
+//	A name is found by hashing it: the low globalDepth bits of the
+//	hash pick an entry in the table, which gives the bucket sector
+//	to read.  A full bucket is split in two, the directory file
+//	growing by a sector (and the table doubling when the bucket was
+//	the only one for its table entry), so a directory can hold up
+//	to 1 << MaxGlobalDepth buckets -- more than the disk has room
+//	for.  Buckets are not merged again when files are removed.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
+//	FetchFrom reads the header and the table of a directory; every
+//	change is written back to its sectors right away.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -21,29 +24,42 @@
 
 #include "copyright.h"
 #include "utility.h"
+#include "debug.h"
 #include "filehdr.h"
 #include "directory.h"
 
+//----------------------------------------------------------------------
+// HashName
+// 	Return the hash of a file name (FNV-1a), over the characters that
+//	are kept in a directory entry.
+//----------------------------------------------------------------------
+
+unsigned HashName(char *name)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < FileNameMaxLen && name[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 //----------------------------------------------------------------------
 // Directory::Directory
-// 	Initialize a directory; initially, the directory is completely
-//	empty.  If the disk is being formatted, an empty directory
-//	is all we need, but otherwise, we need to call FetchFrom in order
-//	to initialize it from disk.
-//
-//	"size" is the number of entries in the directory
+// 	Initialize a directory object.  It describes nothing until
+//	Initialize makes a new directory, or FetchFrom reads one in.
 //----------------------------------------------------------------------
 
-Directory::Directory(int size)
+Directory::Directory()
 {
-    table = new DirectoryEntry[size];
+    ASSERT(sizeof(DirectoryBucket) == SectorSize);
 
+    file = NULL;
     // MP4 mod tag
-    memset(table, 0, sizeof(DirectoryEntry) * size); // dummy operation to keep valgrind happy
-
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++)
-        table[i].inUse = FALSE;
+    memset(&header, 0, sizeof(header)); // dummy operation to keep valgrind happy
+    table = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -57,41 +73,81 @@ Directory::~Directory()
 }
 
 //----------------------------------------------------------------------
-// Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// Directory::Initialize
+// 	Lay out an empty directory in a file: the header, one table
+//	sector with one entry, and one empty bucket.
 //
-//	"file" -- file containing the directory contents
+//	"file" -- the new directory file, DirectoryFileSize bytes long
 //----------------------------------------------------------------------
 
-void Directory::FetchFrom(OpenFile *file)
+void Directory::Initialize(OpenFile *file)
 {
-    (void)file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    DirectoryBucket bucket;
+
+    ASSERT(file->Length() >= DirectoryFileSize);
+    this->file = file;
+
+    header.globalDepth = 0;
+    header.numEntries = 0;
+    header.numSectors = 3;
+    header.tableStart = 1;
+    delete[] table;
+    table = new int[1];
+    table[0] = 2;
+
+    memset(&bucket, 0, sizeof(bucket));
+    WriteHeader();
+    WriteTable(0, 0);
+    WriteSector(2, &bucket);
 }
 
 //----------------------------------------------------------------------
-// Directory::WriteBack
-// 	Write any modifications to the directory back to disk
+// Directory::FetchFrom
+// 	Read the header and hash table of the directory from disk.
 //
-//	"file" -- file to contain the new directory contents
+//	"file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
-void Directory::WriteBack(OpenFile *file)
+void Directory::FetchFrom(OpenFile *file)
 {
-    (void)file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    int size, sectors;
+
+    this->file = file;
+    (void)file->ReadAt((char *)&header, sizeof(header), 0);
+
+    size = 1 << header.globalDepth;
+    sectors = divRoundUp(size, BucketsPerTableSector);
+    delete[] table;
+    table = new int[size];
+    for (int i = 0; i < sectors; i++)
+    {
+        int chunk[BucketsPerTableSector];
+
+        ReadSector(header.tableStart + i, chunk);
+        memcpy(&table[i * BucketsPerTableSector], chunk,
+               min(BucketsPerTableSector, size - i * BucketsPerTableSector) * sizeof(int));
+    }
 }
 
 //----------------------------------------------------------------------
-// Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// Directory::FindEntry
+// 	Look up file name in directory.  Read the bucket it hashes to,
+//	and return the name's index in the bucket, or -1 if the name
+//	isn't in the directory.
 //
 //	"name" -- the file name to look up
+//	"bucket" -- set to the contents of the bucket
+//	"bucketSector" -- set to the file sector of the bucket
 //----------------------------------------------------------------------
 
-int Directory::FindIndex(char *name)
+int Directory::FindEntry(char *name, DirectoryBucket *bucket, int *bucketSector)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
+    int index = HashName(name) & ((1 << header.globalDepth) - 1);
+
+    *bucketSector = table[index];
+    ReadSector(*bucketSector, bucket);
+    for (int i = 0; i < bucket->numEntries; i++)
+        if (!strncmp(bucket->entries[i].name, name, FileNameMaxLen))
             return i;
     return -1; // name not in directory
 }
@@ -103,42 +159,178 @@ int Directory::FindIndex(char *name)
 //	in the directory.
 //
 //	"name" -- the file name to look up
+//	"isDir" -- if not NULL, set to whether the file is a directory
 //----------------------------------------------------------------------
 
-int Directory::Find(char *name)
+int Directory::Find(char *name, bool *isDir)
 {
-    int i = FindIndex(name);
+    DirectoryBucket bucket;
+    int bucketSector;
+    int i = FindEntry(name, &bucket, &bucketSector);
 
-    if (i != -1)
-        return table[i].sector;
-    return -1;
+    if (i == -1)
+        return -1;
+    if (isDir != NULL)
+        *isDir = bucket.entries[i].isDir;
+    return bucket.entries[i].sector;
 }
 
 //----------------------------------------------------------------------
 // Directory::Add
 // 	Add a file into the directory.  Return TRUE if successful;
 //	return FALSE if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	the directory cannot grow any more.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
+//	"isDir" -- is the file a directory?
+//	"freeMap" -- where to allocate from if the directory file grows;
+//		the caller writes it back
 //----------------------------------------------------------------------
 
-bool Directory::Add(char *name, int newSector)
+bool Directory::Add(char *name, int newSector, bool isDir, PersistentBitmap *freeMap)
 {
-    if (FindIndex(name) != -1)
+    DirectoryBucket bucket;
+    int bucketSector;
+
+    if (FindEntry(name, &bucket, &bucketSector) != -1)
         return FALSE;
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse)
+    while (bucket.numEntries == EntriesPerBucket)
+    {
+        int index = HashName(name) & ((1 << header.globalDepth) - 1);
+
+        if (!Split(index, &bucket, freeMap))
+            return FALSE; // no space
+        FindEntry(name, &bucket, &bucketSector);
+    }
+
+    DirectoryEntry *entry = &bucket.entries[bucket.numEntries++];
+    entry->isDir = isDir;
+    entry->sector = newSector;
+    strncpy(entry->name, name, FileNameMaxLen);
+    entry->name[FileNameMaxLen] = '\0';
+    WriteSector(bucketSector, &bucket);
+
+    header.numEntries++;
+    WriteHeader();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::Split
+// 	Split a full bucket on the next bit of the hash: the names with
+//	that bit set move to a new bucket, and the table entries with
+//	that bit set point to it.
+//
+//	"index" -- a table entry pointing to the bucket
+//	"bucket" -- the contents of the bucket
+//	"freeMap" -- where to allocate from if the directory file grows
+//----------------------------------------------------------------------
+
+bool Directory::Split(int index, DirectoryBucket *bucket, PersistentBitmap *freeMap)
+{
+    int oldSector = table[index];
+    int newSector, bit, kept = 0;
+    DirectoryBucket moved;
+
+    if (bucket->localDepth == header.globalDepth && !DoubleTable(freeMap))
+        return FALSE;
+    if ((newSector = NewSectors(1, freeMap)) == -1)
+        return FALSE;
+
+    bit = 1 << bucket->localDepth;
+    memset(&moved, 0, sizeof(moved));
+    moved.localDepth = ++bucket->localDepth;
+    for (int i = 0; i < bucket->numEntries; i++)
+    {
+        if (HashName(bucket->entries[i].name) & bit)
+            moved.entries[moved.numEntries++] = bucket->entries[i];
+        else
+            bucket->entries[kept++] = bucket->entries[i];
+    }
+    bucket->numEntries = kept;
+
+    int first = -1, last = -1;
+    for (int i = 0; i < (1 << header.globalDepth); i++)
+    {
+        if (table[i] == oldSector && (i & bit))
         {
-            table[i].inUse = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
+            table[i] = newSector;
+            if (first == -1)
+                first = i;
+            last = i;
         }
-    return FALSE; // no space.  Fix when we have extensible files.
+    }
+
+    WriteSector(oldSector, bucket);
+    WriteSector(newSector, &moved);
+    WriteTable(first, last);
+    WriteHeader();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::DoubleTable
+// 	Use one more bit of the hash to index the table.  The new half
+//	of the table points to the same buckets as the old half.  A
+//	table that no longer fits in its sectors is written out whole at
+//	the end of the file.
+//
+//	"freeMap" -- where to allocate from if the directory file grows
+//----------------------------------------------------------------------
+
+bool Directory::DoubleTable(PersistentBitmap *freeMap)
+{
+    int size = 1 << header.globalDepth;
+    int sectors = divRoundUp(2 * size, BucketsPerTableSector);
+    int *newTable;
+
+    if (header.globalDepth == MaxGlobalDepth)
+        return FALSE;
+    if (sectors > divRoundUp(size, BucketsPerTableSector))
+    {
+        int start = NewSectors(sectors, freeMap);
+
+        if (start == -1)
+            return FALSE;
+        header.tableStart = start;
+        size = 0; // all of the table moves
+    }
+
+    newTable = new int[2 << header.globalDepth];
+    for (int i = 0; i < (1 << header.globalDepth); i++)
+        newTable[i] = newTable[i + (1 << header.globalDepth)] = table[i];
+    delete[] table;
+    table = newTable;
+    header.globalDepth++;
+    WriteTable(size, (1 << header.globalDepth) - 1);
+    WriteHeader();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::NewSectors
+// 	Return the first of "count" unused sectors at the end of the
+//	directory file, doubling the file if they are not there (or, on
+//	a nearly full disk, adding just enough).  Return -1 if the disk
+//	is full.
+//
+//	"count" -- how many consecutive file sectors are needed
+//	"freeMap" -- where to allocate from if the directory file grows
+//----------------------------------------------------------------------
+
+int Directory::NewSectors(int count, PersistentBitmap *freeMap)
+{
+    int needed = (header.numSectors + count) * SectorSize;
+    int first = header.numSectors;
+
+    if (needed > file->Length()
+        && !file->Grow(freeMap, max(needed, 2 * file->Length()))
+        && !file->Grow(freeMap, needed))
+        return -1;
+    header.numSectors += count;
+    return first;
 }
 
 //----------------------------------------------------------------------
@@ -151,24 +343,76 @@ bool Directory::Add(char *name, int newSector)
 
 bool Directory::Remove(char *name)
 {
-    int i = FindIndex(name);
+    DirectoryBucket bucket;
+    int bucketSector;
+    int i = FindEntry(name, &bucket, &bucketSector);
 
     if (i == -1)
         return FALSE; // name not in directory
-    table[i].inUse = FALSE;
+    bucket.entries[i] = bucket.entries[--bucket.numEntries];
+    WriteSector(bucketSector, &bucket);
+
+    header.numEntries--;
+    WriteHeader();
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Directory::IsEmpty
+// 	Return TRUE if there are no files in the directory.
+//----------------------------------------------------------------------
+
+bool Directory::IsEmpty()
+{
+    return header.numEntries == 0;
+}
+
 //----------------------------------------------------------------------
 // Directory::List
-// 	List all the file names in the directory.
+// 	List all the file names in the directory.  A recursive listing
+//	marks each name [D] or [F], and lists every subdirectory below
+//	its name, indented one more level.
+//
+//	Each bucket is listed once, from the lowest table entry that
+//	points to it: the one below 1 << localDepth.
+//
+//	"recursive" -- list the subdirectories too?
+//	"depth" -- how deep below the listed directory this one is
 //----------------------------------------------------------------------
 
-void Directory::List()
+void Directory::List(bool recursive, int depth)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse)
-            printf("%s\n", table[i].name);
+    DirectoryBucket bucket;
+
+    for (int i = 0; i < (1 << header.globalDepth); i++)
+    {
+        ReadSector(table[i], &bucket);
+        if (i >= (1 << bucket.localDepth))
+            continue; // listed already
+
+        for (int j = 0; j < bucket.numEntries; j++)
+        {
+            DirectoryEntry *entry = &bucket.entries[j];
+
+            if (!recursive)
+            {
+                printf("%s\n", entry->name);
+                continue;
+            }
+            printf("%*s[%c] %s\n", 4 * depth, "", entry->isDir ? 'D' : 'F',
+                   entry->name);
+            if (entry->isDir)
+            {
+                OpenFile *subFile = new OpenFile(entry->sector);
+                Directory *sub = new Directory;
+
+                sub->FetchFrom(subFile);
+                sub->List(TRUE, depth + 1);
+                delete sub;
+                delete subFile;
+            }
+        }
+    }
 }
 
 //----------------------------------------------------------------------
@@ -180,15 +424,74 @@ void Directory::List()
 void Directory::Print()
 {
     FileHeader *hdr = new FileHeader;
+    DirectoryBucket bucket;
 
     printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse)
+    for (int i = 0; i < (1 << header.globalDepth); i++)
+    {
+        ReadSector(table[i], &bucket);
+        if (i >= (1 << bucket.localDepth))
+            continue; // printed already
+
+        for (int j = 0; j < bucket.numEntries; j++)
         {
-            printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-            hdr->FetchFrom(table[i].sector);
+            printf("Name: %s, Sector: %d%s\n", bucket.entries[j].name,
+                   bucket.entries[j].sector,
+                   bucket.entries[j].isDir ? ", Directory" : "");
+            hdr->FetchFrom(bucket.entries[j].sector);
             hdr->Print();
         }
+    }
     printf("\n");
     delete hdr;
 }
+
+//----------------------------------------------------------------------
+// Directory::ReadSector/WriteSector
+// 	Transfer one sector of the directory file.
+//
+//	"sector" -- the sector, counted within the directory file
+//	"into"/"from" -- SectorSize bytes
+//----------------------------------------------------------------------
+
+void Directory::ReadSector(int sector, void *into)
+{
+    (void)file->ReadAt((char *)into, SectorSize, sector * SectorSize);
+}
+
+void Directory::WriteSector(int sector, void *from)
+{
+    (void)file->WriteAt((char *)from, SectorSize, sector * SectorSize);
+}
+
+//----------------------------------------------------------------------
+// Directory::WriteHeader
+// 	Write back the header, at the start of the directory file.
+//----------------------------------------------------------------------
+
+void Directory::WriteHeader()
+{
+    (void)file->WriteAt((char *)&header, sizeof(header), 0);
+}
+
+//----------------------------------------------------------------------
+// Directory::WriteTable
+// 	Write back the table sectors holding entries first to last.
+//
+//	"first", "last" -- a range of table entries
+//----------------------------------------------------------------------
+
+void Directory::WriteTable(int first, int last)
+{
+    int size = 1 << header.globalDepth;
+
+    for (int i = first / BucketsPerTableSector; i <= last / BucketsPerTableSector; i++)
+    {
+        int chunk[BucketsPerTableSector];
+        int n = min(BucketsPerTableSector, size - i * BucketsPerTableSector);
+
+        memset(chunk, -1, sizeof(chunk));
+        memcpy(chunk, &table[i * BucketsPerTableSector], n * sizeof(int));
+        WriteSector(header.tableStart + i, chunk);
+    }
+}
@@ -1,10 +1,14 @@
 // directory.h
 //	Data structures to manage a UNIX-like directory of file names.
 //
-//      A directory is a table of pairs: <file name, sector #>,
+//      A directory is a set of pairs: <file name, sector #>,
 //	giving the name of each file in the directory, and
 //	where to find its file header (the data structure describing
-//	where to find the file's data blocks) on disk.
+//	where to find the file's data blocks) on disk.  An entry can
+//	itself be a directory, so directories form a tree.
+//
+//	The pairs are kept in an extendible hash table, so a lookup
+//	reads a single sector of the directory, however big it grows.
 //
 //      We assume mutual exclusion is provided by the caller.
 //
@@ -17,10 +21,15 @@
 #ifndef DIRECTORY_H
 #define DIRECTORY_H
 
+#include "disk.h"
 #include "openfile.h"
+#include "pbitmap.h"
+
+// for simplicity, we assume file names are <= 9 characters long
+#define FileNameMaxLen 9
 
-#define FileNameMaxLen 9 // for simplicity, we assume \
-                         // file names are <= 9 characters long
+extern unsigned HashName(char *name); // Hash of the first
+                                      //  FileNameMaxLen characters
 
 // The following class defines a "directory entry", representing a file
 // in the directory.  Each entry gives the name of the file, and where
@@ -32,61 +41,119 @@
 class DirectoryEntry
 {
 public:
-    bool inUse;                    // Is this directory entry in use?
+    bool isDir;                    // Is the file a directory?
     int sector;                    // Location on disk to find the
                                    //   FileHeader for this file
     char name[FileNameMaxLen + 1]; // Text name for file, with +1 for
                                    // the trailing '\0'
 };
 
+// The on-disk layout of a directory file:
+//
+//	file sector 0 -- a DirectoryHeader
+//	table -- the hash table, in consecutive file sectors: bucket i
+//		is at the file sector stored in table entry i
+//	buckets -- a DirectoryBucket each
+//
+// The table has 1 << globalDepth entries, indexed by the low bits of
+// the hash of a name.  A bucket with localDepth d is shared by every
+// table entry with the same d low bits.  When a bucket is full, it is
+// split on its next bit, doubling the table first if d = globalDepth.
+// Sectors are taken from the end of the file, which grows as needed;
+// a table that outgrows its sectors moves to the end, and its old
+// sectors are not reused.
+
+#define BucketsPerTableSector ((int)(SectorSize / sizeof(int)))
+#define MaxGlobalDepth 12 // 4096 buckets, far more than fit on the disk
+#define EntriesPerBucket ((int)((SectorSize - 2 * sizeof(int)) / sizeof(DirectoryEntry)))
+
+// Size of a new, empty directory file: header, table and one bucket.
+#define DirectoryFileSize (3 * SectorSize)
+
+class DirectoryHeader
+{
+public:
+    int globalDepth; // The table has 1 << globalDepth entries
+    int numEntries;  // Files in the directory
+    int numSectors;  // File sectors in use; the rest is room to grow
+    int tableStart;  // First file sector of the table
+};
+
+class DirectoryBucket
+{
+public:
+    int localDepth; // Low hash bits all its names share
+    int numEntries; // Entries in use, at the front
+    DirectoryEntry entries[EntriesPerBucket];
+};
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
-// The directory data structure can be stored in memory, or on disk.
-// When it is on disk, it is stored as a regular Nachos file.
-//
-// The constructor initializes a directory structure in memory; the
-// FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk.
+// The directory data structure is stored on disk as a regular Nachos
+// file.  In memory we keep its header and hash table; buckets are read
+// when a name hashes to them.  Every change is written straight back,
+// a sector at a time, so there is no WriteBack.
 
 class Directory
 {
 public:
-    Directory(int size); // Initialize an empty directory
-                         // with space for "size" files
-    ~Directory();        // De-allocate the directory
+    Directory();  // Initialize a directory not yet tied
+                  // to a file
+    ~Directory(); // De-allocate the directory
 
-    void FetchFrom(OpenFile *file); // Init directory contents from disk
-    void WriteBack(OpenFile *file); // Write modifications to
-                                    // directory contents back to disk
+    void Initialize(OpenFile *file); // Make "file" an empty directory,
+                                     // of DirectoryFileSize bytes
+    void FetchFrom(OpenFile *file);  // Init directory from its file
 
-    int Find(char *name); // Find the sector number of the
-                          // FileHeader for file: "name"
+    int Find(char *name, bool *isDir = NULL);
+    // Find the sector number of the
+    // FileHeader for file: "name"
 
-    bool Add(char *name, int newSector); // Add a file name into the directory
+    bool Add(char *name, int newSector, bool isDir, PersistentBitmap *freeMap);
+    // Add a file name into the directory,
+    // growing it from freeMap if needed
 
     bool Remove(char *name); // Remove a file from the directory
 
-    void List();  // Print the names of all the files
-                  //  in the directory
+    bool IsEmpty(); // Are there no files in it?
+
+    OpenFile *File() { return file; } // The directory file
+
+    void List(bool recursive = FALSE, int depth = 0);
+    // Print the names of all the files
+    //  in the directory, and if recursive,
+    //  of the directories below it
     void Print(); // Verbose print of the contents
                   //  of the directory -- all the file
                   //  names and their contents.
 
 private:
     /*
-		MP4 Hint:
-		Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
-		Disk part: table
-		In-core part: tableSize
+		Disk part: header, table, buckets
+		In-core part: file, and copies of header and table
 	*/
 
-    int tableSize;         // Number of directory entries
-    DirectoryEntry *table; // Table of pairs:
-                           // <file name, file header location>
-
-    int FindIndex(char *name); // Find the index into the directory
-                               //  table corresponding to "name"
+    OpenFile *file;         // The directory file
+    DirectoryHeader header; // Its header
+    int *table;             // Its hash table: file sector of each bucket,
+                            //  1 << globalDepth entries
+
+    int FindEntry(char *name, DirectoryBucket *bucket, int *bucketSector);
+    // Read the bucket for "name", return
+    //  the entry's index in it, or -1
+    bool Split(int index, DirectoryBucket *bucket, PersistentBitmap *freeMap);
+    // Split the full bucket at table[index]
+    bool DoubleTable(PersistentBitmap *freeMap); // Add one bit to the index
+    int NewSectors(int count, PersistentBitmap *freeMap);
+    // Take file sectors from the end,
+    //  or return -1
+
+    void ReadSector(int sector, void *into);  // Transfer one sector of
+    void WriteSector(int sector, void *from); //  the directory file
+    void WriteHeader();                       // Write back the header
+    void WriteTable(int first, int last);     // Write the table sectors
+                                              //  holding these entries
 };
 
 #endif // DIRECTORY_H
@@ -3,12 +3,12 @@
 //	would be called the i-node).
 //
 //	The file header is used to locate where on disk the
-//	file's data is stored.  We implement this as a fixed size
-//	table of pointers -- each entry in the table points to the
-//	disk sector containing that portion of the file data
-//	(in other words, there are no indirect or doubly indirect
-//	blocks). The table size is chosen so that the file header
-//	will be just big enough to fit in one disk sector,
+//	file's data is stored.  We implement this as a tree of
+//	extents -- each extent maps a run of file sectors to a run
+//	of consecutive disk sectors.  The header sector is the root;
+//	when a file has more extents than fit in it, they move to
+//	leaf blocks, and the header points to those (or to index
+//	blocks above them, up to MaxExtentDepth levels).
 //
 //      Unlike in a real system, we do not keep track of file permissions,
 //	ownership, last modification date, etc., in the file header.
@@ -26,12 +26,139 @@
 
 #include "filehdr.h"
 #include "debug.h"
-#include "synchdisk.h"
+#include "blockcache.h"
 #include "main.h"
 
-//   MP4 multilevel-scheme   //
-#define bytes_1_level NumDirect * SectorSize // 4KB
-#define bytes_2_level NumDirect * bytes_of_1_level // 115KB
+// Zeroes, to clear the sectors given to a new file.
+static char zeroSector[SectorSize];
+
+//----------------------------------------------------------------------
+// IndexBlocks
+// 	Return how many index and leaf blocks a tree of "count" extents
+//	needs on top of the header.
+//----------------------------------------------------------------------
+
+static int IndexBlocks(int count)
+{
+	int blocks = 0;
+
+	while (count > (int)NumHeaderExtents)
+	{
+		count = divRoundUp(count, NumBlockExtents);
+		blocks += count;
+	}
+	return blocks;
+}
+
+//----------------------------------------------------------------------
+// FindExtent
+// 	Return the entry covering a file sector, by binary search: the
+//	last one that starts at or before it.
+//
+//	"entries", "count" -- the sorted entries of one tree node
+//	"sector" -- the file sector
+//----------------------------------------------------------------------
+
+static int FindExtent(Extent *entries, int count, int sector)
+{
+	int low = 0, high = count - 1;
+
+	ASSERT(count > 0 && entries[0].offset <= sector);
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		if (entries[middle].offset <= sector)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	ASSERT(sector < entries[low].offset + entries[low].length);
+	return low;
+}
+
+//----------------------------------------------------------------------
+// FreeExtents
+// 	Clear in the free map every sector a tree node maps, and the blocks
+//	below it.
+//
+//	"entries", "count" -- the entries of the node
+//	"level" -- how many levels of blocks are below it
+//----------------------------------------------------------------------
+
+static void FreeExtents(PersistentBitmap *freeMap, Extent *entries, int count,
+						int level)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (level == 0)
+		{
+			for (int j = 0; j < entries[i].length; j++)
+			{
+				ASSERT(freeMap->Test(entries[i].start + j)); // ought to be marked!
+				freeMap->Clear(entries[i].start + j);
+			}
+			continue;
+		}
+
+		ExtentBlock block;
+		kernel->blockCache->ReadSector(entries[i].start, (char *)&block);
+		FreeExtents(freeMap, block.entries, block.numEntries, level - 1);
+		ASSERT(freeMap->Test(entries[i].start));
+		freeMap->Clear(entries[i].start);
+	}
+}
+
+//----------------------------------------------------------------------
+// CollectExtents
+// 	Append the extents of a tree node, and of the blocks below it, to
+//	a list, in file order.  If a free map is given, the blocks of the
+//	tree itself are cleared in it as they are passed.
+//
+//	"entries", "count" -- the entries of the node
+//	"level" -- how many levels of blocks are below it
+//	"extents", "numExtents" -- the list, and how many it holds
+//	"freeMap" -- where to free the tree blocks, or NULL
+//----------------------------------------------------------------------
+
+static void CollectExtents(Extent *entries, int count, int level,
+						   Extent *extents, int *numExtents,
+						   PersistentBitmap *freeMap)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (level == 0)
+		{
+			extents[(*numExtents)++] = entries[i];
+			continue;
+		}
+
+		ExtentBlock block;
+		kernel->blockCache->ReadSector(entries[i].start, (char *)&block);
+		CollectExtents(block.entries, block.numEntries, level - 1,
+					   extents, numExtents, freeMap);
+		if (freeMap != NULL)
+			freeMap->Clear(entries[i].start);
+	}
+}
+
+//----------------------------------------------------------------------
+// ExtentNode::ExtentNode
+// 	Initialize an in-core block with nothing loaded below it; the
+//	caller reads the block in.
+//----------------------------------------------------------------------
+
+ExtentNode::ExtentNode()
+{
+	for (int i = 0; i < (int)NumBlockExtents; i++)
+		children[i] = NULL;
+}
+
+ExtentNode::~ExtentNode()
+{
+	for (int i = 0; i < (int)NumBlockExtents; i++)
+		if (children[i] != NULL)
+			delete children[i];
+}
 
 //----------------------------------------------------------------------
 // MP4 mod tag
@@ -42,119 +169,277 @@
 //----------------------------------------------------------------------
 FileHeader::FileHeader()
 {
+	ASSERT((char *)children - (char *)this == SectorSize
+		   && sizeof(ExtentBlock) == SectorSize);
+
+	magic = FileHeaderMagic;
 	numBytes = -1;
 	numSectors = -1;
-	memset(dataSectors, -1, sizeof(dataSectors));
+	depth = 0;
+	numEntries = 0;
+	memset(entries, -1, sizeof(entries));
+	for (int i = 0; i < (int)NumHeaderExtents; i++)
+		children[i] = NULL;
+	cursor.length = 0;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	Free the in-core blocks of the tree.
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
+	Invalidate();
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Invalidate
+// 	Drop the in-core part, the loaded blocks and the cursor, because
+//	the tree on disk is about to change or has changed.
+//----------------------------------------------------------------------
+
+void FileHeader::Invalidate()
+{
+	for (int i = 0; i < (int)NumHeaderExtents; i++)
+	{
+		if (children[i] != NULL)
+			delete children[i];
+		children[i] = NULL;
+	}
+	cursor.length = 0;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 // 	Initialize a fresh file header for a newly created file.
-//	Allocate data blocks for the file out of the map of free disk blocks.
+//	Allocate data blocks for the file out of the map of free disk blocks,
+//	as few runs as possible: each is the best-fitting free run, or the
+//	largest one if none is big enough for the rest of the file.
 //	Return FALSE if there are not enough free blocks to accomodate
 //	the new file.
 //
 //	"freeMap" is the bit map of free disk sectors
-//	"fileSize" is the bit map of free disk sectors
+//	"fileSize" is the size of the file in bytes
 //----------------------------------------------------------------------
 
 bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 {
+	Extent *extents;
+	int count = 0;
+
 	numBytes = fileSize;
 	numSectors = divRoundUp(fileSize, SectorSize);
 	if (freeMap->NumClear() < numSectors)
 		return FALSE; // not enough space
-	/*
-	for (int i = 0; i < numSectors; i++)
+
+	extents = new Extent[numSectors + 1];
+	for (int done = 0; done < numSectors; done += extents[count++].length)
 	{
-		dataSectors[i] = freeMap->FindAndSet();
+		extents[count].offset = done;
+		extents[count].start = freeMap->FindAndSetRun(numSectors - done,
+													  &extents[count].length);
 		// since we checked that there was enough free space,
 		// we expect this to succeed
-		ASSERT(dataSectors[i] >= 0);
-	}*/
-
-	if(fileSize > bytes_1_level){
-		int i = 0;
-		// 4KB ~ 128KB
-		while(fileSize > 0){
-			dataSectors[i] = freeMap->FindAndSet();  // allocate sector to sub fileHeader
-			FileHeader* sub_FH = new FileHeader();
-
-			if(fileSize > bytes_1_level) { // if remaining fileSize is more than 4KB, allocate 4 KB to sub_FH
-				sub_FH->Allocate(freeMap, bytes_1_level);
-			}
-			else{  // if remaining size is less than 4KB, no need to allocate too more sectors to sub_FH
-				sub_FH->Allocate(freeMap, fileSize);
-			}
-			sub_FH->WriteBack(dataSectors[i]);
-			i++;
-			fileSize = fileSize - bytes_1_level;
-			//cout << fileSize << endl;
-		}
+		ASSERT(extents[count].start >= 0);
+	}
 
+	if (freeMap->NumClear() < IndexBlocks(count))
+	{ // no space left for the index blocks: give the data blocks back
+		for (int i = 0; i < count; i++)
+			for (int j = 0; j < extents[i].length; j++)
+				freeMap->Clear(extents[i].start + j);
+		delete[] extents;
+		return FALSE;
 	}
-	else{
-		// Original NachOS 4KB
-		for (int i = 0; i < numSectors; i++)
-		{
-			dataSectors[i] = freeMap->FindAndSet();
-			// since we checked that there was enough free space,
-			// we expect this to succeed
-			ASSERT(dataSectors[i] >= 0);
 
-			// clean the Disk sector we allocate
-			char* fresh = new char[SectorSize]();
-			kernel->synchDisk->WriteSector(dataSectors[i], fresh);
-			delete fresh;
+	// clean the disk sectors we allocate
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < extents[i].length; j++)
+			kernel->blockCache->WriteSector(extents[i].start + j, zeroSector);
 
-			// clean the allocate sector
+	Build(freeMap, extents, count);
+	delete[] extents;
+	return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Grow a file to "fileSize" bytes.  The new sectors continue the
+//	last extent if the sectors after it are free, otherwise they come
+//	from the best-fitting free runs; then the tree is rebuilt with the
+//	new extents.  Return FALSE, with nothing changed, if there is not
+//	enough free space.  The caller writes the header back.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"fileSize" is the new size of the file in bytes, at least the old
+//----------------------------------------------------------------------
+
+bool FileHeader::Extend(PersistentBitmap *freeMap, int fileSize)
+{
+	int newSectors = divRoundUp(fileSize, SectorSize);
+	int need = newSectors - numSectors;
+	Extent *extents;
+	int count = 0;
+
+	ASSERT(fileSize >= numBytes);
+	if (need == 0)
+	{
+		numBytes = fileSize;
+		return TRUE;
+	}
+
+	extents = new Extent[newSectors + 1];
+	CollectExtents(entries, numEntries, depth, extents, &count, NULL);
+	if (freeMap->NumClear() + IndexBlocks(count) < need + IndexBlocks(count + need))
+	{
+		delete[] extents;
+		return FALSE; // not enough space
+	}
+	count = 0;
+	CollectExtents(entries, numEntries, depth, extents, &count, freeMap);
+
+	for (int done = numSectors; done < newSectors;)
+	{
+		Extent *last = (count > 0) ? &extents[count - 1] : NULL;
+		int next = (last != NULL) ? last->start + last->length : NumSectors;
+
+		if (next < NumSectors && !freeMap->Test(next))
+		{ // the run goes on
+			freeMap->Mark(next);
+			last->length++;
+			kernel->blockCache->WriteSector(next, zeroSector);
+			done++;
+			continue;
 		}
+
+		extents[count].offset = done;
+		extents[count].start = freeMap->FindAndSetRun(newSectors - done,
+													  &extents[count].length);
+		ASSERT(extents[count].start >= 0);
+		for (int j = 0; j < extents[count].length; j++)
+			kernel->blockCache->WriteSector(extents[count].start + j, zeroSector);
+		done += extents[count++].length;
 	}
 
+	numBytes = fileSize;
+	numSectors = newSectors;
+	Build(freeMap, extents, count);
+	delete[] extents;
 	return TRUE;
 }
 
 //----------------------------------------------------------------------
-// FileHeader::Deallocate
-// 	De-allocate all the space allocated for data blocks for this file.
+// FileHeader::Adopt
+// 	Initialize a file header for a file whose data blocks are already
+//	allocated, merging consecutive sectors into extents.  Used to
+//	convert headers from an older layout.  Return FALSE if there are
+//	not enough free blocks for the index blocks.
 //
-//	"freeMap" is the bit map of free disk sectors
+//	"freeMap" is the bit map of free disk sectors; only needed when the
+//		extents don't all fit in the header
+//	"fileSize" is the size of the file in bytes
+//	"sectors" is the disk sector of each file sector, in file order
 //----------------------------------------------------------------------
 
-void FileHeader::Deallocate(PersistentBitmap *freeMap)
+bool FileHeader::Adopt(PersistentBitmap *freeMap, int fileSize, int *sectors)
 {
-	//cout << "deallocate\n";
-	if(numBytes > bytes_1_level){
-		int how_many_index_block = numSectors / NumDirect;
-		if(numSectors % NumDirect != 0 ){
-			how_many_index_block++;
-		}
-		for(int i = 0; i < how_many_index_block; i++){
-			FileHeader* sub_HF = new FileHeader();
-			sub_HF->FetchFrom(dataSectors[i]);
-			sub_HF->Deallocate(freeMap);
-			freeMap->Clear(dataSectors[i]);
+	Extent *extents;
+	int count = 0;
+	bool success;
+
+	numBytes = fileSize;
+	numSectors = divRoundUp(fileSize, SectorSize);
+
+	extents = new Extent[numSectors + 1];
+	for (int i = 0; i < numSectors; i++)
+	{
+		if (count > 0 && sectors[i] == extents[count - 1].start + extents[count - 1].length)
+		{
+			extents[count - 1].length++;
+			continue;
 		}
+		extents[count].offset = i;
+		extents[count].start = sectors[i];
+		extents[count].length = 1;
+		count++;
 	}
-	else{  // original NachOS deallocate	
-		for (int i = 0; i < numSectors; i++)
+
+	success = (IndexBlocks(count) == 0 || freeMap->NumClear() >= IndexBlocks(count));
+	if (success)
+		Build(freeMap, extents, count);
+	delete[] extents;
+	return success;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Build
+// 	Store the extents of the file.  While there are too many for the
+//	header, pack them into blocks of NumBlockExtents and go on with one
+//	index entry per block, one level up.  The caller has made sure
+//	there is space for the blocks.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"extents", "count" -- the extents of the file, sorted by offset
+//----------------------------------------------------------------------
+
+void FileHeader::Build(PersistentBitmap *freeMap, Extent *extents, int count)
+{
+	Extent *level = extents;
+
+	Invalidate();
+	magic = FileHeaderMagic;
+	depth = 0;
+	while (count > (int)NumHeaderExtents)
+	{
+		int numBlocks = divRoundUp(count, NumBlockExtents);
+		Extent *up = new Extent[numBlocks];
+
+		ASSERT(freeMap != NULL);
+		for (int b = 0; b < numBlocks; b++)
 		{
-			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
-			freeMap->Clear((int)dataSectors[i]);
+			ExtentBlock block;
+			Extent *first = &level[b * NumBlockExtents];
+
+			memset(&block, -1, sizeof(block));
+			block.numEntries = min((int)NumBlockExtents, count - b * (int)NumBlockExtents);
+			memcpy(block.entries, first, block.numEntries * sizeof(Extent));
+
+			up[b].offset = first->offset;
+			up[b].start = freeMap->FindAndSet();
+			up[b].length = first[block.numEntries - 1].offset
+						   + first[block.numEntries - 1].length - first->offset;
+			ASSERT(up[b].start >= 0);
+			kernel->blockCache->WriteSector(up[b].start, (char *)&block);
 		}
+
+		if (level != extents)
+			delete[] level;
+		level = up;
+		count = numBlocks;
+		depth++;
 	}
+	ASSERT(depth <= MaxExtentDepth);
+
+	memset(entries, -1, sizeof(entries));
+	memcpy(entries, level, count * sizeof(Extent));
+	numEntries = count;
+	if (level != extents)
+		delete[] level;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Deallocate
+// 	De-allocate all the space allocated for data blocks for this file,
+//	and the index blocks.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+void FileHeader::Deallocate(PersistentBitmap *freeMap)
+{
+	FreeExtents(freeMap, entries, numEntries, depth);
+	Invalidate();
 }
 
 //----------------------------------------------------------------------
@@ -166,13 +451,9 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 
 void FileHeader::FetchFrom(int sector)
 {
-	//cout << "fetchfrom\n";
-	kernel->synchDisk->ReadSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	// only the disk part, which comes first, is overwritten
+	kernel->blockCache->ReadSector(sector, (char *)this);
+	Invalidate();
 }
 
 //----------------------------------------------------------------------
@@ -184,17 +465,20 @@ void FileHeader::FetchFrom(int sector)
 
 void FileHeader::WriteBack(int sector)
 {
-	//cout << "writeback\n";
-	kernel->synchDisk->WriteSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	// only the disk part, which comes first, is written
+	kernel->blockCache->WriteSector(sector, (char *)this);
+	Invalidate();
+}
+
+//----------------------------------------------------------------------
+// FileHeader::IsValid
+// 	Return TRUE if the header was written in the extent layout; a
+//	header from an older layout has to be converted first.
+//----------------------------------------------------------------------
+
+bool FileHeader::IsValid()
+{
+	return magic == FileHeaderMagic;
 }
 
 //----------------------------------------------------------------------
@@ -204,21 +488,40 @@ void FileHeader::WriteBack(int sector)
 //	offset in the file) to a physical address (the sector where the
 //	data at the offset is stored).
 //
+//	A sector in the same extent as the last one costs nothing more.
+//	Otherwise walk down the extent tree; a block is read from disk
+//	the first time only, and kept in core below the header.
+//
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int FileHeader::ByteToSector(int offset)
 {
-	//cout << "ByteToSector\n";
-	if(numBytes > bytes_1_level){
-		FileHeader* sub_HF = new FileHeader();
-		int number = divRoundDown(offset, bytes_1_level);
-		sub_HF->FetchFrom(dataSectors[number]);
-		int sector_begin = bytes_1_level * number;
-		sub_HF->ByteToSector(offset - sector_begin);
+	int sector = offset / SectorSize;
+	Extent *level = entries;
+	ExtentNode **loaded = children;
+	int count = numEntries;
+
+	if (cursor.length > 0 && cursor.offset <= sector
+		&& sector < cursor.offset + cursor.length)
+		return cursor.start + (sector - cursor.offset);
+
+	for (int d = depth; d > 0; d--)
+	{
+		int i = FindExtent(level, count, sector);
+
+		if (loaded[i] == NULL)
+		{
+			loaded[i] = new ExtentNode;
+			kernel->blockCache->ReadSector(level[i].start, (char *)&loaded[i]->block);
+		}
+		level = loaded[i]->block.entries;
+		count = loaded[i]->block.numEntries;
+		loaded = loaded[i]->children;
 	}
-	else
-		return (dataSectors[offset / SectorSize]);
+
+	cursor = level[FindExtent(level, count, sector)];
+	return cursor.start + (sector - cursor.offset);
 }
 
 //----------------------------------------------------------------------
@@ -239,17 +542,17 @@ int FileHeader::FileLength()
 
 void FileHeader::Print()
 {
-	//cout << "Print\n";
 	int i, j, k;
 	char *data = new char[SectorSize];
 
-	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
+	printf("FileHeader contents.  File size: %d.  Tree depth: %d.  File blocks:\n",
+		   numBytes, depth);
 	for (i = 0; i < numSectors; i++)
-		printf("%d ", dataSectors[i]);
+		printf("%d ", ByteToSector(i * SectorSize));
 	printf("\nFile contents:\n");
 	for (i = k = 0; i < numSectors; i++)
 	{
-		kernel->synchDisk->ReadSector(dataSectors[i], data);
+		kernel->blockCache->ReadSector(ByteToSector(i * SectorSize), data);
 		for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 		{
 			if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -17,19 +17,68 @@
 #include "disk.h"
 #include "pbitmap.h"
 
-#define NumDirect ((SectorSize - 2 * sizeof(int)) / sizeof(int))
-#define MaxFileSize (NumDirect * SectorSize)
+// Marks a header in the extent layout; older disks have a sector
+// number in its place, see FileSystem::Migrate.
+#define FileHeaderMagic 0x45585431 // "EXT1"
+
+// A run of consecutive file sectors stored in consecutive disk sectors.
+// In the interior of an extent tree the same record describes a child
+// block instead: "start" is the sector holding it, and the run is every
+// file sector the child maps.
+
+class Extent
+{
+public:
+	int offset; // First file sector of the run
+	int start;	// Disk sector holding it, or the child block
+	int length; // Number of file sectors in the run
+};
+
+#define NumHeaderExtents ((SectorSize - 5 * sizeof(int)) / sizeof(Extent))
+#define NumBlockExtents ((SectorSize - 2 * sizeof(int)) / sizeof(Extent))
+#define MaxExtentDepth 3
+
+// One sector of an extent tree below the file header: an index block,
+// or at the bottom a leaf block of extents.
+
+class ExtentBlock
+{
+public:
+	int numEntries; // Number of entries in use
+	int unused;		// Pads the block to a whole sector
+	Extent entries[NumBlockExtents];
+};
+
+// An extent block brought into memory, with the blocks below it that
+// have been looked at so far.
+
+class ExtentNode
+{
+public:
+	ExtentNode();
+	~ExtentNode(); // Also frees the nodes below
+
+	ExtentBlock block;
+	ExtentNode *children[NumBlockExtents]; // Loaded children, or NULL
+};
 
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks.
+// The file header is organized as a tree of extents, sorted by file
+// sector: with depth 0 the header itself holds the extents; otherwise
+// it holds index entries, each pointing to a block one level further
+// down.  The allocator hands out the best-fitting free run, so most
+// files are a single extent.
 //
 // The file header data structure can be stored in memory or on disk.
 // When it is on disk, it is stored in a single sector -- this means
 // that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// as one disk sector.  Up to NumHeaderExtents extents fit in it, and
+// every level of index blocks multiplies that by NumBlockExtents.
+//
+// In memory, the blocks of the tree are kept once they have been read,
+// and the last extent found is remembered, so a sequential scan maps
+// each sector without any search or disk read.
 //
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
@@ -45,12 +94,19 @@ public:
 	bool Allocate(PersistentBitmap *bitMap, int fileSize); // Initialize a file header,
 														   //  including allocating space
 														   //  on disk for the file data
-	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's
-														   //  data blocks
+	bool Adopt(PersistentBitmap *bitMap, int fileSize, int *sectors);
+	// Initialize a file header for data
+	//  already on disk, in "sectors"
+	bool Extend(PersistentBitmap *bitMap, int fileSize);
+	// Grow the file to fileSize bytes,
+	//  allocating the new data blocks
+	void Deallocate(PersistentBitmap *bitMap); // De-allocate this file's
+											   //  data blocks
 
 	void FetchFrom(int sectorNumber); // Initialize file header from disk
 	void WriteBack(int sectorNumber); // Write modifications to file header
 									  //  back to disk
+	bool IsValid();					  // Is it in the extent layout?
 
 	int ByteToSector(int offset); // Convert a byte offset into the file
 								  // to the disk sector containing
@@ -62,25 +118,31 @@ public:
 	void Print(); // Print the contents of the file.
 
 private:
+	void Build(PersistentBitmap *bitMap, Extent *extents, int count);
+	// Store sorted extents, adding index
+	//  blocks if the header can't hold them
+	void Invalidate(); // Forget the in-core part
+
 	/*
-		MP4 hint:
-		You will need a data structure to store more information in a header.
-		Fields in a class can be separated into disk part and in-core part.
-		Disk part are data that will be written into disk.
-		In-core part are data only lies in memory, and are used to maintain the data structure of this class.
-		In order to implement a data structure, you will need to add some "in-core" data
-		to maintain data structure.
-		
-		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
-		written to a sector on disk.
-		In-core part - none
-		
+		Disk Part - magic, numBytes, numSectors, depth, numEntries and
+		entries occupy exactly 128 bytes and will be written to a sector
+		on disk.  They must come first.
+		In-core part - children and cursor, a cache of the tree below
+		the header, loaded as ByteToSector walks it.
 	*/
 
-	int numBytes;				// Number of bytes in the file
-	int numSectors;				// Number of data sectors in the file
-	int dataSectors[NumDirect]; // Disk sector numbers for each data
-								// block in the file
+	int magic;		// FileHeaderMagic
+	int numBytes;	// Number of bytes in the file
+	int numSectors; // Number of data sectors in the file
+	int depth;		// Levels of index blocks below the header
+	int numEntries; // Number of entries in use
+	Extent entries[NumHeaderExtents]; // Extents, or index entries if
+									  // depth > 0
+
+	ExtentNode *children[NumHeaderExtents]; // Loaded blocks below the
+											// entries, or NULL
+	Extent cursor; // Last extent ByteToSector found,
+				   // length 0 if none
 };
 
 #endif // FILEHDR_H
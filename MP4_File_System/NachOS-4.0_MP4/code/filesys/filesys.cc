@@ -19,22 +19,24 @@
 //	on bootup.
 //
 //	The file system assumes that the bitmap and directory files are
-//	kept "open" continuously while Nachos is running.
+//	kept "open" continuously while Nachos is running.  The bitmap and
+//	the root directory are also kept in memory from mount on, and
+//	changed in place.
 //
 //	For those operations (such as Create, Remove) that modify the
-//	directory and/or bitmap, if the operation succeeds, the changes
-//	are written immediately back to disk (the two files are kept
-//	open during all this time).  If the operation fails, and we have
-//	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	directory and/or bitmap, the changed sectors are written back
+//	to disk as the operation finishes: a directory writes each
+//	sector as it changes it, and the bitmap writes the sectors that
+//	differ from what is on disk.  If the operation fails, it undoes
+//	what it changed in the bitmap before writing it back.
 //
 // 	Our implementation at this point has the following restrictions:
 //
 //	   there is no synchronization for concurrent accesses
 //	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
+//	     (only directories grow, as names are added)
+//	   files cannot be bigger than the free space left on the disk
+//	   names are at most FileNameMaxLen characters per path component
 //	   there is no attempt to make the system robust to failures
 //	    (if Nachos exits in the middle of an operation that modifies
 //	    the file system, it may corrupt the disk)
@@ -51,6 +53,9 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "blockcache.h"
+#include "dircache.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
@@ -58,12 +63,34 @@
 #define FreeMapSector 0
 #define DirectorySector 1
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// Initial file size for the bitmap; directories start at
+// DirectoryFileSize and grow as names are added.
 #define FreeMapFileSize (NumSectors / BitsInByte)
-#define NumDirEntries 10
-#define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
+
+// The file header layout before extents: a table of data sectors, or
+// for a file over OldMaxFileSize bytes, a table of sub-headers in the
+// same layout, each mapping the next OldMaxFileSize bytes.
+#define OldNumDirect ((SectorSize - 2 * sizeof(int)) / sizeof(int))
+#define OldMaxFileSize ((int)OldNumDirect * SectorSize)
+
+class OldFileHeader
+{
+public:
+    int numBytes;
+    int numSectors;
+    int dataSectors[OldNumDirect];
+};
+
+// The root directory before hashing: a table of OldNumDirEntries entries.
+#define OldNumDirEntries 10
+
+class OldDirectoryEntry
+{
+public:
+    bool inUse;
+    int sector;
+    char name[FileNameMaxLen + 1];
+};
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -73,7 +100,8 @@
 //	not all of the sectors marked as free).
 //
 //	If format = FALSE, we just have to open the files
-//	representing the bitmap and the directory.
+//	representing the bitmap and the directory.  A disk formatted
+//	before file headers held extents is converted first.
 //
 //	"format" -- should we initialize the disk?
 //----------------------------------------------------------------------
@@ -81,14 +109,16 @@
 FileSystem::FileSystem(bool format)
 {
     DEBUG(dbgFile, "Initializing the file system.");
+    dirCache = new DirCache;
+    for (int i = 0; i < MaxOpenFiles; i++)
+        openFiles[i] = NULL;
     if (format)
     {
-        PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
         FileHeader *mapHdr = new FileHeader;
         FileHeader *dirHdr = new FileHeader;
-        the_file_is_open = NULL;
         DEBUG(dbgFile, "Formatting the file system.");
+        freeMap = new PersistentBitmap(NumSectors);
+        directory = new Directory;
 
         // First, allocate space for FileHeaders for the directory and bitmap
         // (make sure no one else grabs these!)
@@ -121,198 +151,512 @@ FileSystem::FileSystem(bool format)
         // of each file back to disk.  The directory at this point is completely
         // empty; but the bitmap has been changed to reflect the fact that
         // sectors on the disk have been allocated for the file headers and
-        // to hold the file data for the directory and bitmap.
+        // to hold the file data for the directory and bitmap.  Both stay
+        // in memory from now on.
 
         DEBUG(dbgFile, "Writing bitmap and directory back to disk.");
         freeMap->WriteBack(freeMapFile); // flush changes to disk
-        directory->WriteBack(directoryFile);
+        directory->Initialize(directoryFile);
 
         if (debug->IsEnabled('f'))
         {
             freeMap->Print();
             directory->Print();
         }
-        delete freeMap;
-        delete directory;
         delete mapHdr;
         delete dirHdr;
     }
     else
     {
-        // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        FileHeader *mapHdr = new FileHeader;
+
+        mapHdr->FetchFrom(FreeMapSector);
+        if (!mapHdr->IsValid())
+            Migrate(); // opens and reads the bitmap and directory
+        else
+        {
+            // if we are not formatting the disk, just open the files
+            // representing the bitmap and directory, and read them in;
+            // these are left open while Nachos is running
+            freeMapFile = new OpenFile(FreeMapSector);
+            directoryFile = new OpenFile(DirectorySector);
+            freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+            directory = new Directory;
+            directory->FetchFrom(directoryFile);
+        }
+        delete mapHdr;
     }
 }
 
+//----------------------------------------------------------------------
+// OldDataSectors
+// 	List the data sectors of a file in the old header layout, in file
+//	order, and free its sub-headers in the bitmap.  Return the file
+//	size in bytes.
+//
+//	"sector" -- the old file header
+//	"sectors" -- set to the data sector of every file sector
+//	"freeMap" -- where to free the sub-headers, NULL to leave them
+//----------------------------------------------------------------------
+
+static int OldDataSectors(int sector, int *sectors, PersistentBitmap *freeMap)
+{
+    OldFileHeader hdr, sub;
+    int count = 0;
+
+    kernel->blockCache->ReadSector(sector, (char *)&hdr);
+    if (hdr.numBytes <= OldMaxFileSize)
+    {
+        for (int i = 0; i < hdr.numSectors; i++)
+            sectors[count++] = hdr.dataSectors[i];
+        return hdr.numBytes;
+    }
+
+    for (int i = 0; i < divRoundUp(hdr.numBytes, OldMaxFileSize); i++)
+    {
+        kernel->blockCache->ReadSector(hdr.dataSectors[i], (char *)&sub);
+        for (int j = 0; j < sub.numSectors; j++)
+            sectors[count++] = sub.dataSectors[j];
+        if (freeMap != NULL)
+            freeMap->Clear(hdr.dataSectors[i]);
+    }
+    return hdr.numBytes;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Migrate
+// 	Rewrite every file header on a disk formatted with the table
+//	layout as an extent tree, in place.  File data stays where it is;
+//	consecutive sectors just become one extent.  Sub-headers of large
+//	files are freed, and index blocks allocated if a file is too
+//	fragmented for its header.
+//
+//	The bitmap and directory are small enough to need no index
+//	blocks, so they are converted first, and then read through the
+//	new headers.  Last, the root directory table is rewritten as a
+//	hashed directory.  The bitmap and directory are left open, and
+//	in memory, as after mounting a new disk.
+//----------------------------------------------------------------------
+
+void FileSystem::Migrate()
+{
+    int *sectors = new int[NumSectors];
+    OldDirectoryEntry table[OldNumDirEntries];
+    FileHeader *hdr = new FileHeader;
+    int size;
+    bool success;
+
+    DEBUG(dbgFile, "Converting the file system to extents.");
+
+    size = OldDataSectors(FreeMapSector, sectors, NULL);
+    success = hdr->Adopt(NULL, size, sectors);
+    ASSERT(success);
+    hdr->WriteBack(FreeMapSector);
+    freeMapFile = new OpenFile(FreeMapSector);
+    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+
+    size = OldDataSectors(DirectorySector, sectors, freeMap);
+    success = hdr->Adopt(freeMap, size, sectors);
+    ASSERT(success);
+    hdr->WriteBack(DirectorySector);
+    directoryFile = new OpenFile(DirectorySector);
+    directoryFile->ReadAt((char *)table, sizeof(table), 0);
+
+    for (int i = 0; i < OldNumDirEntries; i++)
+    {
+        if (!table[i].inUse)
+            continue;
+        size = OldDataSectors(table[i].sector, sectors, freeMap);
+        success = hdr->Adopt(freeMap, size, sectors);
+        ASSERT(success);
+        hdr->WriteBack(table[i].sector);
+    }
+
+    success = directoryFile->Grow(freeMap, DirectoryFileSize);
+    ASSERT(success);
+    directory = new Directory;
+    directory->Initialize(directoryFile);
+    for (int i = 0; i < OldNumDirEntries; i++)
+    {
+        if (!table[i].inUse)
+            continue;
+        success = directory->Add(table[i].name, table[i].sector, FALSE, freeMap);
+        ASSERT(success);
+    }
+
+    freeMap->WriteBack(freeMapFile);
+    delete hdr;
+    delete[] sectors;
+}
+
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileSystem::~FileSystem
+//	Let go of the in-memory state.  No I/O: by now the block cache is
+//	flushed, and anything written through it would be lost.  See
+//	FileSystem::Sync.
 //----------------------------------------------------------------------
 FileSystem::~FileSystem()
 {
+    delete freeMap;
+    delete directory;
+    delete dirCache;
+    for (int i = 0; i < MaxOpenFiles; i++)
+        delete openFiles[i];
     delete freeMapFile;
     delete directoryFile;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::Sync
+// 	Write the free map kept in memory back to its file, through the
+//	block cache.  Called by Interrupt::Halt before the cache is
+//	flushed for the last time.
+//----------------------------------------------------------------------
+
+void FileSystem::Sync()
+{
+    freeMap->WriteBack(freeMapFile);
+}
+
 //----------------------------------------------------------------------
 // FileSystem::Create
 // 	Create a file in the Nachos file system (similar to UNIX create).
 //	Since we can't increase the size of files dynamically, we have
 //	to give Create the initial size of the file.
 //
+//	Return TRUE if everything goes ok, otherwise, return FALSE.
+//	See CreateEntry for the steps, and when it fails.
+//
+//	"name" -- path of file to be created
+//	"initialSize" -- size of file to be created
+//----------------------------------------------------------------------
+
+bool FileSystem::Create(char *name, int initialSize)
+{
+    DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
+    return CreateEntry(name, initialSize, FALSE);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CreateDirectory
+// 	Create an empty directory (similar to UNIX mkdir).  Return TRUE
+//	if everything goes ok, otherwise, return FALSE.
+//
+//	"name" -- path of directory to be created
+//----------------------------------------------------------------------
+
+bool FileSystem::CreateDirectory(char *name)
+{
+    DEBUG(dbgFile, "Creating directory " << name);
+    return CreateEntry(name, DirectoryFileSize, TRUE);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CreateEntry
+// 	Create a file or a directory.
+//
 //	The steps to create a file are:
+//	  Find the directory it goes in
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
 // 	  Allocate space on disk for the data blocks for the file
-//	  Add the name to the directory
-//	  Store the new file header on disk
-//	  Flush the changes to the bitmap and the directory back to disk
-//
-//	Return TRUE if everything goes ok, otherwise, return FALSE.
+//	  Store the new file header on disk (and lay out an empty
+//	    directory in it, for a directory)
+//	  Add the name to the directory, which may grow it
+//	  Flush the changes to the bitmap back to disk
 //
 // 	Create fails if:
+//		a directory on the path doesn't exist
 //   		file is already in directory
 //	 	no free space for file header
-//	 	no free entry for file in directory
 //	 	no free space for data blocks for the file
+//	 	no space to grow the directory
 //
 // 	Note that this implementation assumes there is no concurrent access
 //	to the file system!
 //
-//	"name" -- name of file to be created
-//	"initialSize" -- size of file to be created
+//	"name" -- path of file to be created
+//	"size" -- size of file to be created
+//	"isDir" -- create a directory?
 //----------------------------------------------------------------------
 
-bool FileSystem::Create(char *name, int initialSize)
+bool FileSystem::CreateEntry(char *name, int size, bool isDir)
 {
-    Directory *directory;
-    PersistentBitmap *freeMap;
+    char leaf[FileNameMaxLen + 1];
+    Directory *parentDir;
     FileHeader *hdr;
-    int sector;
+    int parent, sector;
     bool success;
 
-    DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
+    parent = WalkTo(name, leaf);
+    if (parent == -1 || leaf[0] == '\0')
+        return FALSE; // no such directory, or no name in it
+    if (FindIn(parent, leaf, NULL) != -1)
+        return FALSE; // file is already in directory
 
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    sector = freeMap->FindAndSet(); // find a sector to hold the file header
+    if (sector == -1)
+        return FALSE; // no free block for file header
 
-    if (directory->Find(name) != -1)
-        success = FALSE; // file is already in directory
-    else
+    hdr = new FileHeader;
+    if (!hdr->Allocate(freeMap, size))
     {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet(); // find a sector to hold the file header
-        if (sector == -1)
-            success = FALSE; // no free block for file header
-        else if (!directory->Add(name, sector))
-            success = FALSE; // no space in directory
-        else
-        {
-            hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, initialSize))
-                success = FALSE; // no space on disk for data
-            else
-            {
-                success = TRUE;
-                // everthing worked, flush all changes back to disk
-                hdr->WriteBack(sector);
-                directory->WriteBack(directoryFile);
-                freeMap->WriteBack(freeMapFile);
-            }
-            delete hdr;
-        }
-        delete freeMap;
+        freeMap->Clear(sector);
+        delete hdr;
+        return FALSE; // no space on disk for data
     }
-    delete directory;
+
+    hdr->WriteBack(sector);
+    if (isDir)
+    {
+        OpenFile *newFile = new OpenFile(sector);
+        Directory *newDirectory = new Directory;
+
+        newDirectory->Initialize(newFile);
+        delete newDirectory;
+        delete newFile;
+    }
+    parentDir = OpenDirectory(parent);
+    success = parentDir->Add(leaf, sector, isDir, freeMap);
+    CloseDirectory(parentDir);
+    if (success)
+        dirCache->Enter(parent, leaf, sector, isDir);
+    else
+    { // no space in directory
+        hdr->Deallocate(freeMap);
+        freeMap->Clear(sector);
+    }
+    // the directory may have grown, even if Add failed
+    freeMap->WriteBack(freeMapFile);
+    delete hdr;
     return success;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::WalkTo
+// 	Follow a path down from the root directory, one component at a
+//	time, to the directory holding its last component.  Return the
+//	sector of that directory's header, or -1 if a directory on the
+//	way doesn't exist.
+//
+//	"path" -- the path, e.g. "/a/b/c"; the leading '/' is optional
+//	"leaf" -- set to the last component ("c"), or "" if the path
+//		ends in '/'
+//----------------------------------------------------------------------
+
+int FileSystem::WalkTo(char *path, char *leaf)
+{
+    int sector = DirectorySector;
+    char *next;
+
+    while (*path == '/')
+        path++;
+    while ((next = strchr(path, '/')) != NULL)
+    {
+        char component[FileNameMaxLen + 1];
+        bool isDir;
+
+        strncpy(component, path, min((int)(next - path), FileNameMaxLen));
+        component[min((int)(next - path), FileNameMaxLen)] = '\0';
+        sector = FindIn(sector, component, &isDir);
+        if (sector == -1 || !isDir)
+            return -1;
+
+        for (path = next; *path == '/'; path++)
+            ;
+    }
+    strncpy(leaf, path, FileNameMaxLen);
+    leaf[FileNameMaxLen] = '\0';
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Lookup
+// 	Return the sector of the file header for a path, or -1 if there
+//	is no such file.  "/" is the root directory.
+//
+//	"path" -- the path to look up
+//	"isDir" -- set to whether the file is a directory
+//----------------------------------------------------------------------
+
+int FileSystem::Lookup(char *path, bool *isDir)
+{
+    char leaf[FileNameMaxLen + 1];
+    int parent = WalkTo(path, leaf);
+
+    *isDir = TRUE;
+    if (parent == -1 || leaf[0] == '\0')
+        return parent; // the directory itself
+    return FindIn(parent, leaf, isDir);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FindIn
+// 	Return the sector of the file header for a name in a directory,
+//	or -1 if there is no such name.  The answer comes from the name
+//	cache if it has it; otherwise the directory is read, and the
+//	answer cached, whether the name was found or not.
+//
+//	"parent" -- the directory's header sector
+//	"name" -- the name to look up
+//	"dirFlag" -- if not NULL, set to whether the file is a directory
+//----------------------------------------------------------------------
+
+int FileSystem::FindIn(int parent, char *name, bool *dirFlag)
+{
+    Directory *dir;
+    bool isDir = FALSE;
+    int sector;
+
+    if (!dirCache->Lookup(parent, name, &sector, &isDir))
+    {
+        dir = OpenDirectory(parent);
+        sector = dir->Find(name, &isDir);
+        CloseDirectory(dir);
+        dirCache->Enter(parent, name, sector, isDir);
+    }
+    if (dirFlag != NULL)
+        *dirFlag = isDir;
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::OpenDirectory/CloseDirectory
+// 	Read in a directory, and let go of it again.  The root directory
+//	is the one kept in memory all the time, so that there is one
+//	in-core copy of it, and of its file header, as it grows.
+//
+//	"sector" -- the directory's file header
+//	"dir" -- a directory returned by OpenDirectory
+//----------------------------------------------------------------------
+
+Directory * FileSystem::OpenDirectory(int sector)
+{
+    Directory *dir;
+
+    if (sector == DirectorySector)
+        return directory;
+    dir = new Directory;
+    dir->FetchFrom(new OpenFile(sector));
+    return dir;
+}
+
+void FileSystem::CloseDirectory(Directory *dir)
+{
+    OpenFile *dirFile = dir->File();
+
+    if (dir == directory)
+        return;
+    delete dir;
+    delete dirFile;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::Open
 // 	Open a file for reading and writing.
 //	To open a file:
-//	  Find the location of the file's header, using the directory
+//	  Find the location of the file's header, using the directories
+//	    on its path
 //	  Bring the header into memory
 //
-//	"name" -- the text name of the file to be opened
+//	Directories cannot be opened this way.
+//
+//	"name" -- the path of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile * FileSystem::Open(char *name)
 {
-    Directory *directory = new Directory(NumDirEntries);
     OpenFile *openFile = NULL;
+    bool isDir;
     int sector;
 
     DEBUG(dbgFile, "Opening file" << name);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name);
-    if (sector >= 0)
+    sector = Lookup(name, &isDir);
+    if (sector >= 0 && !isDir)
         openFile = new OpenFile(sector); // name was found in directory
-    the_file_is_open = openFile;
-    delete directory;
     return openFile; // return NULL if not found
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Remove
 // 	Delete a file from the file system.  This requires:
-//	    Remove it from the directory
+//	    Remove it from its directory
 //	    Delete the space for its header
 //	    Delete the space for its data blocks
-//	    Write changes to directory, bitmap back to disk
+//	    Write changes to bitmap back to disk
 //
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
-//	in the file system.
+//	in the file system, is a directory that is not empty, or is
+//	open in a user program.
 //
-//	"name" -- the text name of the file to be removed
+//	"name" -- the path of the file to be removed
 //----------------------------------------------------------------------
 
 bool FileSystem::Remove(char *name)
 {
-    Directory *directory;
-    PersistentBitmap *freeMap;
+    char leaf[FileNameMaxLen + 1];
+    Directory *parentDir;
     FileHeader *fileHdr;
-    int sector;
+    int parent, sector;
+    bool isDir;
 
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name);
+    parent = WalkTo(name, leaf);
+    if (parent == -1 || leaf[0] == '\0')
+        return FALSE; // no such directory, or the root
+    sector = FindIn(parent, leaf, &isDir);
     if (sector == -1)
-    {
-        delete directory;
         return FALSE; // file not found
+    for (int i = 0; i < MaxOpenFiles; i++)
+        if (openFiles[i] != NULL && openSectors[i] == sector)
+            return FALSE; // file in use
+    if (isDir)
+    {
+        Directory *dir = OpenDirectory(sector);
+        bool empty = dir->IsEmpty();
+
+        CloseDirectory(dir);
+        if (!empty)
+            return FALSE; // directory not empty
+        dirCache->Purge(sector);
     }
     fileHdr = new FileHeader;
     fileHdr->FetchFrom(sector);
 
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-
     fileHdr->Deallocate(freeMap); // remove data blocks
     freeMap->Clear(sector);       // remove header block
-    directory->Remove(name);
+    parentDir = OpenDirectory(parent);
+    parentDir->Remove(leaf); // written back as it changes
+    CloseDirectory(parentDir);
+    dirCache->Enter(parent, leaf, -1, FALSE);
 
-    freeMap->WriteBack(freeMapFile);     // flush to disk
-    directory->WriteBack(directoryFile); // flush to disk
+    freeMap->WriteBack(freeMapFile); // flush to disk
     delete fileHdr;
-    delete directory;
-    delete freeMap;
     return TRUE;
 }
 
 //----------------------------------------------------------------------
 // FileSystem::List
-// 	List all the files in the file system directory.
+// 	List all the files in a directory.
+//
+//	"name" -- the path of the directory
+//	"recursive" -- list the directories below it too?
 //----------------------------------------------------------------------
 
-void FileSystem::List()
+void FileSystem::List(char *name, bool recursive)
 {
-    Directory *directory = new Directory(NumDirEntries);
+    Directory *dir;
+    bool isDir;
+    int sector = Lookup(name, &isDir);
 
-    directory->FetchFrom(directoryFile);
-    directory->List();
-    delete directory;
+    if (sector == -1 || !isDir)
+    {
+        printf("List: no directory %s\n", name);
+        return;
+    }
+    dir = OpenDirectory(sector);
+    dir->List(recursive);
+    CloseDirectory(dir);
 }
 
 //----------------------------------------------------------------------
@@ -329,8 +673,6 @@ void FileSystem::Print()
 {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
 
     printf("Bit map file header:\n");
     bitHdr->FetchFrom(FreeMapSector);
@@ -342,25 +684,68 @@ void FileSystem::Print()
 
     freeMap->Print();
 
-    directory->FetchFrom(directoryFile);
     directory->Print();
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
-    delete directory;
 }
 
-int FileSystem::Write(char *buffer, int size, OpenFileId id){
-    return the_file_is_open->Write(buffer, size);
-}
+//----------------------------------------------------------------------
+// FileSystem::OpenShared
+// 	Open a file for a user program, in the system-wide open-file
+//	table.  A file has one entry, and so one OpenFile, however many
+//	descriptors in however many address spaces refer to it; each
+//	descriptor keeps its own position, and uses ReadAt/WriteAt.
+//
+//	Return the index of the entry, or -1 if there is no such file,
+//	it is a directory, or the table is full.
+//
+//	"name" -- the path of the file to be opened
+//----------------------------------------------------------------------
 
-int FileSystem::Read(char *buffer, int size, OpenFileId id){
-    return the_file_is_open->Read(buffer, size);
+int FileSystem::OpenShared(char *name)
+{
+    bool isDir;
+    int sector = Lookup(name, &isDir);
+    int index = -1;
+
+    if (sector == -1 || isDir)
+        return -1;
+    for (int i = 0; i < MaxOpenFiles; i++)
+    {
+        if (openFiles[i] != NULL && openSectors[i] == sector)
+        {
+            openCounts[i]++; // open already
+            return i;
+        }
+        if (openFiles[i] == NULL && index == -1)
+            index = i;
+    }
+    if (index == -1)
+        return -1; // table full
+
+    DEBUG(dbgFile, "Opening file " << name << " as open file " << index);
+    openFiles[index] = new OpenFile(sector);
+    openSectors[index] = sector;
+    openCounts[index] = 1;
+    return index;
 }
 
-int FileSystem::Close(OpenFileId id){
-    delete the_file_is_open;
-    return 1;
+//----------------------------------------------------------------------
+// FileSystem::CloseShared
+// 	Drop one descriptor's use of an open file, and close the file
+//	when it was the last.
+//
+//	"index" -- the open file, as returned by OpenShared
+//----------------------------------------------------------------------
+
+void FileSystem::CloseShared(int index)
+{
+    ASSERT(openFiles[index] != NULL && openCounts[index] > 0);
+    if (--openCounts[index] == 0)
+    {
+        delete openFiles[index];
+        openFiles[index] = NULL;
+    }
 }
 #endif // FILESYS_STUB
@@ -18,9 +18,9 @@
 //	file system (in a file named "DISK").
 //
 //	In the "real" implementation, there are two key data structures used
-//	in the file system.  There is a single "root" directory, listing
-//	all of the files in the file system; unlike UNIX, the baseline
-//	system does not provide a hierarchical directory structure.
+//	in the file system.  There is a "root" directory, at the top of a
+//	UNIX-like tree of directories; a file is named by its path from
+//	the root, such as "/a/b/c".
 //	In addition, there is a bitmap for allocating
 //	disk sectors.  Both the root directory and the bitmap are themselves
 //	stored as files in the Nachos file system -- this causes an interesting
@@ -37,6 +37,10 @@
 #include "sysdep.h"
 #include "openfile.h"
 
+class PersistentBitmap;
+class Directory;
+class DirCache;
+
 typedef int OpenFileId;
 
 #ifdef FILESYS_STUB // Temporarily implement file system calls as
@@ -76,6 +80,10 @@ public:
 };
 
 #else // FILESYS
+
+// Files user programs can have open at once, across all of them.
+#define MaxOpenFiles 32
+
 class FileSystem
 {
 public:
@@ -85,38 +93,65 @@ public:
 							 // If "format", there is nothing on
 							 // the disk, so initialize the directory
 							 // and the bitmap of free blocks.
+							 // Otherwise a disk in the old header
+							 // layout is converted to extents.
 	// MP4 mod tag
 	~FileSystem();
 
 	bool Create(char *name, int initialSize);
 	// Create a file (UNIX creat)
 
+	bool CreateDirectory(char *name); // Create a directory (UNIX mkdir)
+
 	OpenFile *Open(char *name); // Open a file (UNIX open)
 
 	bool Remove(char *name); // Delete a file (UNIX unlink)
 
-	//   MP4    //
-	int Read(char* buffer, int size, OpenFileId id);
-
-	int Write(char* buffer, int size, OpenFileId id);
-
-	int Close(OpenFileId id);
+	int OpenShared(char *name); // Open a file for a user program;
+								// return its index in the open-file
+								// table, or -1
+	OpenFile *SharedFile(int index) { return openFiles[index]; }
+	// The open file at an index
+	void CloseShared(int index); // Drop one use of an open file
 
-	//    MP4    //
 
-
-	void List(); // List all the files in the file system
+	void List(char *name, bool recursive); // List all the files in a
+										   //  directory, and if recursive,
+										   //  in the directories below it
 
 	void Print(); // List all the files and their contents
 
-private:
+	void Sync(); // Write what is kept in memory through
+				 // the block cache, before it is flushed
 
-	OpenFile * the_file_is_open;
+private:
+	void Migrate(); // Convert every file header from the
+					// table layout to extents
+
+	bool CreateEntry(char *name, int size, bool isDir);
+	// Create a file or a directory
+	int WalkTo(char *path, char *leaf);
+	// Find the directory holding the
+	//  last component of path
+	int Lookup(char *path, bool *isDir); // Find the header of a path
+	int FindIn(int parent, char *name, bool *dirFlag);
+	// Find a name in a directory,
+	//  through the name cache
+	Directory *OpenDirectory(int sector); // Read in a directory,
+	void CloseDirectory(Directory *dir);  //  and let go of it
 
 	OpenFile *freeMapFile;	 // Bit map of free disk blocks,
 							 // represented as a file
 	OpenFile *directoryFile; // "Root" directory -- list of
 							 // file names, represented as a file
+
+	PersistentBitmap *freeMap; // The bitmap and root directory,
+	Directory *directory;	   //  kept in memory while mounted
+	DirCache *dirCache;		   // Names looked up in directories
+
+	OpenFile *openFiles[MaxOpenFiles]; // Files open by user programs,
+	int openSectors[MaxOpenFiles];	   //  their header sectors, and how
+	int openCounts[MaxOpenFiles];	   //  many descriptors use each
 };
 
 #endif // FILESYS
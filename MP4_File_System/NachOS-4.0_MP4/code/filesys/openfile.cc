@@ -7,6 +7,11 @@
 //	Also as in UNIX, for convenience, we keep the file header in
 //	memory while the file is open.
 //
+//	ReadAt watches a reader's reads, given its ReadAheadState.  While
+//	they are sequential, the sectors after them are read into the
+//	cache ahead of need, in a window that doubles with each read; any
+//	other read shuts it.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -16,7 +21,7 @@
 #include "main.h"
 #include "filehdr.h"
 #include "openfile.h"
-#include "synchdisk.h"
+#include "blockcache.h"
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
@@ -30,6 +35,7 @@ OpenFile::OpenFile(int sector)
 {
     hdr = new FileHeader;
     hdr->FetchFrom(sector);
+    hdrSector = sector;
     seekPosition = 0;
 }
 
@@ -71,7 +77,7 @@ void OpenFile::Seek(int position)
 
 int OpenFile::Read(char *into, int numBytes)
 {
-    int result = ReadAt(into, numBytes, seekPosition);
+    int result = ReadAt(into, numBytes, seekPosition, &readAhead);
     seekPosition += result;
     return result;
 }
@@ -93,27 +99,30 @@ int OpenFile::Write(char *into, int numBytes)
 //	boundary; however the disk only knows how to read/write a whole disk
 //	sector at a time.  Thus:
 //
-//	For ReadAt:
-//	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
-//	For WriteAt:
-//	   We must first read in any sectors that will be partially written,
-//	   so that we don't overwrite the unmodified portion.  We then copy
-//	   in the data that will be modified, and write back all the full
-//	   or partial sectors that are part of the request.
+//	The sectors the request covers completely are transferred straight
+//	between the caller's buffer and the cache, a run of physically
+//	consecutive sectors at a time, so a large transfer of a contiguous
+//	file costs one disk request instead of one per sector.
+//
+//	A sector the request covers only partly goes through a one-sector
+//	buffer: ReadAt copies out the part we are interested in, and
+//	WriteAt first reads the sector in, so that we don't overwrite the
+//	unmodified portion, then copies in the new bytes and writes it back.
 //
 //	"into" -- the buffer to contain the data to be read from disk
 //	"from" -- the buffer containing the data to be written to disk
 //	"numBytes" -- the number of bytes to transfer
 //	"position" -- the offset within the file of the first byte to be
 //			read/written
+//	"state" -- the reader's read-ahead state, or NULL not to read ahead
 //----------------------------------------------------------------------
 
-int OpenFile::ReadAt(char *into, int numBytes, int position)
+int OpenFile::ReadAt(char *into, int numBytes, int position,
+                     ReadAheadState *state)
 {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int sector, offset, count, done;
+    char buf[SectorSize];
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
@@ -121,28 +130,36 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
-    firstSector = divRoundDown(position, SectorSize);
-    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
+    for (done = 0; done < numBytes; done += count)
+    {
+        sector = divRoundDown(position + done, SectorSize);
+        offset = (position + done) - sector * SectorSize;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
-
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete[] buf;
+        if (offset != 0 || numBytes - done < SectorSize)
+        { // partial sector: copy the part we want
+            count = min(SectorSize - offset, numBytes - done);
+            kernel->blockCache->ReadSector(hdr->ByteToSector(sector * SectorSize), buf);
+            bcopy(&buf[offset], &into[done], count);
+        }
+        else
+        { // whole sectors: read them in place
+            int run = ContiguousRun(sector, (numBytes - done) / SectorSize);
+            kernel->blockCache->ReadSectors(hdr->ByteToSector(sector * SectorSize),
+                                            &into[done], run);
+            count = run * SectorSize;
+        }
+    }
+    if (state != NULL)
+        ReadAhead(state, divRoundDown(position, SectorSize),
+                  divRoundDown(position + numBytes - 1, SectorSize));
     return numBytes;
 }
 
 int OpenFile::WriteAt(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int sector, offset, count, done;
+    char buf[SectorSize];
 
     if ((numBytes <= 0) || (position >= fileLength))
         return 0; // check request
@@ -150,33 +167,97 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
         numBytes = fileLength - position;
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
-    firstSector = divRoundDown(position, SectorSize);
-    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
+    for (done = 0; done < numBytes; done += count)
+    {
+        sector = divRoundDown(position + done, SectorSize);
+        offset = (position + done) - sector * SectorSize;
 
-    buf = new char[numSectors * SectorSize];
+        if (offset != 0 || numBytes - done < SectorSize)
+        { // partial sector: read, modify, write back
+            int diskSector = hdr->ByteToSector(sector * SectorSize);
 
-    memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
+            count = min(SectorSize - offset, numBytes - done);
+            kernel->blockCache->ReadSector(diskSector, buf);
+            bcopy(&from[done], &buf[offset], count);
+            kernel->blockCache->WriteSector(diskSector, buf);
+        }
+        else
+        { // whole sectors: write them from the caller's buffer
+            int run = ContiguousRun(sector, (numBytes - done) / SectorSize);
+            kernel->blockCache->WriteSectors(hdr->ByteToSector(sector * SectorSize),
+                                             &from[done], run);
+            count = run * SectorSize;
+        }
+    }
+    return numBytes;
+}
 
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+//----------------------------------------------------------------------
+// OpenFile::ContiguousRun
+// 	Return how many file sectors, starting at "sector" and at most
+//	"maxSectors", are stored in consecutive disk sectors, so they can
+//	be transferred together.  At least one.
+//
+//	"sector" -- the first sector, counted within the file
+//	"maxSectors" -- the longest run the caller wants
+//----------------------------------------------------------------------
 
-    // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+int OpenFile::ContiguousRun(int sector, int maxSectors)
+{
+    int first = hdr->ByteToSector(sector * SectorSize);
+    int run = 1;
 
-    // copy in the bytes we want to change
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+    while (run < maxSectors
+           && hdr->ByteToSector((sector + run) * SectorSize) == first + run)
+        run++;
+    return run;
+}
 
-    // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
-    delete[] buf;
-    return numBytes;
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Called after each read by a reader that keeps a ReadAheadState.
+//	A read that starts where the reader's last one
+//	stopped (or in its last sector, for reads smaller than a sector)
+//	is sequential: it doubles the read-ahead window, between
+//	MinReadAhead and MaxReadAhead.  Any other read shuts the window.
+//
+//	While the window is open, the file sectors after the read, as far
+//	as the window reaches, are handed to the cache to prefetch; those
+//	already asked for by an earlier read are not asked for again.
+//	Each run of consecutive disk sectors is one prefetch.
+//
+//	"state" -- the reader's past reads, updated for this one
+//	"first" -- the first file sector read
+//	"last" -- the last file sector read
+//----------------------------------------------------------------------
+
+void OpenFile::ReadAhead(ReadAheadState *state, int first, int last)
+{
+    int numSectors = divRoundUp(hdr->FileLength(), SectorSize);
+    int sector, end;
+
+    if (first == state->nextSector || first == state->nextSector - 1)
+        state->window = (state->window == 0) ? MinReadAhead
+                                             : min(2 * state->window, MaxReadAhead);
+    else
+    {
+        state->window = 0;
+        state->aheadUntil = 0;
+    }
+    state->nextSector = last + 1;
+    if (state->window == 0)
+        return;
+
+    sector = max(state->nextSector, state->aheadUntil);
+    end = min(state->nextSector + state->window, numSectors);
+    while (sector < end)
+    {
+        int run = ContiguousRun(sector, end - sector);
+
+        kernel->blockCache->Prefetch(hdr->ByteToSector(sector * SectorSize), run);
+        sector += run;
+    }
+    state->aheadUntil = max(state->aheadUntil, end);
 }
 
 //----------------------------------------------------------------------
@@ -189,4 +270,24 @@ int OpenFile::Length()
     return hdr->FileLength();
 }
 
+//----------------------------------------------------------------------
+// OpenFile::Grow
+// 	Extend the file to "numBytes" bytes, if it is shorter, and write
+//	its header back.  The new bytes read as zeroes.  Return FALSE if
+//	the disk is too full.  The caller writes the free map back.
+//
+//	"freeMap" -- the bit map of free disk sectors
+//	"numBytes" -- the length the file must have
+//----------------------------------------------------------------------
+
+bool OpenFile::Grow(PersistentBitmap *freeMap, int numBytes)
+{
+    if (numBytes <= hdr->FileLength())
+        return TRUE;
+    if (!hdr->Extend(freeMap, numBytes))
+        return FALSE;
+    hdr->WriteBack(hdrSector);
+    return TRUE;
+}
+
 #endif //FILESYS_STUB
@@ -73,7 +73,38 @@ private:
 };
 
 #else // FILESYS
+
+// Bounds on how many sectors are read ahead of a sequential reader.
+// The window starts small, and doubles with each sequential read up
+// to about a track.
+#define MinReadAhead 2
+#define MaxReadAhead SectorsPerTrack
+
+// What one reader's reads have been: whether they are sequential, and
+// how far ahead of them the cache has been filled.  It belongs with the
+// reader's position -- an OpenFile keeps one for its own Read, and a
+// user program one per file descriptor -- so that readers sharing an
+// OpenFile do not shut each other's windows.
+class ReadAheadState
+{
+public:
+	ReadAheadState() { Reset(); }
+	void Reset()
+	{
+		nextSector = 0;
+		window = 0;
+		aheadUntil = 0;
+	}
+
+	int nextSector; // File sector after the last one read
+	int window;		// Sectors to keep read ahead, 0 if the
+					// reads are not sequential
+	int aheadUntil; // File sectors before this are being,
+					// or have been, read ahead
+};
+
 class FileHeader;
+class PersistentBitmap;
 
 class OpenFile
 {
@@ -91,9 +122,12 @@ public:
 										// and increment position in file.
 	int Write(char *from, int numBytes);
 
-	int ReadAt(char *into, int numBytes, int position);
+	int ReadAt(char *into, int numBytes, int position,
+			   ReadAheadState *state = NULL);
 	// Read/write bytes from the file,
 	// bypassing the implicit position.
+	// A read given the reader's state
+	// also reads ahead for it
 	int WriteAt(char *from, int numBytes, int position);
 
 	int Length(); // Return the number of bytes in the
@@ -101,9 +135,22 @@ public:
 				  // than the UNIX idiom -- lseek to
 				  // end of file, tell, lseek back
 
+	bool Grow(PersistentBitmap *freeMap, int numBytes);
+	// Make the file at least numBytes long
+
 private:
+	int ContiguousRun(int sector, int maxSectors);
+	// How many file sectors from "sector"
+	// on lie in consecutive disk sectors
+	void ReadAhead(ReadAheadState *state, int first, int last);
+	// Note that file sectors first..last
+	// were read, and prefetch what follows
+	// if the reads are sequential
+
 	FileHeader *hdr;  // Header for this file
+	int hdrSector;	  // Where the header is on disk
 	int seekPosition; // Current position within the file
+	ReadAheadState readAhead; // How Read has been reading
 };
 
 #endif // FILESYS
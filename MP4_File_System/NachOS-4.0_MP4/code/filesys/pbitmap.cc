@@ -8,6 +8,8 @@
 
 #include "copyright.h"
 #include "pbitmap.h"
+#include "debug.h"
+#include "disk.h"
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -21,6 +23,8 @@
 
 PersistentBitmap::PersistentBitmap(int numItems) : Bitmap(numItems)
 {
+    onDisk = new unsigned int[numWords];
+    onDiskKnown = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -40,7 +44,8 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    onDisk = new unsigned int[numWords];
+    FetchFrom(file);
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +55,7 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems) : Bitmap(numIte
 
 PersistentBitmap::~PersistentBitmap()
 {
+    delete[] onDisk;
 }
 
 //----------------------------------------------------------------------
@@ -62,16 +68,76 @@ PersistentBitmap::~PersistentBitmap()
 void PersistentBitmap::FetchFrom(OpenFile *file)
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    memcpy(onDisk, map, numWords * sizeof(unsigned));
+    onDiskKnown = TRUE;
+    Recount();
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
 // 	Store the contents of a persistent bitmap to a Nachos file.
+//	Only the sectors that changed since the bitmap was last read or
+//	written are written, so a bitmap kept in memory is cheap to
+//	write back after every change.
 //
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
 
 void PersistentBitmap::WriteBack(OpenFile *file)
 {
-    file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    int numBytes = numWords * sizeof(unsigned);
+    char *now = (char *)map, *then = (char *)onDisk;
+
+    for (int offset = 0; offset < numBytes; offset += SectorSize)
+    {
+        int length = min(SectorSize, numBytes - offset);
+
+        if (onDiskKnown && !memcmp(now + offset, then + offset, length))
+            continue; // sector unchanged
+        file->WriteAt(now + offset, length, offset);
+    }
+    memcpy(onDisk, map, numBytes);
+    onDiskKnown = TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::FindAndSetRun
+// 	Allocate a run of consecutive clear bits, so that a file can be
+//	laid out in as few extents as possible.  Of the runs at least
+//	"wanted" long, take the shortest (best fit); if there is none,
+//	take the longest run, and the caller asks again for the rest.
+//
+//	Return the first bit of the run, -1 if no bits are clear.
+//
+//	"wanted" is the number of bits the caller still needs
+//	"length" is set to the number of bits actually set
+//----------------------------------------------------------------------
+
+int PersistentBitmap::FindAndSetRun(int wanted, int *length)
+{
+    int best = -1, bestLength = 0;
+    int start, end, i;
+
+    ASSERT(wanted > 0);
+    for (start = NextClear(0); start != -1 && bestLength != wanted;
+         start = NextClear(end))
+    {
+        end = NextSet(start);
+
+        int run = end - start;
+        bool better = (run >= wanted) ? (bestLength < wanted || run < bestLength)
+                                      : (bestLength < wanted && run > bestLength);
+        if (better)
+        {
+            best = start;
+            bestLength = run;
+        }
+    }
+
+    if (best == -1)
+        return -1;
+    *length = min(bestLength, wanted);
+    for (i = best; i < best + *length; i++)
+        Mark(i);
+    return best;
 }
@@ -31,6 +31,15 @@ public:
 
     void FetchFrom(OpenFile *file); // read bitmap from the disk
     void WriteBack(OpenFile *file); // write bitmap contents to disk
+
+    int FindAndSetRun(int wanted, int *length); // Set the best-fitting
+                                                // run of clear bits, or
+                                                // the longest if none fits
+
+private:
+    unsigned int *onDisk; // the map as last read or written, so
+                          // WriteBack can skip unchanged sectors
+    bool onDiskKnown;     // FALSE until the map is read or written
 };
 
 #endif // PBITMAP_H
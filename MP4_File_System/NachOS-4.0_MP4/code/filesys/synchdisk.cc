@@ -5,10 +5,12 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Every request carries its own completion, a semaphore or an
+//	object to call back.  Because the physical disk can only handle
+//	one operation at a time, requests are queued; the interrupt
+//	handler of one request starts the next, chosen by the scheduler
+//	from where the head is.  The queue is shared with the interrupt
+//	handler, so it is protected by disabling interrupts, not a lock.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,18 +18,92 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "main.h"
+
+static int Track(int sector) { return sector / SectorsPerTrack; }
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Describe a transfer of a run of consecutive sectors.
+//
+//	"sectorNumber" -- the first disk sector to read or write
+//	"numSectors" -- how many sectors
+//	"data" -- the buffer the sectors are read into or written from
+//	"writing" -- is this a write?
+//	"toCall" -- called back when done; NULL to Wait instead
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int sectorNumber, int numSectors, char *data,
+                         bool writing, CallBackObj *toCall)
+{
+    ASSERT((sectorNumber >= 0) && (numSectors > 0)
+           && (sectorNumber + numSectors <= NumSectors));
+
+    sector = sectorNumber;
+    count = numSectors;
+    this->data = data;
+    this->writing = writing;
+    callWhenDone = toCall;
+    done = (toCall == NULL) ? new Semaphore("disk request", 0) : NULL;
+}
+
+DiskRequest::~DiskRequest()
+{
+    if (done != NULL)
+        delete done;
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::Wait
+// 	Wait until the disk has finished the request.
+//----------------------------------------------------------------------
+
+void DiskRequest::Wait()
+{
+    ASSERT(done != NULL);
+    done->P();
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::Complete
+// 	Tell whoever is waiting that the request is done.  Called from
+//	the disk interrupt handler.
+//----------------------------------------------------------------------
+
+void DiskRequest::Complete()
+{
+    if (callWhenDone != NULL)
+        callWhenDone->CallBack();
+    else
+        done->V();
+}
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
 //	initializing the physical disk.
 //
+//	"scheduler" -- how to order queued requests: "fifo", "sstf",
+//		"scan" or "clook"; NULL means clook
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk()
+SynchDisk::SynchDisk(char *scheduler)
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
+    if (scheduler == NULL || strcmp(scheduler, "clook") == 0)
+        this->scheduler = DiskCLOOK;
+    else if (strcmp(scheduler, "fifo") == 0)
+        this->scheduler = DiskFIFO;
+    else if (strcmp(scheduler, "sstf") == 0)
+        this->scheduler = DiskSSTF;
+    else if (strcmp(scheduler, "scan") == 0)
+        this->scheduler = DiskSCAN;
+    else
+        ASSERTNOTREACHED();
+
+    pending = new List<DiskRequest *>;
+    current = NULL;
+    headSector = 0;
+    ascending = TRUE;
     disk = new Disk(this);
 }
 
@@ -40,8 +116,7 @@ SynchDisk::SynchDisk()
 SynchDisk::~SynchDisk()
 {
     delete disk;
-    delete lock;
-    delete semaphore;
+    delete pending;
 }
 
 //----------------------------------------------------------------------
@@ -55,10 +130,7 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    ReadSectors(sectorNumber, data, 1);
 }
 
 //----------------------------------------------------------------------
@@ -72,19 +144,169 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    WriteSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read a run of consecutive disk sectors into a buffer, as one disk
+//	request.  Return only after all of them have been read.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"data" -- the buffer to hold them, numSectors * SectorSize bytes
+//	"numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int sectorNumber, char *data, int numSectors)
+{
+    DiskRequest request(sectorNumber, numSectors, data, FALSE);
+
+    Submit(&request);
+    request.Wait(); // wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write a buffer into a run of consecutive disk sectors, as one disk
+//	request.  Return only after all of them have been written.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"data" -- their new contents, numSectors * SectorSize bytes
+//	"numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteSectors(int sectorNumber, char *data, int numSectors)
+{
+    DiskRequest request(sectorNumber, numSectors, data, TRUE);
+
+    Submit(&request);
+    request.Wait(); // wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Submit
+// 	Queue a request, starting the disk if it is idle.  Returns right
+//	away; the request's completion is signalled from the interrupt
+//	handler.  The request must stay allocated until then.
+//
+//	"request" -- the transfer to do
+//----------------------------------------------------------------------
+
+void SynchDisk::Submit(DiskRequest *request)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    pending->Append(request);
+    if (current == NULL)
+        StartNext();
+
+    (void)kernel->interrupt->SetLevel(oldLevel);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Keep the disk busy with the next request
+//	before telling the owner of the finished one.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack()
 {
-    semaphore->V();
+    DiskRequest *finished = current;
+
+    current = NULL;
+    if (!pending->IsEmpty())
+        StartNext();
+    finished->Complete();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Send the request the scheduler picks to the disk.  Called with
+//	interrupts off, while the disk is idle.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartNext()
+{
+    ASSERT(current == NULL);
+
+    current = NextRequest();
+    // the head ends up on the last sector of the run; the disk charges
+    // the seek time itself
+    headSector = current->sector + current->count - 1;
+
+    if (current->writing)
+        disk->WriteRequest(current->sector, current->data, current->count);
+    else
+        disk->ReadRequest(current->sector, current->data, current->count);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::NextRequest
+// 	Remove and return the pending request to serve next.  Sectors on
+//	one track are taken in increasing order, so the head passes them
+//	in a single rotation.
+//
+//	SSTF picks the nearest track.  SCAN and C-LOOK take the lowest
+//	sector at or above the head; when there is none, SCAN turns
+//	around and takes the highest sector below it, C-LOOK jumps back
+//	to the lowest pending sector.
+//----------------------------------------------------------------------
+
+DiskRequest *SynchDisk::NextRequest()
+{
+    ListIterator<DiskRequest *> iter(pending);
+    DiskRequest *best = NULL;
+
+    if (scheduler == DiskFIFO)
+        return pending->RemoveFront();
+
+    for (; !iter.IsDone(); iter.Next())
+    {
+        DiskRequest *request = iter.Item();
+        int sector = request->sector;
+
+        switch (scheduler)
+        {
+        case DiskSSTF:
+        {
+            int distance = abs(Track(sector) - Track(headSector));
+            if (best == NULL
+                || distance < abs(Track(best->sector) - Track(headSector))
+                || (Track(sector) == Track(best->sector) && sector < best->sector))
+                best = request;
+            break;
+        }
+        case DiskSCAN:
+            if (ascending ? sector < headSector : sector > headSector)
+                break;
+            if (best == NULL
+                || (ascending ? sector < best->sector : sector > best->sector))
+                best = request;
+            break;
+        case DiskCLOOK:
+            if (sector < headSector)
+                break;
+            if (best == NULL || sector < best->sector)
+                best = request;
+            break;
+        default:
+            ASSERTNOTREACHED();
+        }
+    }
+
+    if (best == NULL && scheduler == DiskSCAN)
+    {
+        ascending = !ascending; // nothing left this way, turn around
+        return NextRequest();
+    }
+    if (best == NULL) // C-LOOK wraps around to the lowest sector
+    {
+        ListIterator<DiskRequest *> wrap(pending);
+        for (; !wrap.IsDone(); wrap.Next())
+            if (best == NULL || wrap.Item()->sector < best->sector)
+                best = wrap.Item();
+    }
+
+    pending->Remove(best);
+    return best;
 }
@@ -14,6 +14,42 @@
 #include "disk.h"
 #include "synch.h"
 #include "callback.h"
+#include "list.h"
+
+// The order in which queued requests are sent to the disk.
+
+enum DiskSchedulerType
+{
+    DiskFIFO,  // arrival order
+    DiskSSTF,  // shortest seek first
+    DiskSCAN,  // elevator: keep moving one way, reverse at the last request
+    DiskCLOOK  // move up only, then jump back to the lowest request
+};
+
+// One read or write of a run of consecutive sectors.  The requesting
+// thread either waits for it (Wait), or passes an object to be called
+// back from the disk interrupt handler when it is done.
+
+class DiskRequest
+{
+public:
+    DiskRequest(int sectorNumber, int numSectors, char *data, bool writing,
+                CallBackObj *toCall = NULL);
+    ~DiskRequest();
+
+    void Wait();     // Block until the request is done,
+                     // only if there is nobody to call back
+    void Complete(); // Called when the disk is done with it
+
+    int sector;    // the first sector to transfer
+    int count;     // how many sectors, sector upwards
+    char *data;    // where the sectors come from or go to
+    bool writing;  // write rather than read?
+
+private:
+    CallBackObj *callWhenDone; // who to tell once done, or NULL
+    Semaphore *done;           // otherwise, what Wait waits on
+};
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -24,33 +60,49 @@
 //
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
-// returning.
+// returning.  Requests from many threads are queued, and whenever the
+// disk becomes free the scheduler picks the next one by head position.
 
 class SynchDisk : public CallBackObj
 {
 public:
-    SynchDisk();  // Initialize a synchronous disk,
-                  // by initializing the raw Disk.
+    SynchDisk(char *scheduler = NULL); // Initialize a synchronous disk,
+                                       // by initializing the raw Disk.
+                                       // "scheduler" is fifo, sstf,
+                                       // scan or clook (the default)
     ~SynchDisk(); // De-allocate the synch disk data
 
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
     // only once the data is actually read
-    // or written.  These call
-    // Disk::ReadRequest/WriteRequest and
-    // then wait until the request is done.
+    // or written.  These queue a request
+    // and wait until it is done.
     void WriteSector(int sectorNumber, char *data);
 
+    void ReadSectors(int sectorNumber, char *data, int numSectors);
+    // Read/write numSectors consecutive
+    // sectors as a single request: one
+    // seek, then they stream past the head
+    void WriteSectors(int sectorNumber, char *data, int numSectors);
+
+    void Submit(DiskRequest *request); // Queue a request and return at
+                                       // once; it completes later
+
     void CallBack(); // Called by the disk device interrupt
                      // handler, to signal that the
                      // current disk operation is complete.
 
 private:
-    Disk *disk;           // Raw disk device
-    Semaphore *semaphore; // To synchronize requesting thread
-                          // with the interrupt handler
-    Lock *lock;           // Only one read/write request
-                          // can be sent to the disk at a time
+    Disk *disk; // Raw disk device
+
+    DiskSchedulerType scheduler;
+    List<DiskRequest *> *pending; // Queued requests, in arrival order
+    DiskRequest *current;         // On the disk now, or NULL
+    int headSector;               // Last sector of the request started last
+    bool ascending;               // SCAN direction
+
+    DiskRequest *NextRequest(); // Remove the request to serve next
+    void StartNext();           // Send it to the disk
 };
 
 #endif // SYNCHDISK_H
@@ -31,10 +31,8 @@ Bitmap::Bitmap(int numItems)
     {
         map[i] = 0; // initialize map to keep Purify happy
     }
-    for (i = 0; i < numBits; i++)
-    {
-        Clear(i);
-    }
+    summary = new unsigned int[divRoundUp(numWords, BitsInWord)];
+    Recount();
 }
 
 //----------------------------------------------------------------------
@@ -45,6 +43,7 @@ Bitmap::Bitmap(int numItems)
 Bitmap::~Bitmap()
 {
     delete[] map;
+    delete[] summary;
 }
 
 //----------------------------------------------------------------------
@@ -56,9 +55,17 @@ Bitmap::~Bitmap()
 
 void Bitmap::Mark(int which)
 {
+    int word = which / BitsInWord;
+    unsigned int bit = 1u << (which % BitsInWord);
+
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (map[word] & bit)
+        return;
+    map[word] |= bit;
+    numClear--;
+    if (FreeBits(word) == 0)
+        summary[word / BitsInWord] |= 1u << (word % BitsInWord);
 
     ASSERT(Test(which));
 }
@@ -72,9 +79,18 @@ void Bitmap::Mark(int which)
 
 void Bitmap::Clear(int which)
 {
+    int word = which / BitsInWord;
+    unsigned int bit = 1u << (which % BitsInWord);
+
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (!(map[word] & bit))
+        return;
+    map[word] &= ~bit;
+    numClear++;
+    summary[word / BitsInWord] &= ~(1u << (word % BitsInWord));
+    if (word < hint)
+        hint = word;
 
     ASSERT(!Test(which));
 }
@@ -90,7 +106,7 @@ bool Bitmap::Test(int which) const
 {
     ASSERT(which >= 0 && which < numBits);
 
-    if (map[which / BitsInWord] & (1 << (which % BitsInWord)))
+    if (map[which / BitsInWord] & (1u << (which % BitsInWord)))
     {
         return TRUE;
     }
@@ -107,16 +123,47 @@ bool Bitmap::Test(int which) const
 //	(In other words, find and allocate a bit.)
 //
 //	If no bits are clear, return -1.
+//
+//	The search starts at the hint, the lowest word that may have a
+//	clear bit.
 //----------------------------------------------------------------------
 
 int Bitmap::FindAndSet()
 {
-    for (int i = 0; i < numBits; i++)
+    int which = NextClear(hint * BitsInWord);
+
+    if (which == -1)
     {
-        if (!Test(i))
+        hint = numWords;
+        return -1;
+    }
+    hint = which / BitsInWord;
+    Mark(which);
+    return which;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetRange
+// 	Find the first run of "n" consecutive clear bits, and set them.
+//	Return the number of the first bit of the run, or -1 if there is
+//	no run that long.
+//
+//	"n" is the length of the run wanted.
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetRange(int n)
+{
+    int start, end;
+
+    ASSERT(n > 0);
+    for (start = NextClear(hint * BitsInWord); start != -1; start = NextClear(end))
+    {
+        end = NextSet(start);
+        if (end - start >= n)
         {
-            Mark(i);
-            return i;
+            for (int i = start; i < start + n; i++)
+                Mark(i);
+            return start;
         }
     }
     return -1;
@@ -130,16 +177,109 @@ int Bitmap::FindAndSet()
 
 int Bitmap::NumClear() const
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++)
+//----------------------------------------------------------------------
+// Bitmap::NextClear
+// 	Return the number of the first clear bit at or after "from", or
+//	-1 if there is none.  Full words are skipped through the summary,
+//	a word of it at a time.
+//
+//	"from" is the bit to start from.
+//----------------------------------------------------------------------
+
+int Bitmap::NextClear(int from) const
+{
+    int word = from / BitsInWord;
+    unsigned int free;
+
+    if (from >= numBits)
+        return -1;
+
+    free = FreeBits(word) & (~0u << (from % BitsInWord));
+    if (free != 0)
+        return word * BitsInWord + __builtin_ctz(free);
+
+    for (word++; word < numWords; word++)
     {
-        if (!Test(i))
+        int s = word / BitsInWord;
+        unsigned int open = ~summary[s] & (~0u << (word % BitsInWord));
+
+        if (open == 0)
         {
-            count++;
+            word = (s + 1) * BitsInWord - 1; // all full, next summary word
+            continue;
         }
+        word = s * BitsInWord + __builtin_ctz(open);
+        if (word >= numWords)
+            break;
+        return word * BitsInWord + __builtin_ctz(FreeBits(word));
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NextSet
+// 	Return the number of the first set bit at or after "from", or
+//	numBits if there is none.
+//
+//	"from" is the bit to start from.
+//----------------------------------------------------------------------
+
+int Bitmap::NextSet(int from) const
+{
+    for (int word = from / BitsInWord; word < numWords; word++)
+    {
+        unsigned int used = ~FreeBits(word);
+
+        if (word == from / BitsInWord)
+            used &= ~0u << (from % BitsInWord);
+        if (used != 0)
+            return min(word * BitsInWord + __builtin_ctz(used), numBits);
+    }
+    return numBits;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FreeBits
+// 	Return the clear bits of a word of the map, leaving out the bits
+//	of the last word that lie past the end of the bitmap.
+//
+//	"word" is the index of the word in the map.
+//----------------------------------------------------------------------
+
+unsigned int Bitmap::FreeBits(int word) const
+{
+    unsigned int free = ~map[word];
+
+    if (word == numWords - 1 && numBits % BitsInWord != 0)
+        free &= (1u << (numBits % BitsInWord)) - 1;
+    return free;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::Recount
+// 	Recompute the clear count, the hint and the summary from the map.
+//	Needed whenever the map is changed other than through Mark and
+//	Clear, as when it is read from disk.
+//----------------------------------------------------------------------
+
+void Bitmap::Recount()
+{
+    numClear = 0;
+    hint = 0;
+    for (int s = 0; s < divRoundUp(numWords, BitsInWord); s++)
+        summary[s] = 0;
+
+    for (int word = 0; word < numWords; word++)
+    {
+        unsigned int free = FreeBits(word);
+
+        numClear += __builtin_popcount(free);
+        if (free == 0)
+            summary[word / BitsInWord] |= 1u << (word % BitsInWord);
     }
-    return count;
 }
 
 //----------------------------------------------------------------------
@@ -180,9 +320,15 @@ void Bitmap::SelfTest()
     ASSERT(Test(0) && Test(31));
 
     ASSERT(FindAndSet() == 1);
+    ASSERT(FindAndSetRange(3) == 2 && Test(4) && !Test(5));
+    ASSERT(NumClear() == numBits - 6);
     Clear(0);
     Clear(1);
     Clear(31);
+    for (i = 2; i < 5; i++)
+    {
+        Clear(i);
+    }
 
     for (i = 0; i < numBits; i++)
     {
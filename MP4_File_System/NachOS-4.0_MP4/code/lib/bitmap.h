@@ -3,7 +3,9 @@
 //	can be either on or off.
 //
 //	Represented as an array of unsigned integers, on which we do
-//	modulo arithmetic to find the bit we are interested in.
+//	modulo arithmetic to find the bit we are interested in.  Searches
+//	work a word at a time, and a second, summary bitmap with one bit
+//	per full word lets them skip 32 full words at a time.
 //
 //	The bitmap can be parameterized with with the number of bits being
 //	managed.
@@ -43,18 +45,37 @@ public:
     int FindAndSet();           // Return the # of a clear bit, and as a side
         // effect, set the bit.
         // If no bits are clear, return -1.
+    int FindAndSetRange(int n); // Set the first run of n clear bits,
+        // returning the # of its first bit,
+        // or -1 if there is no such run.
     int NumClear() const; // Return the number of clear bits
 
     void Print() const; // Print contents of bitmap
     void SelfTest();    // Test whether bitmap is working
 
 protected:
+    int NextClear(int from) const; // # of the first clear bit at or
+                                   // after "from", or -1 if none
+    int NextSet(int from) const;   // # of the first set bit at or
+                                   // after "from", or numBits if none
+    void Recount();                // Recompute the clear count, hint
+                                   // and summary after map changed
+
     int numBits;       // number of bits in the bitmap
     int numWords;      // number of words of bitmap storage
                        // (rounded up if numBits is not a
                        //  multiple of the number of bits in
                        //  a word)
     unsigned int *map; // bit storage
+
+private:
+    unsigned int FreeBits(int word) const; // Clear bits of a map word,
+                                           // not counting the bits
+                                           // past numBits
+
+    int numClear;          // number of clear bits
+    int hint;              // no clear bits in the words below this
+    unsigned int *summary; // bit w is set if map word w is full
 };
 
 #endif // BITMAP_H
@@ -100,54 +100,63 @@ PrintSector(bool writing, int sector, char *data)
 
 //----------------------------------------------------------------------
 // Disk::ReadRequest/WriteRequest
-// 	Simulate a request to read/write a single disk sector
+// 	Simulate a request to read/write a run of consecutive disk sectors
 //	   Do the read/write immediately to the UNIX file
 //	   Set up an interrupt handler to be called later,
 //	      that will notify the caller when the simulator says
 //	      the operation has completed.
 //
-//	Note that a disk only allows an entire sector to be read/written,
+//	Note that a disk only allows entire sectors to be read/written,
 //	not part of a sector.
 //
-//	"sectorNumber" -- the disk sector to read/write
+//	"sectorNumber" -- the first disk sector to read/write
 //	"data" -- the bytes to be written, the buffer to hold the incoming bytes
+//	"numSectors" -- how many sectors, starting at sectorNumber
 //----------------------------------------------------------------------
 
-void Disk::ReadRequest(int sectorNumber, char *data)
+void Disk::ReadRequest(int sectorNumber, char *data, int numSectors)
 {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    int seek;
+    int ticks = ComputeLatency(sectorNumber, FALSE, numSectors, &seek);
 
     ASSERT(!active); // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (numSectors > 0)
+           && (sectorNumber + numSectors <= NumSectors));
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
+    DEBUG(dbgDisk, "Reading " << numSectors << " sectors from sector " << sectorNumber);
     Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    Read(fileno, data, SectorSize * numSectors);
     if (debug->IsEnabled('d'))
-        PrintSector(FALSE, sectorNumber, data);
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(FALSE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskReads++;
+    kernel->stats->diskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
-void Disk::WriteRequest(int sectorNumber, char *data)
+void Disk::WriteRequest(int sectorNumber, char *data, int numSectors)
 {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+    int seek;
+    int ticks = ComputeLatency(sectorNumber, TRUE, numSectors, &seek);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (numSectors > 0)
+           && (sectorNumber + numSectors <= NumSectors));
 
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
+    DEBUG(dbgDisk, "Writing " << numSectors << " sectors to sector " << sectorNumber);
     Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    WriteFile(fileno, data, SectorSize * numSectors);
     if (debug->IsEnabled('d'))
-        PrintSector(TRUE, sectorNumber, data);
+        for (int i = 0; i < numSectors; i++)
+            PrintSector(TRUE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskWrites++;
+    kernel->stats->diskSeekTicks += seek;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
@@ -205,10 +214,14 @@ int Disk::ModuloDiff(int to, int from)
 
 //----------------------------------------------------------------------
 // Disk::ComputeLatency()
-// 	Return how long will it take to read/write a disk sector, from
-//	the current position of the disk head.
+// 	Return how long will it take to read/write a run of disk sectors,
+//	from the current position of the disk head.
 //
 //   	Latency = seek time + rotational latency + transfer time
+//
+//   	Only the first sector of a run pays for the seek and rotational
+//   	delay; the rest stream past the head one RotationTime each, plus
+//   	a one-track seek at every track boundary the run crosses.
 //   	Disk seeks at one track per SeekTime ticks (cf. stats.h)
 //   	and rotates at one sector per RotationTime ticks
 //
@@ -222,27 +235,36 @@ int Disk::ModuloDiff(int to, int from)
 //   	read requests to the current track to be satisfied more quickly.
 //   	The contents of the track buffer are discarded after every seek to
 //   	a new track.
+//
+//	"seekTicks" -- if not NULL, set to the part of the latency spent
+//		seeking, for the statistics
 //----------------------------------------------------------------------
 
-int Disk::ComputeLatency(int newSector, bool writing)
+int Disk::ComputeLatency(int newSector, bool writing, int numSectors, int *seekTicks)
 {
     int rotation;
     int seek = TimeToSeek(newSector, &rotation);
     int timeAfter = kernel->stats->totalTicks + seek + rotation;
+    int lastSector = newSector + numSectors - 1;
+    int crossing = (lastSector / SectorsPerTrack - newSector / SectorsPerTrack) * SeekTime;
+    int streaming = (numSectors - 1) * RotationTime + crossing;
+
+    if (seekTicks != NULL)
+        *seekTicks = seek + crossing;
 
 #ifndef NOTRACKBUF // turn this on if you don't want the track buffer stuff
     // check if track buffer applies
     if ((writing == FALSE) && (seek == 0) && (((timeAfter - bufferInit) / RotationTime) > ModuloDiff(newSector, bufferInit / RotationTime)))
     {
-        DEBUG(dbgDisk, "Request latency = " << RotationTime);
-        return RotationTime; // time to transfer sector from the track buffer
+        DEBUG(dbgDisk, "Request latency = " << (RotationTime + streaming));
+        return RotationTime + streaming; // first sector from the track buffer
     }
 #endif
 
     rotation += ModuloDiff(newSector, timeAfter / RotationTime) * RotationTime;
 
-    DEBUG(dbgDisk, "Request latency = " << (seek + rotation + RotationTime));
-    return (seek + rotation + RotationTime);
+    DEBUG(dbgDisk, "Request latency = " << (seek + rotation + RotationTime + streaming));
+    return (seek + rotation + RotationTime + streaming);
 }
 
 //----------------------------------------------------------------------
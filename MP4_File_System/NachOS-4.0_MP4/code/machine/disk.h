@@ -60,20 +60,24 @@ class Disk : public CallBackObj {
 					// when each request completes.
     ~Disk();				// Deallocate the disk.
     
-    void ReadRequest(int sectorNumber, char* data);
-    					// Read/write an single disk sector.
+    void ReadRequest(int sectorNumber, char* data, int numSectors = 1);
+    					// Read/write numSectors consecutive
+					// disk sectors, a single one by
+					// default.
 					// These routines send a request to 
     					// the disk and return immediately.
     					// Only one request allowed at a time!
-    void WriteRequest(int sectorNumber, char* data);
+    void WriteRequest(int sectorNumber, char* data, int numSectors = 1);
 
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
 
-    int ComputeLatency(int newSector, bool writing);	
+    int ComputeLatency(int newSector, bool writing, int numSectors = 1,
+                       int *seekTicks = NULL);
     					// Return how long a request to 
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
+					// and how much of it is seek
 
   private:
     int fileno;				// UNIX file number for simulated disk 
@@ -23,6 +23,7 @@
 #include "copyright.h"
 #include "interrupt.h"
 #include "main.h"
+#include "blockcache.h"
 
 // String definitions for debugging messages
 
@@ -244,9 +245,22 @@ void Interrupt::Idle()
 //----------------------------------------------------------------------
 // Interrupt::Halt
 // 	Shut down Nachos cleanly, printing out performance statistics.
+//
+//	The file system's in-memory state is written through the block
+//	cache, and dirty cached sectors back to the disk, first: this is
+//	the one place every shutdown goes through, and after it nothing
+//	touches the disk.  The current thread can still wait for the
+//	disk here: if it was going to sleep for good (called from Idle),
+//	waiting on the disk sleeps it again, and the disk interrupt
+//	wakes it.
 //----------------------------------------------------------------------
 void Interrupt::Halt()
 {
+#ifndef FILESYS_STUB
+    kernel->fileSystem->Sync();
+#endif
+    kernel->blockCache->Flush();
+
     // MP4 mod tag
     /*
     cout << "Machine halting!\n\n";
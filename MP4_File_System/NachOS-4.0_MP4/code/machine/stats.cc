@@ -19,7 +19,9 @@
 Statistics::Statistics()
 {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
-    numDiskReads = numDiskWrites = 0;
+    numDiskReads = numDiskWrites = diskSeekTicks = 0;
+    numCacheHits = numCacheMisses = numCacheReadAheads = 0;
+    numNameCacheHits = numNameCacheNegativeHits = numNameCacheMisses = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
 }
@@ -36,7 +38,13 @@ Statistics::Print()
     cout << "Ticks: total " << totalTicks << ", idle " << idleTicks;
 		cout << ", system " << systemTicks << ", user " << userTicks <<"\n";
     cout << "Disk I/O: reads " << numDiskReads;
-		cout << ", writes " << numDiskWrites << "\n";
+		cout << ", writes " << numDiskWrites << ", seek ticks " << diskSeekTicks << "\n";
+    cout << "Block cache: hits " << numCacheHits;
+		cout << ", misses " << numCacheMisses;
+		cout << ", read ahead " << numCacheReadAheads << "\n";
+    cout << "Name cache: hits " << numNameCacheHits;
+		cout << ", negative hits " << numNameCacheNegativeHits;
+		cout << ", misses " << numNameCacheMisses << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
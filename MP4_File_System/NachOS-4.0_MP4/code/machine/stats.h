@@ -30,6 +30,13 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int diskSeekTicks;		// time the disk head spent seeking
+    int numCacheHits;		// block cache requests found cached
+    int numCacheMisses;		// block cache requests that went to disk
+    int numCacheReadAheads;	// sectors read into the cache ahead of need
+    int numNameCacheHits;	// directory lookups answered by the name cache
+    int numNameCacheNegativeHits; // ... answered "no such name"
+    int numNameCacheMisses;	// directory lookups that read the directory
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
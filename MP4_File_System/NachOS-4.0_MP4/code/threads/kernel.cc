@@ -15,6 +15,7 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#include "blockcache.h"
 #include "post.h"
 #include "synchconsole.h"
 
@@ -30,6 +31,8 @@ Kernel::Kernel(int argc, char **argv)
     debugUserProg = FALSE;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
+    cacheSize = NumCacheBuffers;
+    diskScheduler = NULL;      // default is C-LOOK
 #ifndef FILESYS_STUB
     formatFlag = FALSE;
 #endif
@@ -60,6 +63,15 @@ Kernel::Kernel(int argc, char **argv)
 	    	ASSERT(i + 1 < argc);
 	    	consoleOut = argv[i + 1];
 	    	i++;
+		} else if (strcmp(argv[i], "-bc") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	cacheSize = atoi(argv[i + 1]);
+	    	ASSERT(cacheSize > 0);
+	    	i++;
+		} else if (strcmp(argv[i], "-ds") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	diskScheduler = argv[i + 1];
+	    	i++;
 #ifndef FILESYS_STUB
 		} else if (strcmp(argv[i], "-f") == 0) {
 	    	formatFlag = TRUE;
@@ -76,6 +88,8 @@ Kernel::Kernel(int argc, char **argv)
             cout << "Partial usage: nachos [-rs randomSeed]\n";
 	   		cout << "Partial usage: nachos [-s]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
+            cout << "Partial usage: nachos [-bc cacheSectors]\n";
+            cout << "Partial usage: nachos [-ds fifo|sstf|scan|clook]\n";
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
 #endif
@@ -109,7 +123,8 @@ Kernel::Initialize()
     machine = new Machine(debugUserProg);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
-    synchDisk = new SynchDisk();    //
+    synchDisk = new SynchDisk(diskScheduler);    //
+    blockCache = new BlockCache(synchDisk, cacheSize);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
@@ -142,6 +157,9 @@ Kernel::PrepareToEnd()
 //----------------------------------------------------------------------
 // Kernel::~Kernel
 // 	Nachos is halting.  De-allocate global data structures.
+//
+//	Interrupt::Halt has synced the file system and flushed the block
+//	cache already; nothing here does disk I/O.
 //----------------------------------------------------------------------
 
 Kernel::~Kernel()
@@ -153,8 +171,9 @@ Kernel::~Kernel()
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
     delete fileSystem;
+    delete blockCache;
+    delete synchDisk;
 	
 	// Mp4 mod tag
 	/*
@@ -24,6 +24,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class BlockCache;
 
 
 
@@ -64,6 +65,7 @@ class Kernel {
     SynchConsoleInput *synchConsoleIn;
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
+    BlockCache *blockCache;	// sectors cached above synchDisk
     FileSystem *fileSystem;     
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
@@ -81,6 +83,8 @@ class Kernel {
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
+    int cacheSize;              // sectors held by the block cache
+    char *diskScheduler;        // order of queued disk requests
 #ifndef FILESYS_STUB
     bool formatFlag;          // format the disk if this is true
 #endif
@@ -5,7 +5,8 @@
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
 //              -f -cp <unix file> <nachos file>
-//              -p <nachos file> -r <nachos file> -l -D
+//              -p <nachos file> -r <nachos file> -mkdir <nachos dir>
+//              -l <nachos dir> -lr <nachos dir> -D
 //              -n <network reliability> -m <machine id>
 //              -z -K -C -N
 //
@@ -24,10 +25,14 @@
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
+//    -bc sets how many sectors the block cache holds
+//    -ds picks the disk scheduler: fifo, sstf, scan or clook
 //    -cp copies a file from UNIX to Nachos
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
-//    -l lists the contents of the Nachos directory
+//    -mkdir creates a Nachos directory
+//    -l lists the contents of a Nachos directory
+//    -lr lists a Nachos directory and every directory below it
 //    -D prints the contents of the entire file system
 //
 //  Note: the file system flags are not used if the stub filesystem
@@ -44,6 +49,7 @@
 #include "main.h"
 #include "filesys.h"
 #include "openfile.h"
+#include "disk.h"
 #include "sysdep.h"
 
 // global variables
@@ -65,9 +71,10 @@ Cleanup(int x)
 //-------------------------------------------------------------------
 // Constant used by "Copy" and "Print"
 //   It is the number of bytes read from the Unix file (for Copy)
-//   or the Nachos file (for Print) by each read operation
+//   or the Nachos file (for Print) by each read operation.  Several
+//   sectors, so a contiguous file moves in multi-sector disk requests.
 //-------------------------------------------------------------------
-static const int TransferSize = 128;
+static const int TransferSize = 8 * SectorSize;
 
 #ifndef FILESYS_STUB
 //----------------------------------------------------------------------
@@ -153,7 +160,8 @@ void Print(char *name)
 //----------------------------------------------------------------------
 static void CreateDirectory(char *name)
 {
-    // MP4 Assignment
+    if (!kernel->fileSystem->CreateDirectory(name))
+        printf("CreateDirectory: couldn't create directory %s\n", name);
 }
 
 //----------------------------------------------------------------------
@@ -293,7 +301,8 @@ int main(int argc, char **argv)
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
-            cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-mkdir dirName]\n";
+            cout << "Partial usage: nachos [-l dirName] [-lr dirName] [-D]\n";
 #endif //FILESYS_STUB
         }
     }
@@ -337,7 +346,7 @@ int main(int argc, char **argv)
     }
     if (dirListFlag)
     {
-        kernel->fileSystem->List();
+        kernel->fileSystem->List(listDirectoryName, recursiveListFlag);
     }
     if (mkdirFlag)
     {
@@ -20,6 +20,7 @@
 #include "addrspace.h"
 #include "machine.h"
 #include "noff.h"
+#include "syscall.h"
 
 //----------------------------------------------------------------------
 // SwapHeader
@@ -76,6 +77,10 @@ AddrSpace::AddrSpace()
 	pageTable[i].dirty = FALSE;
 	pageTable[i].readOnly = FALSE;  
     }
+
+    // descriptors 0 and 1 are the console, never handed out
+    for (int i = 0; i < NumFileDescriptors; i++)
+	openFiles[i] = -1;
     
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
@@ -88,6 +93,9 @@ AddrSpace::AddrSpace()
 
 AddrSpace::~AddrSpace()
 {
+   for (int i = 0; i < NumFileDescriptors; i++)
+	if (openFiles[i] != -1)
+	    kernel->fileSystem->CloseShared(openFiles[i]);
    delete pageTable;
 }
 
@@ -314,3 +322,138 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 
 
 
+
+//----------------------------------------------------------------------
+// AddrSpace::Open
+// 	Open a file for the program, and return the lowest free file
+//	descriptor, positioned at the start of the file.  Return -1 if
+//	the file cannot be opened, or the program has too many open.
+//
+//	"name" -- the path of the file
+//----------------------------------------------------------------------
+
+OpenFileId
+AddrSpace::Open(char *name)
+{
+    for (int id = SysConsoleOutput + 1; id < NumFileDescriptors; id++) {
+	if (openFiles[id] != -1)
+	    continue;
+	if ((openFiles[id] = kernel->fileSystem->OpenShared(name)) == -1)
+	    return -1;
+	filePositions[id] = 0;
+	readAheads[id].Reset();
+	return id;
+    }
+    return -1;		// no free descriptor
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Read/Write
+// 	Transfer bytes at a descriptor's position, and move it past
+//	them.  Return the number of bytes transferred.
+//
+//	"buffer" -- the bytes, in kernel memory
+//	"size" -- how many bytes to transfer
+//	"id" -- the file descriptor
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Read(char *buffer, int size, OpenFileId id)
+{
+    int result;
+
+    if (!IsOpen(id))
+	return -1;
+    result = PRead(buffer, size, filePositions[id], id);
+    if (result > 0)
+	filePositions[id] += result;
+    return result;
+}
+
+int
+AddrSpace::Write(char *buffer, int size, OpenFileId id)
+{
+    int result;
+
+    if (!IsOpen(id))
+	return -1;
+    result = PWrite(buffer, size, filePositions[id], id);
+    if (result > 0)
+	filePositions[id] += result;
+    return result;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PRead/PWrite
+// 	Transfer bytes at a given position, leaving the descriptor's
+//	position alone.  Return the number of bytes transferred.  Reads
+//	still count toward the descriptor's read-ahead.
+//
+//	"buffer" -- the bytes, in kernel memory
+//	"size" -- how many bytes to transfer
+//	"position" -- where in the file they go
+//	"id" -- the file descriptor
+//----------------------------------------------------------------------
+
+int
+AddrSpace::PRead(char *buffer, int size, int position, OpenFileId id)
+{
+    if (!IsOpen(id) || size < 0 || position < 0)
+	return -1;
+    return kernel->fileSystem->SharedFile(openFiles[id])->ReadAt(buffer,
+					size, position, &readAheads[id]);
+}
+
+int
+AddrSpace::PWrite(char *buffer, int size, int position, OpenFileId id)
+{
+    if (!IsOpen(id) || size < 0 || position < 0)
+	return -1;
+    return kernel->fileSystem->SharedFile(openFiles[id])->WriteAt(buffer,
+							size, position);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Seek
+// 	Set a descriptor's position.  Return 1, or -1 on failure.
+//
+//	"position" -- the byte the next Read or Write starts at
+//	"id" -- the file descriptor
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Seek(int position, OpenFileId id)
+{
+    if (!IsOpen(id) || position < 0)
+	return -1;
+    filePositions[id] = position;
+    return 1;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Close
+// 	Free a file descriptor.  Return 1, or -1 on failure.
+//
+//	"id" -- the file descriptor
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Close(OpenFileId id)
+{
+    if (!IsOpen(id))
+	return -1;
+    kernel->fileSystem->CloseShared(openFiles[id]);
+    openFiles[id] = -1;
+    return 1;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::IsOpen
+// 	Return TRUE if "id" is a descriptor of an open file.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::IsOpen(OpenFileId id)
+{
+    return id >= 0 && id < NumFileDescriptors && openFiles[id] != -1;
+}
@@ -17,6 +17,8 @@
 #include "filesys.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
+#define NumFileDescriptors	16	// open files per address space,
+					// counting the console's two
 
 class AddrSpace {
   public:
@@ -39,6 +41,19 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    // Open files, by descriptor.  Each descriptor has its own seek
+    // position and read-ahead state, on an OpenFile shared through
+    // the file system's open-file table.  Read and Write move the
+    // position; PRead and PWrite use the one given instead.  All
+    // return -1 for a bad id.
+    OpenFileId Open(char *name);	// Return a new descriptor, or -1
+    int Read(char *buffer, int size, OpenFileId id);
+    int Write(char *buffer, int size, OpenFileId id);
+    int PRead(char *buffer, int size, int position, OpenFileId id);
+    int PWrite(char *buffer, int size, int position, OpenFileId id);
+    int Seek(int position, OpenFileId id);
+    int Close(OpenFileId id);
+
   private:
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
@@ -48,6 +63,14 @@ class AddrSpace {
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
 
+    bool IsOpen(OpenFileId id);		// Is id an open file descriptor?
+
+    int openFiles[NumFileDescriptors];	// Open-file table index of each
+					// descriptor, -1 if not in use
+    int filePositions[NumFileDescriptors]; // Seek position of each
+    ReadAheadState readAheads[NumFileDescriptors]; // How each has
+					// been reading, to read ahead for it
+
 };
 
 #endif // ADDRSPACE_H
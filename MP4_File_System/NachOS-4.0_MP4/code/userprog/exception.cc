@@ -53,7 +53,7 @@ void ExceptionHandler(ExceptionType which)
 	int type = kernel->machine->ReadRegister(2);
 	int val;
 	int status, exit, threadID, programID;
-	int initsize, size, id;
+	int initsize, size, id, position;
 	DEBUG(dbgSys, "Received Exception " << which << " type: " << type << "\n");
 	switch (which)
 	{
@@ -142,6 +142,52 @@ void ExceptionHandler(ExceptionType which)
 			return;
 			ASSERTNOTREACHED();
 			break;
+		case SC_PRead:
+			DEBUG(dbgSys, "SC_PRead.\n");
+			val = kernel->machine->ReadRegister(4);
+			size = kernel->machine->ReadRegister(5);
+			position = kernel->machine->ReadRegister(6);
+			id = kernel->machine->ReadRegister(7);
+			{
+				char *buffer = &(kernel->machine->mainMemory[val]);
+				status = SysPRead(buffer, size, position, id);
+				kernel->machine->WriteRegister(2, (int)status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			return;
+			ASSERTNOTREACHED();
+			break;
+		case SC_PWrite:
+			DEBUG(dbgSys, "SC_PWrite.\n");
+			val = kernel->machine->ReadRegister(4);
+			size = kernel->machine->ReadRegister(5);
+			position = kernel->machine->ReadRegister(6);
+			id = kernel->machine->ReadRegister(7);
+			{
+				char *buffer = &(kernel->machine->mainMemory[val]);
+				status = SysPWrite(buffer, size, position, id);
+				kernel->machine->WriteRegister(2, (int)status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			return;
+			ASSERTNOTREACHED();
+			break;
+		case SC_Seek:
+			DEBUG(dbgSys, "SC_Seek.\n");
+			position = kernel->machine->ReadRegister(4);
+			id = kernel->machine->ReadRegister(5);
+			status = SysSeek(position, id);
+			kernel->machine->WriteRegister(2, (int)status);
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			return;
+			ASSERTNOTREACHED();
+			break;
 		case SC_Close:
 			DEBUG(dbgSys, "SC_Close.\n");
 			val = kernel->machine->ReadRegister(4);
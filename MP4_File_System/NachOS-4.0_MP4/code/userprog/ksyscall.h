@@ -37,24 +37,38 @@ int SysCreate(char *filename ,int size)
 //When you finish the function "OpenAFile", you can remove the comment below.
 
 OpenFileId SysOpen(char *name)
-{	OpenFileId id = (OpenFileId) kernel->fileSystem->Open(name);
-    if(id > 0) return id;
-	else return -1;
+{
+	return kernel->currentThread->space->Open(name);
 }
 
-int SysClose(OpenFileId id){
-    int rst = kernel->fileSystem->Close(id);
-	return rst;
+int SysClose(OpenFileId id)
+{
+	return kernel->currentThread->space->Close(id);
 }
 
-int SysWrite(char *buffer, int size, OpenFileId id){
-    int rst = kernel->fileSystem->Write(buffer, size, id);
-	return rst;
+int SysWrite(char *buffer, int size, OpenFileId id)
+{
+	return kernel->currentThread->space->Write(buffer, size, id);
 }
 
-int SysRead(char *buffer, int size, OpenFileId id){
-    int rst = kernel->fileSystem->Read(buffer, size, id);
-	return rst;
+int SysRead(char *buffer, int size, OpenFileId id)
+{
+	return kernel->currentThread->space->Read(buffer, size, id);
+}
+
+int SysPWrite(char *buffer, int size, int position, OpenFileId id)
+{
+	return kernel->currentThread->space->PWrite(buffer, size, position, id);
+}
+
+int SysPRead(char *buffer, int size, int position, OpenFileId id)
+{
+	return kernel->currentThread->space->PRead(buffer, size, position, id);
+}
+
+int SysSeek(int position, OpenFileId id)
+{
+	return kernel->currentThread->space->Seek(position, id);
 }
 
 #ifdef FILESYS_STUB
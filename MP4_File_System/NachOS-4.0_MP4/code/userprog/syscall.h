@@ -34,6 +34,8 @@
 #define SC_ExecV	13
 #define SC_ThreadExit   14
 #define SC_ThreadJoin   15
+#define SC_PRead	16
+#define SC_PWrite	17
 #define SC_Add		42
 #define SC_MSG		100
 
@@ -140,8 +142,21 @@ int Write(char *buffer, int size, OpenFileId id);
  */
 int Read(char *buffer, int size, OpenFileId id);
 
+/* Read "size" bytes from the open file into "buffer", starting at
+ * byte "position", without using or moving the seek position.
+ * Return the number of bytes actually read, or -1 on failure.
+ */
+int PRead(char *buffer, int size, int position, OpenFileId id);
+
+/* Write "size" bytes from "buffer" to the open file, starting at
+ * byte "position", without using or moving the seek position.
+ * Return the number of bytes actually written, or -1 on failure.
+ */
+int PWrite(char *buffer, int size, int position, OpenFileId id);
+
 /* Set the seek position of the open file "id"
  * to the byte "position".
+ * Return 1 on success, negative error code on failure
  */
 int Seek(int position, OpenFileId id);
 
@@ -0,0 +1,205 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AFFINE_HAVE_X86_KERNELS
+#endif
+
+#ifndef AFFINE_HPP
+#define AFFINE_HPP
+
+// x -> (a * x + b) % m, for x < m
+struct AffineMap {
+  unsigned long long a;
+  unsigned long long b;
+  unsigned long long m;
+};
+
+// (x * y) % m without overflow
+static inline unsigned long long mulmod(unsigned long long x, unsigned long long y, unsigned long long m) {
+  return (unsigned long long)((unsigned __int128)x * y % m);
+}
+
+static inline unsigned long long affine_apply(const AffineMap& f, unsigned long long x) {
+  return (unsigned long long)(((unsigned __int128)f.a * x + f.b) % f.m);
+}
+
+// f after g: x -> f(g(x)) = (f.a * g.a) x + (f.a * g.b + f.b)
+static inline AffineMap affine_compose(const AffineMap& f, const AffineMap& g) {
+  AffineMap h;
+  h.a = mulmod(f.a, g.a, f.m);
+  h.b = affine_apply(f, g.b);
+  h.m = f.m;
+  return h;
+}
+
+// f applied k times, by squaring
+static inline AffineMap affine_power(AffineMap f, unsigned long long k) {
+  AffineMap result = { 1, 0, f.m };
+  while (k) {
+    if (k & 1)
+      result = affine_compose(f, result);
+    f = affine_compose(f, f);
+    k >>= 1;
+  }
+  return result;
+}
+
+// Batched kernels stepping vals[i] = (vals[i] * a + b) % m literally,
+// `iterations` times, for all i < n.
+typedef void (*AffineBatchKernel)(unsigned long long a, unsigned long long b, unsigned long long m,
+  int iterations, unsigned long long* vals, int n);
+
+static void affine_iterate_scalar(unsigned long long a, unsigned long long b, unsigned long long m,
+  int iterations, unsigned long long* vals, int n) {
+  for (int i = 0; i < n; i++) {
+    unsigned long long val = vals[i];
+    for (int k = 0; k < iterations; k++)
+      val = (val * a + b) % m;
+    vals[i] = val;
+  }
+}
+
+#ifdef AFFINE_HAVE_X86_KERNELS
+
+// The vector kernels keep every value below m < 2^32, so val * a fits
+// _mm*_mul_epu32 and, with a and b small enough, val * a + b < 2^52 is
+// exact as a double. The quotient is then estimated Barrett-style with a
+// double reciprocal of m; it is off by at most one, which a compare and
+// add or subtract of m corrects.
+static inline bool affine_vectorizable(unsigned long long a, unsigned long long b, unsigned long long m) {
+  if (m == 0 || m >> 32 || a >> 32)
+    return false;
+  unsigned __int128 largest = (unsigned __int128)(m - 1) * a + b;
+  return largest >> 52 == 0;
+}
+
+// 2^52: OR-ing an integer below it into the mantissa of 2^52 and
+// subtracting 2^52 converts it to a double, and back
+#define AFFINE_MAGIC 4503599627370496.0
+
+__attribute__((target("avx2")))
+static inline __m256i affine_step_avx2(__m256i x, __m256i va, __m256i vb, __m256i vm,
+  __m256i vm1, __m256d inv_m, __m256d magic) {
+  __m256i magic_i = _mm256_castpd_si256(magic);
+  __m256i t = _mm256_add_epi64(_mm256_mul_epu32(x, va), vb);
+  __m256d td = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(t, magic_i)), magic);
+  __m256d qd = _mm256_floor_pd(_mm256_mul_pd(td, inv_m));
+  __m256i q = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(qd, magic)), magic_i);
+  __m256i r = _mm256_sub_epi64(t, _mm256_mul_epu32(q, vm));
+  r = _mm256_add_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), r), vm));
+  r = _mm256_sub_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(r, vm1), vm));
+  return r;
+}
+
+__attribute__((target("avx2")))
+static void affine_iterate_avx2(unsigned long long a, unsigned long long b, unsigned long long m,
+  int iterations, unsigned long long* vals, int n) {
+  if (iterations <= 0)
+    return;
+  if (!affine_vectorizable(a, b, m)) {
+    affine_iterate_scalar(a, b, m, iterations, vals, n);
+    return;
+  }
+
+  // the first step runs on the raw values, which may not be below m
+  affine_iterate_scalar(a, b, m, 1, vals, n);
+
+  __m256i va = _mm256_set1_epi64x(a);
+  __m256i vb = _mm256_set1_epi64x(b);
+  __m256i vm = _mm256_set1_epi64x(m);
+  __m256i vm1 = _mm256_set1_epi64x(m - 1);
+  __m256d inv_m = _mm256_set1_pd(1.0 / m);
+  __m256d magic = _mm256_set1_pd(AFFINE_MAGIC);
+
+  int i = 0;
+  // two independent vectors per loop to hide the latency of each step
+  for (; i + 8 <= n; i += 8) {
+    __m256i x0 = _mm256_loadu_si256((__m256i*)(vals + i));
+    __m256i x1 = _mm256_loadu_si256((__m256i*)(vals + i + 4));
+    for (int k = 1; k < iterations; k++) {
+      x0 = affine_step_avx2(x0, va, vb, vm, vm1, inv_m, magic);
+      x1 = affine_step_avx2(x1, va, vb, vm, vm1, inv_m, magic);
+    }
+    _mm256_storeu_si256((__m256i*)(vals + i), x0);
+    _mm256_storeu_si256((__m256i*)(vals + i + 4), x1);
+  }
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((__m256i*)(vals + i));
+    for (int k = 1; k < iterations; k++)
+      x = affine_step_avx2(x, va, vb, vm, vm1, inv_m, magic);
+    _mm256_storeu_si256((__m256i*)(vals + i), x);
+  }
+
+  affine_iterate_scalar(a, b, m, iterations - 1, vals + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i affine_step_avx512(__m512i x, __m512i va, __m512i vb, __m512i vm,
+  __m512i vm1, __m512d inv_m, __m512d magic) {
+  __m512i magic_i = _mm512_castpd_si512(magic);
+  __m512i t = _mm512_add_epi64(_mm512_mul_epu32(x, va), vb);
+  __m512d td = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(t, magic_i)), magic);
+  __m512d qd = _mm512_roundscale_pd(_mm512_mul_pd(td, inv_m), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  __m512i q = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(qd, magic)), magic_i);
+  __m512i r = _mm512_sub_epi64(t, _mm512_mul_epu32(q, vm));
+  r = _mm512_mask_add_epi64(r, _mm512_cmplt_epi64_mask(r, _mm512_setzero_si512()), r, vm);
+  r = _mm512_mask_sub_epi64(r, _mm512_cmpgt_epi64_mask(r, vm1), r, vm);
+  return r;
+}
+
+__attribute__((target("avx512f")))
+static void affine_iterate_avx512(unsigned long long a, unsigned long long b, unsigned long long m,
+  int iterations, unsigned long long* vals, int n) {
+  if (iterations <= 0)
+    return;
+  if (!affine_vectorizable(a, b, m)) {
+    affine_iterate_scalar(a, b, m, iterations, vals, n);
+    return;
+  }
+
+  // the first step runs on the raw values, which may not be below m
+  affine_iterate_scalar(a, b, m, 1, vals, n);
+
+  __m512i va = _mm512_set1_epi64(a);
+  __m512i vb = _mm512_set1_epi64(b);
+  __m512i vm = _mm512_set1_epi64(m);
+  __m512i vm1 = _mm512_set1_epi64(m - 1);
+  __m512d inv_m = _mm512_set1_pd(1.0 / m);
+  __m512d magic = _mm512_set1_pd(AFFINE_MAGIC);
+
+  int i = 0;
+  // two independent vectors per loop to hide the latency of each step
+  for (; i + 16 <= n; i += 16) {
+    __m512i x0 = _mm512_loadu_si512(vals + i);
+    __m512i x1 = _mm512_loadu_si512(vals + i + 8);
+    for (int k = 1; k < iterations; k++) {
+      x0 = affine_step_avx512(x0, va, vb, vm, vm1, inv_m, magic);
+      x1 = affine_step_avx512(x1, va, vb, vm, vm1, inv_m, magic);
+    }
+    _mm512_storeu_si512(vals + i, x0);
+    _mm512_storeu_si512(vals + i + 8, x1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    __m512i x = _mm512_loadu_si512(vals + i);
+    for (int k = 1; k < iterations; k++)
+      x = affine_step_avx512(x, va, vb, vm, vm1, inv_m, magic);
+    _mm512_storeu_si512(vals + i, x);
+  }
+
+  affine_iterate_avx2(a, b, m, iterations - 1, vals + i, n - i);
+}
+
+#endif // AFFINE_HAVE_X86_KERNELS
+
+// the widest kernel this CPU runs
+static inline AffineBatchKernel affine_select_kernel() {
+#ifdef AFFINE_HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return affine_iterate_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return affine_iterate_avx2;
+#endif
+  return affine_iterate_scalar;
+}
+
+#endif // AFFINE_HPP
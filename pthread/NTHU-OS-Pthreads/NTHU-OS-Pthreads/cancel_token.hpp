@@ -0,0 +1,103 @@
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <vector>
+
+#ifndef CANCEL_TOKEN_HPP
+#define CANCEL_TOKEN_HPP
+
+// Anything a thread can block in that a cancel has to cut short.
+class Interruptible {
+public:
+	virtual ~Interruptible() {}
+
+	// wake every thread blocked in this object so it rechecks its tokens
+	virtual void interrupt() = 0;
+};
+
+// A cooperative cancellation flag. Blocking calls that take a token check
+// it under the same lock they wait with, and cancel() interrupts every
+// attached Interruptible after setting it, so a cancel is never missed and
+// a cancelled thread wakes right away instead of at its next timeout.
+class CancelToken {
+public:
+	CancelToken();
+
+	~CancelToken();
+
+	// also interrupt blocker on cancel; attach before the token is shared
+	void attach(Interruptible* blocker);
+
+	// set the token and wake everything waiting on it
+	void cancel();
+
+	// clear the token so it can be cancelled again
+	void reset();
+
+	bool is_cancelled() const;
+
+	// sleep until deadline on the monotonic clock or until cancelled,
+	// return whether the token was cancelled
+	bool sleep_until(const struct timespec& deadline);
+
+private:
+	std::atomic<bool> cancelled;
+	std::vector<Interruptible*> blockers;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+// Implementation start
+
+CancelToken::CancelToken() {
+	cancelled.store(false);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond, &attr);
+
+	pthread_condattr_destroy(&attr);
+}
+
+CancelToken::~CancelToken() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond);
+}
+
+void CancelToken::attach(Interruptible* blocker) {
+	blockers.push_back(blocker);
+}
+
+void CancelToken::cancel() {
+	pthread_mutex_lock(&mutex);
+	cancelled.store(true);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	for (size_t i = 0; i < blockers.size(); i++)
+		blockers[i]->interrupt();
+}
+
+void CancelToken::reset() {
+	cancelled.store(false);
+}
+
+bool CancelToken::is_cancelled() const {
+	return cancelled.load();
+}
+
+bool CancelToken::sleep_until(const struct timespec& deadline) {
+	pthread_mutex_lock(&mutex);
+	while (!cancelled.load() && pthread_cond_timedwait(&cond, &mutex, &deadline) != ETIMEDOUT)
+		;
+	bool result = cancelled.load();
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+#endif // CANCEL_TOKEN_HPP
@@ -4,6 +4,8 @@
 #include "ts_queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "item_batch.hpp"
+#include "cancel_token.hpp"
 
 #ifndef CONSUMER_HPP
 #define CONSUMER_HPP
@@ -18,6 +20,8 @@ public:
 
 	virtual void start() override;
 
+	// stop taking new batches, the batch in hand is still passed on;
+	// the thread also exits once the worker queue is drained
 	virtual int cancel() override;
 private:
 	TSQueue<Item*>* worker_queue;
@@ -25,7 +29,8 @@ private:
 
 	Transformer* transformer;
 
-	bool is_cancel;
+	// cuts a wait on the worker queue short
+	CancelToken token;
 
 	// the method for pthread to create a consumer thread
 	static void* process(void* arg);
@@ -33,44 +38,40 @@ private:
 
 Consumer::Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer)
 	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer) {
-	is_cancel = false;
+	token.attach(worker_queue);
+	output_queue->attach_source();
 }
 
 Consumer::~Consumer() {}
 
 void Consumer::start() {
 	// TODO: starts a Consumer thread
-	pthread_create(&t, 0, Consumer::process, (void *)this);
+	create(Consumer::process, (void*)this);
 }
 
 int Consumer::cancel() {
 	// TODO: cancels the consumer thread
-	is_cancel = true;
-	if(is_cancel)
-		return 1;
-	else 
-		return 0;
+	token.cancel();
+	return 0;
 }
 
 void* Consumer::process(void* arg) {
 
 	Consumer *consumer = (Consumer *)arg;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, nullptr);
+	Item* items[DEFAULT_BATCH_SIZE];
 
-	while (!consumer->is_cancel)
+	while (true)
 	{
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
-		// TODO: implements the Consumer's work
-		Item *item = new Item;
-		item = consumer->worker_queue->dequeue();
-		item->val = consumer->transformer->consumer_transform(item->opcode, item->val);
-		consumer->output_queue->enqueue(item);
-		
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+		// 0 means the queue is drained or the consumer was cancelled
+		int n = consumer->worker_queue->dequeue_bulk(items, DEFAULT_BATCH_SIZE, -1, &consumer->token);
+		if (n == 0)
+			break;
+		transform_items(consumer->transformer, CONSUMER_STAGE, items, n);
+		consumer->output_queue->enqueue_bulk(items, n);
 	}
 
-	delete consumer;
+	consumer->output_queue->detach_source();
 
 	return nullptr;
 }
@@ -1,25 +1,61 @@
 #include <pthread.h>
 #include <unistd.h>
-#include <vector>
+#include <time.h>
+#include <math.h>
 #include <iostream>
-#include "consumer.hpp"
+#include <vector>
+#include "consumer_pool.hpp"
 #include "ts_queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "cancel_token.hpp"
 
 #ifndef CONSUMER_CONTROLLER
 #define CONSUMER_CONTROLLER
 
+// the fraction of their time the consumers should be busy at the target
+#define CONSUMER_CONTROLLER_TARGET_UTILIZATION 0.8
+// the target leaves room to drain the sampled backlog within this many
+// check periods
+#define CONSUMER_CONTROLLER_DRAIN_PERIODS 2
+// the target has to stay below the active count for this many checks in
+// a row before a consumer is parked
+#define CONSUMER_CONTROLLER_SCALE_DOWN_CHECKS 3
+// no scaling down within this many checks of the last change
+#define CONSUMER_CONTROLLER_COOLDOWN_CHECKS 3
+// weight of the newest sample in the smoothed rates
+#define CONSUMER_CONTROLLER_RATE_WEIGHT 0.5
+
+// one change of the active consumer count and what it was based on
+struct ScalingDecision {
+	// seconds since the controller started
+	double time;
+	// worker queue depth at the check
+	int depth;
+	// smoothed items per second entering the worker queue
+	double arrival_rate;
+	// smoothed items per second one busy consumer transforms,
+	// 0 while nothing has been measured and the thresholds decide
+	double service_rate;
+	// the consumer count the rates call for
+	int target;
+	int from;
+	int to;
+};
+
 class ConsumerController : public Thread {
 public:
-	// constructor
+	// constructor, metrics are passed on to the consumer pool, which has
+	// max_consumers workers or one per online core if that is <= 0
 	ConsumerController(
 		TSQueue<Item*>* worker_queue,
 		TSQueue<Item*>* writer_queue,
 		Transformer* transformer,
 		int check_period,
 		int low_threshold,
-		int high_threshold
+		int high_threshold,
+		Metrics* metrics = nullptr,
+		int max_consumers = 0
 	);
 
 	// destructor
@@ -27,8 +63,24 @@ public:
 
 	virtual void start();
 
+	// stop checking, then wait for the consumer pool to drain the worker
+	// queue; the thread exits once the pool has
+	virtual int cancel() override;
+
+	// run the controller in the home domain and pin the consumer workers,
+	// call before start
+	void set_placement(Placement* placement);
+
+	// return a copy of every scaling decision made so far
+	std::vector<ScalingDecision> get_decisions();
+
+	// print the decision log, one decision per line
+	void dump_decisions(std::ostream& os);
+
 private:
-	std::vector<Consumer*> consumers;
+	// one parked-or-running worker per core, scaling only changes how
+	// many of them are active
+	ConsumerPool* pool;
 
 	TSQueue<Item*>* worker_queue;
 	TSQueue<Item*>* writer_queue;
@@ -42,8 +94,21 @@ private:
 	int low_threshold;
 	// When the number of items in the worker queue is higher than high_threshold,
 	// the number of consumers scaled up by 1.
+	// Both thresholds only apply until a service rate has been measured.
 	int high_threshold;
 
+	// the consumers needed for the given rates and backlog, by Little's law
+	int target_consumers(double arrival_rate, double service_rate, int depth);
+
+	// set the active count and log the decision behind it
+	void scale(const ScalingDecision& decision);
+
+	std::vector<ScalingDecision> decisions;
+	pthread_mutex_t decisions_mutex;
+
+	// cancelled to end the check loop without waiting out the period
+	CancelToken stop;
+
 	static void* process(void* arg);
 };
 
@@ -55,43 +120,180 @@ ConsumerController::ConsumerController(
 	Transformer* transformer,
 	int check_period,
 	int low_threshold,
-	int high_threshold
+	int high_threshold,
+	Metrics* metrics,
+	int max_consumers
 ) : worker_queue(worker_queue),
 	writer_queue(writer_queue),
 	transformer(transformer),
 	check_period(check_period),
 	low_threshold(low_threshold),
 	high_threshold(high_threshold) {
+	pool = new ConsumerPool(worker_queue, writer_queue, transformer, max_consumers, metrics);
+	pthread_mutex_init(&decisions_mutex, nullptr);
 }
 
-ConsumerController::~ConsumerController() {}
+ConsumerController::~ConsumerController() {
+	delete pool;
+	pthread_mutex_destroy(&decisions_mutex);
+}
 
 void ConsumerController::start() {
 	// TODO: starts a ConsumerController thread
-	pthread_create(&t, 0, ConsumerController::process, (void *)this);
+	create(ConsumerController::process, (void*)this);
+}
+
+int ConsumerController::cancel() {
+	stop.cancel();
+	return 0;
+}
+
+void ConsumerController::set_placement(Placement* placement) {
+	cpu_set_t cpus;
+	placement->home_cpus(cpus);
+	set_affinity(cpus);
+	pool->set_placement(placement);
+}
+
+std::vector<ScalingDecision> ConsumerController::get_decisions() {
+	pthread_mutex_lock(&decisions_mutex);
+	std::vector<ScalingDecision> copy = decisions;
+	pthread_mutex_unlock(&decisions_mutex);
+	return copy;
+}
+
+void ConsumerController::dump_decisions(std::ostream& os) {
+	std::vector<ScalingDecision> log = get_decisions();
+	for (size_t i = 0; i < log.size(); i++) {
+		os << log[i].time << "s: " << log[i].from << " -> " << log[i].to
+			<< " consumers (target " << log[i].target
+			<< ", depth " << log[i].depth
+			<< ", arrival " << log[i].arrival_rate << "/s"
+			<< ", service " << log[i].service_rate << "/s per consumer)\n";
+	}
+}
+
+int ConsumerController::target_consumers(double arrival_rate, double service_rate, int depth) {
+	// Little's law: keeping up with arrival_rate takes arrival_rate /
+	// service_rate busy consumers on average; on top of that the backlog
+	// should be gone within the drain periods
+	double period = check_period / 1e6;
+	double demand = arrival_rate + depth / (CONSUMER_CONTROLLER_DRAIN_PERIODS * period);
+	int target = (int)ceil(demand / service_rate / CONSUMER_CONTROLLER_TARGET_UTILIZATION);
+
+	if (target < 1)
+		target = 1;
+	if (target > pool->get_size())
+		target = pool->get_size();
+	return target;
+}
+
+void ConsumerController::scale(const ScalingDecision& decision) {
+	pool->set_active(decision.to);
+
+	pthread_mutex_lock(&decisions_mutex);
+	decisions.push_back(decision);
+	pthread_mutex_unlock(&decisions_mutex);
+
+	std::cout << "Scaling " << (decision.to > decision.from ? "up" : "down") << " consumers from "
+		<< decision.from << " to " << decision.to << "\n";
 }
 
 void* ConsumerController::process(void* arg) {
-	// TODO: implements the ConsumerController's work
 	ConsumerController *controller = (ConsumerController *)arg;
-	int counter = 0;
-	while(counter <= controller->check_period){
-		counter++;
-		if(counter >= controller->check_period){
-			counter = 0;
-			if(controller->worker_queue->get_size() >= controller->high_threshold){
-				Consumer* consumer = new Consumer(controller->worker_queue, controller->writer_queue, controller->transformer);
-				controller->consumers.push_back(consumer);
-				std::cout << "Scaling up consumers from " << controller->consumers.size() - 1 << " to " << controller->consumers.size() << "\n";
-				consumer->start();
-			}
-			else if(controller->worker_queue->get_size() <= controller->low_threshold && controller->consumers.size() > 1){
-				int cancel_or_not = controller->consumers[controller->consumers.size()-1]->cancel();
-				controller->consumers.pop_back();
-				std::cout << "Scaling down consumers from " << controller->consumers.size() + 1 << " to " << controller->consumers.size() << "\n";
-			}
+	ConsumerPool *pool = controller->pool;
+	TSQueue<Item*>* worker_queue = controller->worker_queue;
+
+	pool->start();
+
+	unsigned long long started = monotonic_ns();
+
+	// there is always at least one consumer
+	ScalingDecision decision = { 0, 0, 0, 0, 1, 0, 1 };
+	controller->scale(decision);
+
+	// checks are scheduled on absolute times, so time spent deciding does
+	// not make the period drift
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	unsigned long long last_time = started;
+	unsigned long long last_enqueued = worker_queue->get_enqueued();
+	unsigned long long last_processed = 0, last_busy_ns = 0;
+	double arrival_rate = 0, service_rate = 0;
+	int checks_below = 0, checks_since_change = 0;
+
+	while (true) {
+		next.tv_sec += controller->check_period / 1000000;
+		next.tv_nsec += (controller->check_period % 1000000) * 1000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		if (controller->stop.sleep_until(next))
+			break;
+
+		unsigned long long now = monotonic_ns();
+		int depth = worker_queue->get_size();
+		unsigned long long enqueued = worker_queue->get_enqueued();
+		unsigned long long processed, busy_ns;
+		pool->get_service(processed, busy_ns);
+
+		double elapsed = (now - last_time) / 1e9;
+		double arrived = (enqueued - last_enqueued) / elapsed;
+		arrival_rate = arrival_rate == 0 ? arrived
+			: CONSUMER_CONTROLLER_RATE_WEIGHT * arrived + (1 - CONSUMER_CONTROLLER_RATE_WEIGHT) * arrival_rate;
+
+		// only time spent transforming counts, an idle consumer says
+		// nothing about how fast it would be
+		if (busy_ns > last_busy_ns) {
+			double served = (processed - last_processed) / ((busy_ns - last_busy_ns) / 1e9);
+			service_rate = service_rate == 0 ? served
+				: CONSUMER_CONTROLLER_RATE_WEIGHT * served + (1 - CONSUMER_CONTROLLER_RATE_WEIGHT) * service_rate;
+		}
+
+		last_time = now;
+		last_enqueued = enqueued;
+		last_processed = processed;
+		last_busy_ns = busy_ns;
+
+		int active = pool->get_active();
+		int target;
+		if (service_rate > 0)
+			target = controller->target_consumers(arrival_rate, service_rate, depth);
+		else if (depth >= controller->high_threshold)
+			target = active + 1 < pool->get_size() ? active + 1 : pool->get_size();
+		else if (depth <= controller->low_threshold)
+			target = active > 1 ? active - 1 : 1;
+		else
+			target = active;
+
+		checks_since_change++;
+		checks_below = target < active ? checks_below + 1 : 0;
+
+		// scale up as soon as the target asks for it, but down only one
+		// consumer at a time, once the target stayed low and the last
+		// change had time to show in the rates
+		int to = active;
+		if (target > active)
+			to = target;
+		else if (checks_below >= CONSUMER_CONTROLLER_SCALE_DOWN_CHECKS
+			&& checks_since_change >= CONSUMER_CONTROLLER_COOLDOWN_CHECKS)
+			to = active - 1;
+
+		if (to != active) {
+			ScalingDecision decision = {
+				(now - started) / 1e9, depth, arrival_rate, service_rate, target, active, to
+			};
+			controller->scale(decision);
+			checks_below = 0;
+			checks_since_change = 0;
 		}
 	}
+
+	pool->join();
+
+	return nullptr;
 }
 
 #endif // CONSUMER_CONTROLLER_HPP
@@ -0,0 +1,336 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include "thread.hpp"
+#include "ts_queue.hpp"
+#include "work_stealing_deque.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+#include "item_batch.hpp"
+#include "metrics.hpp"
+#include "topology.hpp"
+#include "cancel_token.hpp"
+
+#ifndef CONSUMER_POOL_HPP
+#define CONSUMER_POOL_HPP
+
+// how many items a worker takes off its deque at a time, the rest stays
+// there for others to steal
+#define CONSUMER_POOL_CHUNK_SIZE 8
+
+// A fixed set of consumer threads, one per core. Scaling changes how many
+// of them are active; inactive workers park on a condvar instead of being
+// created and cancelled. Every worker moves batches from the worker queue
+// into its own work-stealing deque, so an idle worker can take over part
+// of a batch another worker grabbed. An idle worker blocks on the worker
+// queue without a timeout; a worker that leaves items to steal in its
+// deque cuts that wait short through the idle worker's token. Once the
+// worker queue is drained the workers finish their deques and exit, and
+// the last one out closes the output queue.
+class ConsumerPool {
+public:
+	// constructor, size <= 0 means one worker per online core; with
+	// metrics every worker records under the "consumer" stage
+	ConsumerPool(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer, int size,
+		Metrics* metrics = nullptr);
+
+	// destructor
+	~ConsumerPool();
+
+	// pin every worker to its cpu in placement, call before start
+	void set_placement(Placement* placement);
+
+	// start every worker thread, all of them inactive
+	void start();
+
+	// wait for every worker to drain and exit
+	void join();
+
+	// let workers [0, n) run and park the others once their deques are
+	// empty; a worker waiting on the worker queue is woken to park at once
+	void set_active(int n);
+
+	// return the number of active workers
+	int get_active();
+
+	// return the number of worker threads
+	int get_size();
+
+	// add up what all workers transformed so far: the item count and the
+	// nanoseconds spent transforming them, i.e. the consumers' busy time
+	void get_service(unsigned long long& processed, unsigned long long& busy_ns);
+
+private:
+	class Worker : public Thread {
+	public:
+		Worker(ConsumerPool* pool, int id);
+
+		virtual void start() override;
+
+		WorkStealingDeque<Item*> deque;
+
+		// cuts the worker's wait on the worker queue short, cancelled when
+		// it is deactivated or another worker has items for it to steal;
+		// the worker resets it before each wait
+		CancelToken wake;
+
+		// set while the worker is about to wait or waiting on the worker
+		// queue, cleared by whoever wakes it
+		std::atomic<bool> idle;
+
+		// written by the worker only, read by get_service
+		std::atomic<unsigned long long> processed;
+		std::atomic<unsigned long long> busy_ns;
+	private:
+		ConsumerPool* pool;
+		int id;
+
+		// the method for pthread to create a worker thread
+		static void* process(void* arg);
+	};
+
+	// steal up to max items, and at most half of its deque, from the first
+	// worker other than thief that has any; returns how many were stolen
+	int steal(int thief, Item** items, int max);
+
+	// owner has left surplus items in its deque: wake one idle active
+	// worker per chunk of them to steal
+	void offer(int owner, int surplus);
+
+	// block the calling worker while it is not active and the worker queue
+	// is not drained
+	void wait_until_active(int id);
+
+	// the worker queue is drained: wake the parked workers so they exit
+	void finish();
+
+	TSQueue<Item*>* worker_queue;
+	TSQueue<Item*>* output_queue;
+
+	Transformer* transformer;
+
+	Metrics* metrics;
+
+	int size;
+	Worker** workers;
+
+	// workers with an id below active run, the others park
+	std::atomic<int> active;
+	bool finished;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_active;
+};
+
+// Implementation start
+
+ConsumerPool::ConsumerPool(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer, int size,
+	Metrics* metrics)
+	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer), metrics(metrics), size(size) {
+	if (this->size <= 0)
+		this->size = sysconf(_SC_NPROCESSORS_ONLN);
+	if (this->size <= 0)
+		this->size = 1;
+
+	workers = new Worker*[this->size];
+	for (int i = 0; i < this->size; i++) {
+		workers[i] = new Worker(this, i);
+		workers[i]->wake.attach(worker_queue);
+		// each worker is a source of the output queue until it exits
+		output_queue->attach_source();
+	}
+
+	active.store(0);
+	finished = false;
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_active, nullptr);
+}
+
+ConsumerPool::~ConsumerPool() {
+	for (int i = 0; i < size; i++)
+		delete workers[i];
+	delete[] workers;
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_active);
+}
+
+void ConsumerPool::set_placement(Placement* placement) {
+	cpu_set_t cpus;
+	for (int i = 0; i < size; i++) {
+		placement->consumer_cpus(i, cpus);
+		workers[i]->set_affinity(cpus);
+	}
+}
+
+void ConsumerPool::start() {
+	for (int i = 0; i < size; i++)
+		workers[i]->start();
+}
+
+void ConsumerPool::join() {
+	for (int i = 0; i < size; i++)
+		workers[i]->join();
+}
+
+void ConsumerPool::set_active(int n) {
+	if (n < 0)
+		n = 0;
+	if (n > size)
+		n = size;
+
+	pthread_mutex_lock(&mutex);
+	active.store(n);
+	pthread_cond_broadcast(&cond_active);
+	pthread_mutex_unlock(&mutex);
+
+	// the deactivated workers stop waiting on the worker queue; one that
+	// resets its token after this sees the new count and parks
+	for (int i = n; i < size; i++)
+		workers[i]->wake.cancel();
+}
+
+int ConsumerPool::get_active() {
+	return active.load();
+}
+
+int ConsumerPool::get_size() {
+	return size;
+}
+
+void ConsumerPool::get_service(unsigned long long& processed, unsigned long long& busy_ns) {
+	processed = 0;
+	busy_ns = 0;
+	for (int i = 0; i < size; i++) {
+		processed += workers[i]->processed.load(std::memory_order_relaxed);
+		busy_ns += workers[i]->busy_ns.load(std::memory_order_relaxed);
+	}
+}
+
+int ConsumerPool::steal(int thief, Item** items, int max) {
+	for (int i = 1; i < size; i++) {
+		Worker* victim = workers[(thief + i) % size];
+
+		int limit = (victim->deque.get_size() + 1) / 2;
+		if (limit > max)
+			limit = max;
+
+		int n = 0;
+		while (n < limit && victim->deque.steal(items[n]))
+			n++;
+		if (n > 0)
+			return n;
+	}
+	return 0;
+}
+
+void ConsumerPool::offer(int owner, int surplus) {
+	// pairs with the idle flag a thief sets before its last look: either
+	// it sees the items just pushed, or we see it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	int limit = active.load();
+	for (int i = 1; i < size && surplus > 0; i++) {
+		int thief = (owner + i) % size;
+		if (thief >= limit || !workers[thief]->idle.exchange(false))
+			continue;
+		workers[thief]->wake.cancel();
+		surplus -= CONSUMER_POOL_CHUNK_SIZE;
+	}
+}
+
+void ConsumerPool::wait_until_active(int id) {
+	if (id < active.load())
+		return;
+
+	pthread_mutex_lock(&mutex);
+	while (id >= active.load() && !finished)
+		pthread_cond_wait(&cond_active, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ConsumerPool::finish() {
+	pthread_mutex_lock(&mutex);
+	finished = true;
+	pthread_cond_broadcast(&cond_active);
+	pthread_mutex_unlock(&mutex);
+}
+
+ConsumerPool::Worker::Worker(ConsumerPool* pool, int id) : pool(pool), id(id) {
+	processed.store(0, std::memory_order_relaxed);
+	busy_ns.store(0, std::memory_order_relaxed);
+	idle.store(false);
+}
+
+void ConsumerPool::Worker::start() {
+	create(ConsumerPool::Worker::process, (void*)this);
+}
+
+void* ConsumerPool::Worker::process(void* arg) {
+	Worker* worker = (Worker*)arg;
+	ConsumerPool* pool = worker->pool;
+
+	Item* batch[DEFAULT_BATCH_SIZE];
+
+	StageMetrics* stats = pool->metrics ? pool->metrics->register_stage("consumer") : nullptr;
+
+	while (true) {
+		Item* item;
+		int n = 0;
+
+		while (n < CONSUMER_POOL_CHUNK_SIZE && worker->deque.pop(item))
+			batch[n++] = item;
+
+		// a deactivated worker finishes its own deque but steals nothing
+		if (n == 0 && worker->id < pool->get_active())
+			n = pool->steal(worker->id, batch, CONSUMER_POOL_CHUNK_SIZE);
+
+		if (n > 0) {
+			// the wait covers the worker queue and the time in a deque
+			unsigned long long begin = monotonic_ns();
+			if (stats)
+				stats->record_taken(batch, n, begin);
+			transform_items(pool->transformer, CONSUMER_STAGE, batch, n);
+			unsigned long long end = monotonic_ns();
+			owner_add(worker->busy_ns, end - begin);
+			owner_add(worker->processed, n);
+			if (stats) {
+				stats->record_transform(n, end - begin);
+				StageMetrics::stamp_queued(batch, n, end);
+			}
+			pool->output_queue->enqueue_bulk(batch, n);
+			continue;
+		}
+
+		// the deque is empty and nothing is left to fetch; whatever other
+		// deques still hold, their owners finish themselves
+		if (pool->worker_queue->is_drained()) {
+			pool->finish();
+			break;
+		}
+
+		pool->wait_until_active(worker->id);
+
+		// advertise the wait before looking at the other deques once more:
+		// an owner pushing after that look sees the flag and wakes us
+		worker->wake.reset();
+		worker->idle.store(true);
+		if (worker->id < pool->get_active())
+			n = pool->steal(worker->id, batch, CONSUMER_POOL_CHUNK_SIZE);
+
+		// a sharded worker queue gives every worker its own home shard
+		if (n == 0)
+			n = pool->worker_queue->dequeue_bulk_from(worker->id, batch, DEFAULT_BATCH_SIZE, -1, &worker->wake);
+		worker->idle.store(false);
+
+		for (int i = 0; i < n; i++)
+			worker->deque.push(batch[i]);
+		// whatever the next chunk leaves behind can be stolen
+		if (n > CONSUMER_POOL_CHUNK_SIZE)
+			pool->offer(worker->id, n - CONSUMER_POOL_CHUNK_SIZE);
+	}
+
+	pool->output_queue->detach_source();
+
+	return nullptr;
+}
+
+#endif // CONSUMER_POOL_HPP
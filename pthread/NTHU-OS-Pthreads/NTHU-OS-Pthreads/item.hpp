@@ -3,6 +3,12 @@
 #ifndef ITEM_HPP
 #define ITEM_HPP
 
+// the longest line format() writes: an int, an unsigned long long, an
+// opcode, two spaces and a newline
+#define ITEM_MAX_LINE 48
+
+class ItemPool;
+
 class Item {
 public:
 	Item();
@@ -12,17 +18,35 @@ public:
 	friend std::ostream& operator<<(std::ostream& os, const Item& item);
 	friend std::istream& operator>>(std::istream& in, Item& item);
 
+	// parse "key val opcode" from [p, end) without iostreams, advancing p
+	// past it; false if the input ends before a whole item
+	static bool parse(const char*& p, const char* end, Item& item);
+
+	// format item as "key val opcode\n" into out, which must have room
+	// for ITEM_MAX_LINE chars; return the length written
+	static int format(char* out, const Item& item);
+
 	int key;
 	unsigned long long val;
 	char opcode;
+
+	// the pool the item is recycled into, nullptr if it came from new
+	ItemPool* pool;
+	// the next free item while the item sits in its pool
+	Item* next_free;
+
+	// monotonic ns the item was read and last queued at, only stamped
+	// while the pipeline is measured, see metrics.hpp
+	unsigned long long born_ns;
+	unsigned long long queued_ns;
 };
 
 // Implementation start
 
-Item::Item() {}
+Item::Item() : pool(nullptr), next_free(nullptr), born_ns(0), queued_ns(0) {}
 
 Item::Item(int key, unsigned long long val, char opcode) :
-	key(key), val(val), opcode(opcode) {
+	key(key), val(val), opcode(opcode), pool(nullptr), next_free(nullptr), born_ns(0), queued_ns(0) {
 }
 
 Item::~Item() {}
@@ -37,4 +61,72 @@ std::ostream& operator<<(std::ostream& os, const Item& item) {
 	return os;
 }
 
+static inline bool is_space(char c) {
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline const char* skip_spaces(const char* p, const char* end) {
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+bool Item::parse(const char*& p, const char* end, Item& item) {
+	p = skip_spaces(p, end);
+	bool negative = p < end && *p == '-';
+	if (negative || (p < end && *p == '+'))
+		p++;
+	if (p >= end || *p < '0' || *p > '9')
+		return false;
+	long long key = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		key = key * 10 + (*p++ - '0');
+	item.key = (int)(negative ? -key : key);
+
+	p = skip_spaces(p, end);
+	if (p >= end || *p < '0' || *p > '9')
+		return false;
+	unsigned long long val = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		val = val * 10 + (*p++ - '0');
+	item.val = val;
+
+	p = skip_spaces(p, end);
+	if (p >= end)
+		return false;
+	item.opcode = *p++;
+	return true;
+}
+
+// write the digits of v backwards ending right before end, return the start
+static inline char* format_digits(char* end, unsigned long long v) {
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+int Item::format(char* out, const Item& item) {
+	char digits[24];
+	char* p = out;
+
+	unsigned long long key = item.key < 0 ? -(unsigned long long)(long long)item.key : item.key;
+	if (item.key < 0)
+		*p++ = '-';
+	char* start = format_digits(digits + sizeof(digits), key);
+	for (; start < digits + sizeof(digits); start++)
+		*p++ = *start;
+	*p++ = ' ';
+
+	start = format_digits(digits + sizeof(digits), item.val);
+	for (; start < digits + sizeof(digits); start++)
+		*p++ = *start;
+	*p++ = ' ';
+
+	*p++ = item.opcode;
+	*p++ = '\n';
+	return p - out;
+}
+
 #endif // ITEM_HPP
@@ -0,0 +1,82 @@
+#include "ts_queue.hpp"
+#include "item.hpp"
+#include "transformer.hpp"
+
+#ifndef ITEM_BATCH_HPP
+#define ITEM_BATCH_HPP
+
+// which side of the pipeline a batch is transformed for
+enum TransformStage { PRODUCER_STAGE, CONSUMER_STAGE };
+
+// Transform n items in place. Items are grouped by opcode so that each
+// group goes through one batched Transformer call.
+void transform_items(Transformer* transformer, TransformStage stage, Item** items, int n);
+
+// Enqueue n items to the shards of queue picked by their keys, one bulk
+// call per shard that gets any.
+void enqueue_by_key(TSQueue<Item*>* queue, Item** items, int n);
+
+// Implementation start
+
+void transform_items(Transformer* transformer, TransformStage stage, Item** items, int n) {
+	unsigned long long vals[DEFAULT_BATCH_SIZE];
+	int index[DEFAULT_BATCH_SIZE];
+	bool done[DEFAULT_BATCH_SIZE];
+
+	for (int from = 0; from < n; from += DEFAULT_BATCH_SIZE) {
+		int count = n - from < DEFAULT_BATCH_SIZE ? n - from : DEFAULT_BATCH_SIZE;
+		Item** chunk = items + from;
+
+		for (int i = 0; i < count; i++)
+			done[i] = false;
+
+		for (int i = 0; i < count; i++) {
+			if (done[i])
+				continue;
+
+			char opcode = chunk[i]->opcode;
+			int group = 0;
+			for (int j = i; j < count; j++) {
+				if (!done[j] && chunk[j]->opcode == opcode) {
+					index[group] = j;
+					vals[group++] = chunk[j]->val;
+					done[j] = true;
+				}
+			}
+
+			if (stage == PRODUCER_STAGE)
+				transformer->producer_transform_batch(opcode, vals, group);
+			else
+				transformer->consumer_transform_batch(opcode, vals, group);
+
+			for (int j = 0; j < group; j++)
+				chunk[index[j]]->val = vals[j];
+		}
+	}
+}
+
+void enqueue_by_key(TSQueue<Item*>* queue, Item** items, int n) {
+	int shards = queue->get_shards();
+	if (shards == 1) {
+		queue->enqueue_bulk(items, n);
+		return;
+	}
+
+	Item* group[DEFAULT_BATCH_SIZE];
+	for (int from = 0; from < n; from += DEFAULT_BATCH_SIZE) {
+		int count = n - from < DEFAULT_BATCH_SIZE ? n - from : DEFAULT_BATCH_SIZE;
+		Item** chunk = items + from;
+
+		for (int shard = 0; shard < shards; shard++) {
+			int size = 0;
+			for (int i = 0; i < count; i++) {
+				if ((unsigned int)chunk[i]->key % shards == (unsigned int)shard)
+					group[size++] = chunk[i];
+			}
+			if (size > 0)
+				queue->enqueue_bulk_to(shard, group, size);
+		}
+	}
+}
+
+#endif // ITEM_BATCH_HPP
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <vector>
+#include "lock_free_ring.hpp"
+#include "item.hpp"
+
+#ifndef ITEM_POOL_HPP
+#define ITEM_POOL_HPP
+
+// Items carved out of large slabs for one owner thread. Only the owner
+// acquires, from a private free list; any thread may release, pushing
+// onto a lock-free return stack that the owner takes over in one exchange
+// once its own list runs dry. Items are recycled instead of freed, so the
+// pool only grows when more items are in flight than it was sized for.
+class ItemPool {
+public:
+	// constructor, the first slab holds capacity items
+	explicit ItemPool(int capacity);
+
+	// destructor, every item of the pool must be released or unused
+	~ItemPool();
+
+	// owner only: return a free item, adding a slab if all are in use
+	Item* acquire();
+
+	// any thread: return item to its pool, or delete it if it came from
+	// a plain new
+	static void release(Item* item);
+
+	// any thread: release n items, one push per run of items sharing a pool
+	static void release_bulk(Item** items, int n);
+
+	// owner only: return the number of items in all slabs
+	int get_capacity();
+
+private:
+	void add_slab(int n);
+
+	// push the chain first -> ... -> last onto the return stack
+	void push_returned(Item* first, Item* last);
+
+	int capacity;
+	std::vector<Item*> slabs;
+
+	// the owner's free list
+	Item* free_list;
+
+	char pad0[CACHE_LINE_SIZE];
+	// items released by any thread, not yet taken back by the owner
+	std::atomic<Item*> returned;
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<Item*>)];
+};
+
+// Implementation start
+
+ItemPool::ItemPool(int capacity) : capacity(0), free_list(nullptr) {
+	returned.store(nullptr, std::memory_order_relaxed);
+	add_slab(capacity > 0 ? capacity : 1);
+}
+
+ItemPool::~ItemPool() {
+	for (size_t i = 0; i < slabs.size(); i++)
+		delete[] slabs[i];
+}
+
+Item* ItemPool::acquire() {
+	if (!free_list)
+		free_list = returned.exchange(nullptr, std::memory_order_acquire);
+	if (!free_list)
+		add_slab(capacity);
+
+	Item* item = free_list;
+	free_list = item->next_free;
+	return item;
+}
+
+void ItemPool::release(Item* item) {
+	release_bulk(&item, 1);
+}
+
+void ItemPool::release_bulk(Item** items, int n) {
+	int i = 0;
+	while (i < n) {
+		ItemPool* pool = items[i]->pool;
+		if (!pool) {
+			delete items[i++];
+			continue;
+		}
+
+		Item* first = items[i];
+		Item* last = first;
+		for (i++; i < n && items[i]->pool == pool; i++) {
+			last->next_free = items[i];
+			last = items[i];
+		}
+		pool->push_returned(first, last);
+	}
+}
+
+int ItemPool::get_capacity() {
+	return capacity;
+}
+
+void ItemPool::add_slab(int n) {
+	Item* slab = new Item[n];
+	for (int i = 0; i < n; i++) {
+		slab[i].pool = this;
+		slab[i].next_free = i + 1 < n ? &slab[i + 1] : free_list;
+	}
+	free_list = slab;
+	slabs.push_back(slab);
+	capacity += n;
+}
+
+void ItemPool::push_returned(Item* first, Item* last) {
+	// only the owner removes, and always the whole stack, so there is no ABA
+	Item* head = returned.load(std::memory_order_relaxed);
+	do {
+		last->next_free = head;
+	} while (!returned.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+#endif // ITEM_POOL_HPP
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include "ts_queue.hpp"
+#include "item_pool.hpp"
+
+/* Global shared variables */
+ItemPool* pool;
+TSQueue<Item*>* q;
+int num_items;
+int num_releasers;
+
+void* release(void* arg) {
+	int n = *(int*)arg;
+	Item* items[DEFAULT_BATCH_SIZE];
+
+	while (n > 0) {
+		int got = q->dequeue_bulk(items, n < DEFAULT_BATCH_SIZE ? n : DEFAULT_BATCH_SIZE, -1);
+		for (int i = 0; i < got; i++)
+			assert(items[i]->key == (int)items[i]->val);
+		ItemPool::release_bulk(items, got);
+		n -= got;
+	}
+
+	return nullptr;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 3);
+
+	num_items = atoi(argv[1]);
+	num_releasers = atoi(argv[2]);
+
+	// the queue bounds the items in flight, so the pool never has to grow
+	pool = new ItemPool(DEFAULT_BUFFER_SIZE + 2 * DEFAULT_BATCH_SIZE * num_releasers);
+	q = new TSQueue<Item*>(DEFAULT_BUFFER_SIZE);
+	int capacity = pool->get_capacity();
+
+	pthread_t* releasers = new pthread_t[num_releasers];
+	int* shares = new int[num_releasers];
+	for (int i = 0; i < num_releasers; i++) {
+		shares[i] = num_items / num_releasers + (i < num_items % num_releasers);
+		pthread_create(&releasers[i], 0, release, &shares[i]);
+	}
+
+	// the owner acquires and hands items to the releasers, plain new items
+	// mixed in must be deleted by release instead of entering the pool
+	for (int i = 0; i < num_items; i++) {
+		Item* item = i % 7 == 0 ? new Item : pool->acquire();
+		item->key = i;
+		item->val = i;
+		q->enqueue(item);
+	}
+
+	for (int i = 0; i < num_releasers; i++)
+		pthread_join(releasers[i], 0);
+
+	// every pooled item must be back and reusable
+	Item** items = new Item*[capacity];
+	for (int i = 0; i < capacity; i++)
+		items[i] = pool->acquire();
+	bool grew = pool->get_capacity() != capacity;
+
+	printf("items: %d, pool capacity: %d, grew: %s\n", num_items, pool->get_capacity(), grew ? "yes" : "no");
+
+	return grew;
+}
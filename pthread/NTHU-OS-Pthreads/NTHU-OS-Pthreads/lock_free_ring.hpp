@@ -0,0 +1,349 @@
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include "ts_queue.hpp"
+
+#ifndef LOCK_FREE_RING_HPP
+#define LOCK_FREE_RING_HPP
+
+// How many failed attempts a blocking call makes before it parks.
+// On a uniprocessor nobody can make progress while we spin, so we
+// park right away there.
+#define LOCK_FREE_RING_SPIN_LIMIT 128
+
+// Bounded multi-producer/multi-consumer ring (Vyukov). Every slot carries
+// a sequence number telling whether it is ready to be written (seq == pos)
+// or read (seq == pos + 1) for the lap `pos` currently points at, so
+// producers and consumers only contend on their own index. The mutex and
+// condvars are touched only when the ring is full or empty.
+template <class T>
+class LockFreeRing
+{
+public:
+	// constructor, the capacity is rounded up to a power of two, at least 2
+	explicit LockFreeRing(int max_buffer_size);
+
+	// destructor
+	~LockFreeRing();
+
+	// append n elements, spinning and then parking whenever the ring is full
+	void enqueue_bulk(T* items, int n);
+
+	// remove up to max elements, see TSQueue::dequeue_bulk; spins, then
+	// parks for the first element
+	int dequeue_bulk(T* items, int max, long timeout, const CancelToken* token);
+
+	// remove up to max elements if there are any, never blocks
+	int try_dequeue_bulk(T* items, int max);
+
+	// return the number of elements in the ring
+	int get_size();
+
+	// keep the buffer on NUMA node
+	void bind_to_node(int node);
+
+	// stop dequeues from waiting once the ring is empty
+	void close();
+
+	// wake every parked dequeue so it rechecks its token
+	void interrupt();
+
+	// append the element if there is room, never blocks
+	bool try_enqueue(T item);
+
+	// remove the first element into item if there is one, never blocks
+	bool try_dequeue(T& item);
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	// wake the threads parked on cond for n new elements or slots,
+	// if waiters says there is any
+	void wake(std::atomic<int>& waiters, pthread_cond_t* cond, int n);
+
+	Cell* buffer;
+	size_t mask;
+	int spin_limit;
+
+	// producers and consumers each own a cache line
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<size_t> enqueue_pos;
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> dequeue_pos;
+	char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+	// number of threads parked on each condvar
+	std::atomic<int> enqueue_waiters;
+	std::atomic<int> dequeue_waiters;
+
+	// set by close, read by parked dequeues under park_mutex
+	std::atomic<bool> closed;
+
+	// only used by the parking slow path
+	pthread_mutex_t park_mutex;
+	pthread_cond_t cond_enqueue, cond_dequeue;
+};
+
+// Implementation start
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	sched_yield();
+#endif
+}
+
+template <class T>
+LockFreeRing<T>::LockFreeRing(int max_buffer_size)
+{
+	// with one slot seq == pos + 1 would also mean "free" on the next
+	// lap, so a full ring would be written over
+	size_t capacity = 2;
+	while (capacity < (size_t)max_buffer_size)
+		capacity <<= 1;
+
+	// on pages of its own, see bind_to_node
+	buffer = (Cell*) alloc_pages(capacity * sizeof(Cell));
+	mask = capacity - 1;
+	spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOCK_FREE_RING_SPIN_LIMIT : 1;
+	for (size_t i = 0; i < capacity; i++) {
+		new (&buffer[i]) Cell;
+		buffer[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	enqueue_pos.store(0, std::memory_order_relaxed);
+	dequeue_pos.store(0, std::memory_order_relaxed);
+	enqueue_waiters.store(0, std::memory_order_relaxed);
+	dequeue_waiters.store(0, std::memory_order_relaxed);
+	closed.store(false);
+
+	// timed waits are measured on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&park_mutex, nullptr);
+	pthread_cond_init(&cond_enqueue, &attr);
+	pthread_cond_init(&cond_dequeue, &attr);
+
+	pthread_condattr_destroy(&attr);
+}
+
+template <class T>
+LockFreeRing<T>::~LockFreeRing()
+{
+	// every thread using the ring has to be joined by now
+	for (size_t i = 0; i <= mask; i++)
+		buffer[i].~Cell();
+	free(buffer);
+
+	pthread_mutex_destroy(&park_mutex);
+	pthread_cond_destroy(&cond_enqueue);
+	pthread_cond_destroy(&cond_dequeue);
+}
+
+template <class T>
+bool LockFreeRing<T>::try_enqueue(T item)
+{
+	Cell* cell;
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+	while (true) {
+		cell = &buffer[pos & mask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// the slot still holds an element from the previous lap
+			return false;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->data = item;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+template <class T>
+bool LockFreeRing<T>::try_dequeue(T& item)
+{
+	Cell* cell;
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+	while (true) {
+		cell = &buffer[pos & mask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+
+		if (diff == 0) {
+			if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// the slot has not been written for this lap yet
+			return false;
+		} else {
+			pos = dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	item = cell->data;
+	cell->sequence.store(pos + mask + 1, std::memory_order_release);
+	return true;
+}
+
+template <class T>
+void LockFreeRing<T>::wake(std::atomic<int>& waiters, pthread_cond_t* cond, int n)
+{
+	// pairs with the fence in the parking path: either the parked thread
+	// sees our update to the ring, or we see its waiter count
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (n == 0 || waiters.load(std::memory_order_relaxed) == 0)
+		return;
+
+	pthread_mutex_lock(&park_mutex);
+	notify(cond, n);
+	pthread_mutex_unlock(&park_mutex);
+}
+
+template <class T>
+void LockFreeRing<T>::enqueue_bulk(T* items, int n)
+{
+	int published = 0;
+
+	for (int i = 0; i < n; i++) {
+		if (try_enqueue(items[i])) {
+			published++;
+			continue;
+		}
+
+		// the ring is full, let consumers at what we have so far
+		wake(dequeue_waiters, &cond_dequeue, published);
+		published = 0;
+
+		bool done = false;
+		for (int spin = 1; spin < spin_limit && !done; spin++) {
+			cpu_relax();
+			done = try_enqueue(items[i]);
+		}
+
+		if (!done) {
+			pthread_mutex_lock(&park_mutex);
+			enqueue_waiters.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (!try_enqueue(items[i]))
+				pthread_cond_wait(&cond_enqueue, &park_mutex);
+			enqueue_waiters.fetch_sub(1);
+			pthread_mutex_unlock(&park_mutex);
+		}
+		published++;
+	}
+
+	wake(dequeue_waiters, &cond_dequeue, published);
+}
+
+template <class T>
+int LockFreeRing<T>::dequeue_bulk(T* items, int max, long timeout, const CancelToken* token)
+{
+	bool done = try_dequeue(items[0]);
+
+	for (int spin = 1; spin < spin_limit && !done; spin++) {
+		cpu_relax();
+		done = try_dequeue(items[0]);
+	}
+
+	if (!done) {
+		struct timespec deadline;
+		if (timeout >= 0)
+			deadline = deadline_after(timeout);
+
+		pthread_mutex_lock(&park_mutex);
+		dequeue_waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (!(done = try_dequeue(items[0]))) {
+			if (closed.load() || (token && token->is_cancelled()))
+				break;
+			if (timeout < 0)
+				pthread_cond_wait(&cond_dequeue, &park_mutex);
+			else if (pthread_cond_timedwait(&cond_dequeue, &park_mutex, &deadline) == ETIMEDOUT)
+				break;
+		}
+		if (!done)
+			done = try_dequeue(items[0]);
+		dequeue_waiters.fetch_sub(1);
+		pthread_mutex_unlock(&park_mutex);
+
+		if (!done)
+			return 0;
+	}
+
+	int count = 1;
+	while (count < max && try_dequeue(items[count]))
+		count++;
+
+	wake(enqueue_waiters, &cond_enqueue, count);
+	return count;
+}
+
+template <class T>
+int LockFreeRing<T>::try_dequeue_bulk(T* items, int max)
+{
+	int count = 0;
+	while (count < max && try_dequeue(items[count]))
+		count++;
+
+	wake(enqueue_waiters, &cond_enqueue, count);
+	return count;
+}
+
+template <class T>
+int LockFreeRing<T>::get_size()
+{
+	size_t head = dequeue_pos.load(std::memory_order_relaxed);
+	size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+
+	// the two loads are not atomic together, clamp a torn read
+	if (tail <= head)
+		return 0;
+	if (tail - head > mask + 1)
+		return (int)(mask + 1);
+	return (int)(tail - head);
+}
+
+template <class T>
+void LockFreeRing<T>::bind_to_node(int node)
+{
+	::bind_to_node(buffer, (mask + 1) * sizeof(Cell), node);
+}
+
+template <class T>
+void LockFreeRing<T>::close()
+{
+	pthread_mutex_lock(&park_mutex);
+	closed.store(true);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&park_mutex);
+}
+
+template <class T>
+void LockFreeRing<T>::interrupt()
+{
+	pthread_mutex_lock(&park_mutex);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&park_mutex);
+}
+
+#endif // LOCK_FREE_RING_HPP
@@ -1,11 +1,17 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
 #include "ts_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_buffer.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
 #include "producer.hpp"
 #include "consumer_controller.hpp"
+#include "metrics.hpp"
+#include "topology.hpp"
 
 #define READER_QUEUE_SIZE 200
 #define WORKER_QUEUE_SIZE 200
@@ -13,6 +19,28 @@
 #define CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE 20
 #define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
 #define CONSUMER_CONTROLLER_CHECK_PERIOD 1000000
+#define METRICS_SAMPLE_PERIOD 1000
+#define METRICS_REPORT_PERIOD 1000000
+#define NUM_PRODUCERS 4
+
+// the worker queue gets a shard per this many online cpus, so consumers
+// beyond that do not all contend on one head index
+#define CONSUMERS_PER_SHARD 4
+
+// how far past the next key to write the reader may run ahead, the output
+// is written in key order
+#define REORDER_WINDOW 4096
+
+// every live item sits in a queue or in the batch some stage is working
+// on, the pool grows past this only if the stages hold more than the slack
+#define ITEM_POOL_SLACK (64 * DEFAULT_BATCH_SIZE)
+
+// the positive integer in environment variable name, or fallback
+static int env_int(const char* name, int fallback) {
+	const char* value = getenv(name);
+	int n = value ? atoi(value) : 0;
+	return n > 0 ? n : fallback;
+}
 
 int main(int argc, char** argv) {
 	assert(argc == 4);
@@ -21,44 +49,127 @@ int main(int argc, char** argv) {
 	std::string input_file_name(argv[2]);
 	std::string output_file_name(argv[3]);
 
+	// scripts/bench_pipeline.py sweeps these: PIPELINE_QUEUE_SIZE sets the
+	// reader and worker queues, PIPELINE_PRODUCERS the producer threads and
+	// PIPELINE_CONSUMERS the most consumers the controller may run
+	int reader_queue_size = env_int("PIPELINE_QUEUE_SIZE", READER_QUEUE_SIZE);
+	int worker_queue_size = env_int("PIPELINE_QUEUE_SIZE", WORKER_QUEUE_SIZE);
+	int num_producers = env_int("PIPELINE_PRODUCERS", NUM_PRODUCERS);
+	// 0 is one consumer per online core
+	int max_consumers = env_int("PIPELINE_CONSUMERS", 0);
+
+	// PIPELINE_WORKER_SHARDS=<n> overrides the shard count and
+	// PIPELINE_SHARD_BY_KEY=1 makes producers pick shards by item key
+	long cpus = max_consumers > 0 ? max_consumers : sysconf(_SC_NPROCESSORS_ONLN);
+	int worker_shards = env_int("PIPELINE_WORKER_SHARDS", cpus > CONSUMERS_PER_SHARD ? (cpus + CONSUMERS_PER_SHARD - 1) / CONSUMERS_PER_SHARD : 1);
+
 	// TODO: implements main function
 	TSQueue<Item*>* Input_Queue;
 	TSQueue<Item*>* Worker_Queue;
 	TSQueue<Item*>* Writer_Queue;
 
-	Input_Queue = new TSQueue<Item*>;
-	Worker_Queue = new TSQueue<Item*>;
-	Writer_Queue = new TSQueue<Item*>;
+	Input_Queue = new TSQueue<Item*>(reader_queue_size);
+	Worker_Queue = new TSQueue<Item*>(worker_queue_size, worker_shards);
+	Writer_Queue = new TSQueue<Item*>(WRITER_QUEUE_SIZE);
+
+	ItemPool* item_pool = new ItemPool(reader_queue_size + worker_queue_size + WRITER_QUEUE_SIZE + ITEM_POOL_SLACK);
+	ReorderBuffer* reorder = new ReorderBuffer(REORDER_WINDOW);
+
+	// PIPELINE_METRICS=<file> appends a JSON snapshot of the stage latencies
+	// and queue occupancy to file every report period and once at the end
+	Metrics* metrics = nullptr;
+	std::ofstream* metrics_file = nullptr;
+	if (getenv("PIPELINE_METRICS")) {
+		metrics = new Metrics;
+		metrics_file = new std::ofstream(getenv("PIPELINE_METRICS"), std::ios::app);
+		metrics->watch_queue("input", Input_Queue);
+		metrics->watch_queue("worker", Worker_Queue);
+		metrics->watch_queue("writer", Writer_Queue);
+	}
 
-	Transformer* transformer = new Transformer;
+	// TRANSFORMER_VERIFY=1 checks every closed-form transform against the loop
+	Transformer* transformer = new Transformer(getenv("TRANSFORMER_VERIFY") != nullptr);
 
-	Reader* reader = new Reader(n, input_file_name, Input_Queue);
-	Writer* writer = new Writer(n, output_file_name, Writer_Queue);
+	Reader* reader = new Reader(n, input_file_name, Input_Queue, item_pool, reorder, metrics);
+	Writer* writer = new Writer(n, output_file_name, Writer_Queue, reorder, metrics);
 
-	Producer* producer_1 = new Producer(Input_Queue, Worker_Queue, transformer);
-	Producer* producer_2 = new Producer(Input_Queue, Worker_Queue, transformer);
-	Producer* producer_3 = new Producer(Input_Queue, Worker_Queue, transformer);
-	Producer* producer_4 = new Producer(Input_Queue, Worker_Queue, transformer);
+	Producer** producers = new Producer*[num_producers];
+	for (int i = 0; i < num_producers; i++) {
+		producers[i] = new Producer(Input_Queue, Worker_Queue, transformer, metrics);
+		producers[i]->set_shard_by_key(getenv("PIPELINE_SHARD_BY_KEY") != nullptr);
+	}
 
-	int low_threshold = WORKER_QUEUE_SIZE * CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * 0.01;
-	int high_threshold = WORKER_QUEUE_SIZE * CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * 0.01;
-	ConsumerController* controller = new ConsumerController(Worker_Queue, Writer_Queue, transformer, CONSUMER_CONTROLLER_CHECK_PERIOD, low_threshold, high_threshold);
+	int low_threshold = worker_queue_size * CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * 0.01;
+	int high_threshold = worker_queue_size * CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * 0.01;
+	ConsumerController* controller = new ConsumerController(Worker_Queue, Writer_Queue, transformer, CONSUMER_CONTROLLER_CHECK_PERIOD, low_threshold, high_threshold, metrics, max_consumers);
+
+	MetricsReporter* reporter = nullptr;
+	if (metrics)
+		reporter = new MetricsReporter(metrics, metrics_file, METRICS_SAMPLE_PERIOD, METRICS_REPORT_PERIOD);
+
+	// PIPELINE_AFFINITY=1 keeps the stages in one L3 domain, pins the
+	// consumers to cpus and puts each queue on the NUMA node of the
+	// stage draining it
+	Topology* topology = nullptr;
+	Placement* placement = nullptr;
+	if (getenv("PIPELINE_AFFINITY")) {
+		topology = new Topology;
+		placement = new Placement(topology);
+
+		cpu_set_t home;
+		placement->home_cpus(home);
+		reader->set_affinity(home);
+		writer->set_affinity(home);
+		for (int i = 0; i < num_producers; i++)
+			producers[i]->set_affinity(home);
+		if (reporter)
+			reporter->set_affinity(home);
+		controller->set_placement(placement);
+
+		if (topology->get_num_nodes() > 1) {
+			// the producers and the writer run in the home domain; worker
+			// id drains shard id % shards first, so a shard goes where the
+			// lowest of its workers runs
+			Input_Queue->bind_to_node(placement->home_node());
+			for (int i = 0; i < Worker_Queue->get_shards(); i++)
+				Worker_Queue->bind_shard_to_node(i, placement->consumer_node(i));
+			Writer_Queue->bind_to_node(placement->home_node());
+		}
+	}
+
+	if (reporter)
+		reporter->start();
 
 	reader->start();
 	writer->start();
 
 	controller->start();
 
-	producer_1->start();
-	producer_2->start();
-	producer_3->start();
-	producer_4->start();
+	for (int i = 0; i < num_producers; i++)
+		producers[i]->start();
 
+	// every stage exits once the queue it reads from is closed and drained,
+	// the reader closing the input queue starts it off
 	reader->join();
+	for (int i = 0; i < num_producers; i++)
+		producers[i]->join();
 	writer->join();
 
-	delete producer_1;
-	delete producer_2;
+	// the consumers are done by now, the controller only has to stop
+	// checking and join them
+	controller->cancel();
+	controller->join();
+
+	if (reporter)
+		reporter->stop();
+
+	// CONSUMER_CONTROLLER_LOG=1 prints why the consumers were scaled
+	if (getenv("CONSUMER_CONTROLLER_LOG"))
+		controller->dump_decisions(std::cerr);
+
+	for (int i = 0; i < num_producers; i++)
+		delete producers[i];
+	delete[] producers;
 	delete writer;
 	delete reader;
 	delete transformer;
@@ -66,6 +177,13 @@ int main(int argc, char** argv) {
 	delete Worker_Queue;
 	delete Writer_Queue;
 	delete controller;
+	delete item_pool;
+	delete reorder;
+	delete reporter;
+	delete placement;
+	delete topology;
+	delete metrics_file;
+	delete metrics;
 
 	return 0;
 }
@@ -0,0 +1,499 @@
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <ostream>
+#include <string.h>
+#include "thread.hpp"
+#include "ts_queue.hpp"
+#include "item.hpp"
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+// a histogram bucket covers 1/METRICS_SUB_BUCKETS of its power of two,
+// so a reported value is at most that fraction above the true one
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+// the most stage threads that can register, later ones go unmeasured
+#define METRICS_MAX_STAGES 256
+
+// the most queues whose occupancy can be watched
+#define METRICS_MAX_QUEUES 8
+
+// nanoseconds on the monotonic clock
+static inline unsigned long long monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// add v to a counter only the calling thread writes, without a locked add
+static inline void owner_add(std::atomic<unsigned long long>& counter, unsigned long long v) {
+	counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+// A log-linear histogram in the style of HdrHistogram: values below
+// METRICS_SUB_BUCKETS are counted exactly, every power of two above that
+// is split into METRICS_SUB_BUCKETS equal buckets. One thread records,
+// any thread may read at any time; all counts are relaxed atomics.
+class Histogram {
+public:
+	Histogram();
+
+	// owner only: count value count times
+	void record(unsigned long long value, unsigned long long count = 1);
+
+	// add the counts of other, which may still be recording, to this one
+	void merge(const Histogram& other);
+
+	unsigned long long get_count() const;
+	unsigned long long get_min() const;
+	unsigned long long get_max() const;
+	double get_mean() const;
+
+	// the value fraction q of the recorded values are at or below,
+	// rounded up to the end of its bucket; 0 if nothing was recorded
+	unsigned long long percentile(double q) const;
+
+	// write {"count":..,"min":..,..,"p999":..}
+	void write_json(std::ostream& os) const;
+
+	// return the bucket value is counted in
+	static int bucket_of(unsigned long long value);
+
+	// return the largest value counted in bucket
+	static unsigned long long bucket_high(int bucket);
+
+private:
+	std::atomic<unsigned long long> buckets[METRICS_BUCKETS];
+	std::atomic<unsigned long long> count;
+	std::atomic<unsigned long long> sum;
+	std::atomic<unsigned long long> min;
+	std::atomic<unsigned long long> max;
+};
+
+// What one thread of a pipeline stage measured. Every stage thread
+// registers its own, so recording never contends; only that thread writes.
+class StageMetrics {
+public:
+	explicit StageMetrics(const char* stage);
+
+	// stamp n items as entering a queue at now
+	static void stamp_queued(Item** items, int n, unsigned long long now);
+
+	// n items entered the pipeline at now
+	void record_read(Item** items, int n, unsigned long long now);
+
+	// n items were taken off the stage's input at now
+	void record_taken(Item** items, int n, unsigned long long now);
+
+	// n items took ns to transform
+	void record_transform(int n, unsigned long long ns);
+
+	// n items left the pipeline at now
+	void record_written(Item** items, int n, unsigned long long now);
+
+	const char* stage;
+
+	std::atomic<unsigned long long> items;
+	std::atomic<unsigned long long> batches;
+
+	// ns between an item being queued and being taken by this stage
+	Histogram queue_wait;
+	// ns per item spent in the Transformer
+	Histogram transform;
+	// ns between an item being read and being written
+	Histogram end_to_end;
+};
+
+// Per-stage counters and latency histograms of the whole pipeline, plus
+// the sampled occupancy of its queues. Snapshots add up the per-thread
+// StageMetrics without locking, so taking one never stalls a stage.
+class Metrics {
+public:
+	Metrics();
+
+	~Metrics();
+
+	// any thread: return a fresh StageMetrics for the calling thread of
+	// stage, nullptr once METRICS_MAX_STAGES are registered
+	StageMetrics* register_stage(const char* stage);
+
+	// watch the occupancy of queue under name; call before sampling starts
+	void watch_queue(const char* name, TSQueue<Item*>* queue);
+
+	// sampler only: record the current depth of every watched queue
+	void sample_queues();
+
+	// sampler only: write a snapshot of everything measured so far as one
+	// line of JSON
+	void write_json(std::ostream& os);
+
+private:
+	struct WatchedQueue {
+		const char* name;
+		TSQueue<Item*>* queue;
+		int depth;
+		Histogram occupancy;
+	};
+
+	unsigned long long started;
+
+	std::atomic<StageMetrics*> stages[METRICS_MAX_STAGES];
+	std::atomic<int> num_stages;
+
+	WatchedQueue* queues[METRICS_MAX_QUEUES];
+	int num_queues;
+};
+
+// Samples the queues of a Metrics every sample period and writes a JSON
+// snapshot line every report period, both in microseconds.
+class MetricsReporter : public Thread {
+public:
+	MetricsReporter(Metrics* metrics, std::ostream* os, long sample_period, long report_period);
+
+	~MetricsReporter();
+
+	virtual void start() override;
+
+	// write one last snapshot and join the reporter thread
+	void stop();
+
+private:
+	Metrics* metrics;
+	std::ostream* os;
+
+	long sample_period;
+	long report_period;
+
+	bool stopped;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_stop;
+
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+Histogram::Histogram() {
+	for (int i = 0; i < METRICS_BUCKETS; i++)
+		buckets[i].store(0, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	min.store(~0ULL, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::bucket_of(unsigned long long value) {
+	if (value < METRICS_SUB_BUCKETS)
+		return (int)value;
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - METRICS_SUB_BITS;
+	return (shift + 1) * METRICS_SUB_BUCKETS + (int)(value >> shift) - METRICS_SUB_BUCKETS;
+}
+
+unsigned long long Histogram::bucket_high(int bucket) {
+	if (bucket < METRICS_SUB_BUCKETS)
+		return bucket;
+	int shift = bucket / METRICS_SUB_BUCKETS - 1;
+	unsigned long long low = (unsigned long long)(METRICS_SUB_BUCKETS + bucket % METRICS_SUB_BUCKETS) << shift;
+	return low + ((1ULL << shift) - 1);
+}
+
+void Histogram::record(unsigned long long value, unsigned long long n) {
+	owner_add(buckets[bucket_of(value)], n);
+	owner_add(count, n);
+	owner_add(sum, value * n);
+	if (value < min.load(std::memory_order_relaxed))
+		min.store(value, std::memory_order_relaxed);
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+}
+
+void Histogram::merge(const Histogram& other) {
+	for (int i = 0; i < METRICS_BUCKETS; i++)
+		owner_add(buckets[i], other.buckets[i].load(std::memory_order_relaxed));
+	owner_add(count, other.count.load(std::memory_order_relaxed));
+	owner_add(sum, other.sum.load(std::memory_order_relaxed));
+
+	unsigned long long v = other.min.load(std::memory_order_relaxed);
+	if (v < min.load(std::memory_order_relaxed))
+		min.store(v, std::memory_order_relaxed);
+	v = other.max.load(std::memory_order_relaxed);
+	if (v > max.load(std::memory_order_relaxed))
+		max.store(v, std::memory_order_relaxed);
+}
+
+unsigned long long Histogram::get_count() const {
+	return count.load(std::memory_order_relaxed);
+}
+
+unsigned long long Histogram::get_min() const {
+	return get_count() ? min.load(std::memory_order_relaxed) : 0;
+}
+
+unsigned long long Histogram::get_max() const {
+	return max.load(std::memory_order_relaxed);
+}
+
+double Histogram::get_mean() const {
+	unsigned long long n = get_count();
+	return n ? (double)sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+unsigned long long Histogram::percentile(double q) const {
+	// the buckets are read one by one while the owner may still record,
+	// so rank against what is actually summed rather than count
+	unsigned long long total = 0;
+	for (int i = 0; i < METRICS_BUCKETS; i++)
+		total += buckets[i].load(std::memory_order_relaxed);
+	if (total == 0)
+		return 0;
+
+	unsigned long long rank = (unsigned long long)(q * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	unsigned long long seen = 0;
+	for (int i = 0; i < METRICS_BUCKETS; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			unsigned long long high = bucket_high(i);
+			return high < get_max() ? high : get_max();
+		}
+	}
+	return get_max();
+}
+
+void Histogram::write_json(std::ostream& os) const {
+	os << "{\"count\":" << get_count()
+		<< ",\"min\":" << get_min()
+		<< ",\"max\":" << get_max()
+		<< ",\"mean\":" << get_mean()
+		<< ",\"p50\":" << percentile(0.5)
+		<< ",\"p90\":" << percentile(0.9)
+		<< ",\"p99\":" << percentile(0.99)
+		<< ",\"p999\":" << percentile(0.999) << "}";
+}
+
+StageMetrics::StageMetrics(const char* stage) : stage(stage) {
+	items.store(0, std::memory_order_relaxed);
+	batches.store(0, std::memory_order_relaxed);
+}
+
+void StageMetrics::stamp_queued(Item** items, int n, unsigned long long now) {
+	for (int i = 0; i < n; i++)
+		items[i]->queued_ns = now;
+}
+
+void StageMetrics::record_read(Item** read, int n, unsigned long long now) {
+	owner_add(items, n);
+	owner_add(batches, 1);
+	for (int i = 0; i < n; i++) {
+		read[i]->born_ns = now;
+		read[i]->queued_ns = now;
+	}
+}
+
+void StageMetrics::record_taken(Item** taken, int n, unsigned long long now) {
+	if (n <= 0)
+		return;
+	owner_add(items, n);
+	owner_add(batches, 1);
+	for (int i = 0; i < n; i++) {
+		// an item stamped by another thread's clock read may look newer
+		unsigned long long queued = taken[i]->queued_ns;
+		queue_wait.record(now > queued ? now - queued : 0);
+	}
+}
+
+void StageMetrics::record_transform(int n, unsigned long long ns) {
+	if (n > 0)
+		transform.record(ns / n, n);
+}
+
+void StageMetrics::record_written(Item** written, int n, unsigned long long now) {
+	for (int i = 0; i < n; i++) {
+		unsigned long long born = written[i]->born_ns;
+		end_to_end.record(now > born ? now - born : 0);
+	}
+}
+
+Metrics::Metrics() : started(monotonic_ns()), num_queues(0) {
+	for (int i = 0; i < METRICS_MAX_STAGES; i++)
+		stages[i].store(nullptr, std::memory_order_relaxed);
+	num_stages.store(0, std::memory_order_relaxed);
+}
+
+Metrics::~Metrics() {
+	// stage threads are not joined before main returns, so their
+	// StageMetrics are left to the process exit like the queues' buffers
+	for (int i = 0; i < num_queues; i++)
+		delete queues[i];
+}
+
+StageMetrics* Metrics::register_stage(const char* stage) {
+	int i = num_stages.fetch_add(1, std::memory_order_relaxed);
+	if (i >= METRICS_MAX_STAGES)
+		return nullptr;
+	StageMetrics* metrics = new StageMetrics(stage);
+	stages[i].store(metrics, std::memory_order_release);
+	return metrics;
+}
+
+void Metrics::watch_queue(const char* name, TSQueue<Item*>* queue) {
+	if (num_queues == METRICS_MAX_QUEUES)
+		return;
+	WatchedQueue* watched = new WatchedQueue;
+	watched->name = name;
+	watched->queue = queue;
+	watched->depth = 0;
+	queues[num_queues++] = watched;
+}
+
+void Metrics::sample_queues() {
+	for (int i = 0; i < num_queues; i++) {
+		queues[i]->depth = queues[i]->queue->get_size();
+		queues[i]->occupancy.record(queues[i]->depth);
+	}
+}
+
+void Metrics::write_json(std::ostream& os) {
+	int n = num_stages.load(std::memory_order_relaxed);
+	if (n > METRICS_MAX_STAGES)
+		n = METRICS_MAX_STAGES;
+
+	double elapsed = (monotonic_ns() - started) / 1e9;
+	os << "{\"time\":" << elapsed << ",\"stages\":{";
+
+	// add up the threads of each stage in order of first registration
+	bool* done = new bool[n]();
+	bool first = true;
+	for (int i = 0; i < n; i++) {
+		StageMetrics* head = stages[i].load(std::memory_order_acquire);
+		if (done[i] || !head)
+			continue;
+
+		int threads = 0;
+		unsigned long long items = 0, batches = 0;
+		Histogram* wait = new Histogram;
+		Histogram* transform = new Histogram;
+		Histogram* end_to_end = new Histogram;
+
+		for (int j = i; j < n; j++) {
+			StageMetrics* s = stages[j].load(std::memory_order_acquire);
+			if (done[j] || !s || strcmp(s->stage, head->stage) != 0)
+				continue;
+			done[j] = true;
+			threads++;
+			items += s->items.load(std::memory_order_relaxed);
+			batches += s->batches.load(std::memory_order_relaxed);
+			wait->merge(s->queue_wait);
+			transform->merge(s->transform);
+			end_to_end->merge(s->end_to_end);
+		}
+
+		os << (first ? "" : ",") << "\"" << head->stage << "\":{\"threads\":" << threads
+			<< ",\"items\":" << items << ",\"batches\":" << batches
+			<< ",\"items_per_sec\":" << (elapsed > 0 ? items / elapsed : 0)
+			<< ",\"queue_wait_ns\":";
+		wait->write_json(os);
+		os << ",\"transform_ns\":";
+		transform->write_json(os);
+		os << ",\"end_to_end_ns\":";
+		end_to_end->write_json(os);
+		os << "}";
+		first = false;
+
+		delete wait;
+		delete transform;
+		delete end_to_end;
+	}
+	delete[] done;
+
+	os << "},\"queues\":{";
+	for (int i = 0; i < num_queues; i++) {
+		os << (i ? "," : "") << "\"" << queues[i]->name << "\":{\"depth\":" << queues[i]->depth
+			<< ",\"enqueued\":" << queues[i]->queue->get_enqueued()
+			<< ",\"occupancy\":";
+		queues[i]->occupancy.write_json(os);
+		os << "}";
+	}
+	os << "}}\n";
+	os.flush();
+}
+
+MetricsReporter::MetricsReporter(Metrics* metrics, std::ostream* os, long sample_period, long report_period)
+	: metrics(metrics), os(os), sample_period(sample_period), report_period(report_period), stopped(false) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_stop, &attr);
+
+	pthread_condattr_destroy(&attr);
+}
+
+MetricsReporter::~MetricsReporter() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_stop);
+}
+
+void MetricsReporter::start() {
+	create(MetricsReporter::process, (void*)this);
+}
+
+void MetricsReporter::stop() {
+	pthread_mutex_lock(&mutex);
+	stopped = true;
+	pthread_cond_signal(&cond_stop);
+	pthread_mutex_unlock(&mutex);
+
+	join();
+}
+
+void* MetricsReporter::process(void* arg) {
+	MetricsReporter* reporter = (MetricsReporter*)arg;
+
+	// samples are taken on absolute times, so writing a snapshot does not
+	// shift the sampling period
+	struct timespec next = deadline_after(0);
+	unsigned long long next_report = monotonic_ns() + reporter->report_period * 1000ULL;
+
+	pthread_mutex_lock(&reporter->mutex);
+	while (!reporter->stopped) {
+		next.tv_sec += reporter->sample_period / 1000000;
+		next.tv_nsec += (reporter->sample_period % 1000000) * 1000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		while (!reporter->stopped
+			&& pthread_cond_timedwait(&reporter->cond_stop, &reporter->mutex, &next) != ETIMEDOUT)
+			;
+		if (reporter->stopped)
+			break;
+
+		pthread_mutex_unlock(&reporter->mutex);
+
+		reporter->metrics->sample_queues();
+		if (monotonic_ns() >= next_report) {
+			reporter->metrics->write_json(*reporter->os);
+			next_report += reporter->report_period * 1000ULL;
+		}
+
+		pthread_mutex_lock(&reporter->mutex);
+	}
+	pthread_mutex_unlock(&reporter->mutex);
+
+	reporter->metrics->sample_queues();
+	reporter->metrics->write_json(*reporter->os);
+
+	return nullptr;
+}
+
+#endif // METRICS_HPP
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sstream>
+#include "metrics.hpp"
+
+/* Global shared variables */
+Metrics* metrics;
+StageMetrics** registered;
+int num_values;
+std::atomic<int> finished;
+
+// record 1..num_values as queue waits, the way a stage thread would
+void* record(void* arg) {
+	int tid = *(int*)arg;
+
+	StageMetrics* stats = metrics->register_stage("stage");
+	assert(stats);
+	registered[tid] = stats;
+
+	Item item;
+	Item* items[1] = { &item };
+	for (int v = 1; v <= num_values; v++) {
+		item.queued_ns = 1000;
+		stats->record_taken(items, 1, 1000 + v);
+	}
+
+	finished.fetch_add(1);
+	return nullptr;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 3);
+
+	num_values = atoi(argv[1]);
+	int num_threads = atoi(argv[2]);
+
+	// every value lands in a bucket whose end is within the precision
+	for (unsigned long long v = 0; v < (1ULL << 20); v += v / 64 + 1) {
+		int b = Histogram::bucket_of(v);
+		unsigned long long high = Histogram::bucket_high(b);
+		assert(high >= v);
+		assert(high - v <= v / METRICS_SUB_BUCKETS);
+		assert(b == 0 || Histogram::bucket_high(b - 1) < v);
+	}
+	assert(Histogram::bucket_of(~0ULL) < METRICS_BUCKETS);
+
+	metrics = new Metrics;
+	finished.store(0);
+
+	pthread_t* threads = new pthread_t[num_threads];
+	int* tids = new int[num_threads];
+	registered = new StageMetrics*[num_threads];
+	for (int i = 0; i < num_threads; i++) {
+		tids[i] = i;
+		pthread_create(&threads[i], 0, record, &tids[i]);
+	}
+
+	// snapshots taken while the threads record must not block or break them
+	std::ostringstream snapshots;
+	while (finished.load() < num_threads)
+		metrics->write_json(snapshots);
+
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(threads[i], 0);
+
+	std::ostringstream last;
+	metrics->write_json(last);
+	printf("%s", last.str().c_str());
+
+	// every thread recorded the same uniform 1..num_values
+	std::ostringstream expected;
+	expected << "\"stage\":{\"threads\":" << num_threads << ",\"items\":" << (unsigned long long)num_values * num_threads;
+	assert(last.str().find(expected.str()) != std::string::npos);
+
+	Histogram* total = new Histogram;
+	for (int i = 0; i < num_threads; i++)
+		total->merge(registered[i]->queue_wait);
+	assert(total->get_count() == (unsigned long long)num_values * num_threads);
+
+	unsigned long long p50 = total->percentile(0.5);
+	unsigned long long p99 = total->percentile(0.99);
+	assert(p50 >= (unsigned long long)num_values / 2 && p50 <= num_values / 2 + num_values / 2 / METRICS_SUB_BUCKETS + 1);
+	assert(p99 >= (unsigned long long)num_values * 99 / 100 && p99 <= (unsigned long long)num_values);
+	assert(total->get_min() == 1 && total->get_max() == (unsigned long long)num_values);
+
+	return 0;
+}
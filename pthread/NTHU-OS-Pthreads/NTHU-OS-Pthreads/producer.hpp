@@ -3,50 +3,100 @@
 #include "ts_queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "item_batch.hpp"
+#include "metrics.hpp"
 
 #ifndef PRODUCER_HPP
 #define PRODUCER_HPP
 
 class Producer : public Thread {
 public:
-	// constructor
-	Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transfomrer);
+	// constructor, with metrics the thread records under the "producer" stage
+	Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transfomrer,
+		Metrics* metrics = nullptr);
 
 	// destructor
 	~Producer();
 
 	virtual void start();
+
+	// send items to the worker queue shard their key hashes to instead of
+	// spreading whole batches over the shards, call before start
+	void set_shard_by_key(bool by_key);
 private:
 	TSQueue<Item*>* input_queue;
 	TSQueue<Item*>* worker_queue;
 
 	Transformer* transformer;
 
+	Metrics* metrics;
+
+	bool shard_by_key;
+
+	// pass a transformed batch on to the worker queue
+	void hand_over(Item** items, int n);
+
 	// the method for pthread to create a producer thread
 	static void* process(void* arg);
 };
 
-Producer::Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transformer)
-	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer) {
+Producer::Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transformer,
+	Metrics* metrics)
+	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer), metrics(metrics), shard_by_key(false) {
+	// the worker queue ends once every producer is done with it
+	worker_queue->attach_source();
 }
 
 Producer::~Producer() {}
 
 void Producer::start() {
 	// TODO: starts a Producer thread
-	pthread_create(&t, 0, Producer::process, (void*)this);
+	create(Producer::process, (void*)this);
+}
+
+void Producer::set_shard_by_key(bool by_key) {
+	shard_by_key = by_key;
+}
+
+void Producer::hand_over(Item** items, int n) {
+	if (shard_by_key)
+		enqueue_by_key(worker_queue, items, n);
+	else
+		worker_queue->enqueue_bulk(items, n);
 }
 
 void* Producer::process(void* arg) {
 	// TODO: implements the Producer's work
 	Producer* producer = (Producer*) arg;
 
+	Item* items[DEFAULT_BATCH_SIZE];
+
+	StageMetrics* stats = producer->metrics ? producer->metrics->register_stage("producer") : nullptr;
+
 	while(1){
-		Item *item = new Item;
-		item = producer->input_queue->dequeue();
-		item->val = producer->transformer->producer_transform(item->opcode, item->val);
-		producer->worker_queue->enqueue(item);
+		int n = producer->input_queue->dequeue_bulk(items, DEFAULT_BATCH_SIZE, -1);
+		// the reader is done and the input queue drained
+		if (n == 0)
+			break;
+
+		if (!stats) {
+			transform_items(producer->transformer, PRODUCER_STAGE, items, n);
+			producer->hand_over(items, n);
+			continue;
+		}
+
+		unsigned long long begin = monotonic_ns();
+		stats->record_taken(items, n, begin);
+		transform_items(producer->transformer, PRODUCER_STAGE, items, n);
+		unsigned long long end = monotonic_ns();
+		stats->record_transform(n, end - begin);
+		StageMetrics::stamp_queued(items, n, end);
+		producer->hand_over(items, n);
 	}
+
+	producer->worker_queue->detach_source();
+
+	return nullptr;
 }
 
 #endif // PRODUCER_HPP
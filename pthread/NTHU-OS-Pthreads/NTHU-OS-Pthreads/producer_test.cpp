@@ -28,13 +28,22 @@ int main() {
 	p3->start();
 	p4->start();
 
+	// the stages exit once the reader has closed the first queue and
+	// everything has made it through
 	reader->join();
+	p1->join();
+	p2->join();
+	p3->join();
+	p4->join();
 	writer->join();
 
+	delete p4;
+	delete p3;
 	delete p2;
 	delete p1;
 	delete writer;
 	delete reader;
+	delete transformer;
 	delete q2;
 	delete q1;
 
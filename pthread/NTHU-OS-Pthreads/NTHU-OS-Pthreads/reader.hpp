@@ -1,15 +1,31 @@
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
 #include "thread.hpp"
 #include "ts_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_buffer.hpp"
+#include "metrics.hpp"
 
 #ifndef READER_HPP
 #define READER_HPP
 
+// the size of the item pool a reader creates when it is not given one
+#define READER_DEFAULT_POOL_SIZE 4096
+
 class Reader : public Thread {
 public:
-	// constructor
-	Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue);
+	// constructor, items are taken from pool, which the reader thread
+	// owns from start() on; without one the reader creates its own.
+	// With a reorder buffer every key is admitted before it is queued.
+	// With metrics items are stamped for the later stages' latencies.
+	Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue, ItemPool* pool = nullptr,
+		ReorderBuffer* reorder = nullptr, Metrics* metrics = nullptr);
 
 	// destructor
 	~Reader();
@@ -20,38 +36,143 @@ private:
 	// the reader thread finished after input expected lines of item
 	int expected_lines;
 
-	std::ifstream ifs;
+	// the whole input file, mapped if possible and read into memory if not
+	const char* data;
+	size_t length;
+	bool mapped;
+
 	TSQueue<Item*>* input_queue;
 
+	ItemPool* pool;
+	bool owns_pool;
+
+	ReorderBuffer* reorder;
+
+	Metrics* metrics;
+	StageMetrics* stats;
+
+	// hand n parsed items to the input queue
+	void queue_items(Item** items, int n);
+
 	// the method for pthread to create a reader thread
 	static void* process(void* arg);
 };
 
 // Implementaion start
 
-Reader::Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue)
-	: expected_lines(expected_lines), input_queue(input_queue) {
-	ifs = std::ifstream(input_file);
+Reader::Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue, ItemPool* pool,
+	ReorderBuffer* reorder, Metrics* metrics)
+	: expected_lines(expected_lines), data(nullptr), length(0), mapped(false), input_queue(input_queue),
+	  pool(pool), owns_pool(pool == nullptr), reorder(reorder), metrics(metrics), stats(nullptr) {
+	// the input queue ends once the reader is done with it
+	input_queue->attach_source();
+
+	if (owns_pool)
+		this->pool = new ItemPool(READER_DEFAULT_POOL_SIZE);
+
+	int fd = open(input_file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(input_file.c_str());
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+			data = (const char*)addr;
+			length = st.st_size;
+			mapped = true;
+		}
+	}
+
+	// not mappable, e.g. a pipe, so read it all instead
+	if (!mapped) {
+		size_t capacity = 1 << 16;
+		char* buffer = (char*)malloc(capacity);
+		ssize_t n;
+		while ((n = read(fd, buffer + length, capacity - length)) > 0) {
+			length += n;
+			if (length == capacity)
+				buffer = (char*)realloc(buffer, capacity *= 2);
+		}
+		data = buffer;
+	}
+
+	close(fd);
 }
 
 Reader::~Reader() {
-	ifs.close();
+	if (owns_pool)
+		delete pool;
+	if (mapped)
+		munmap((void*)data, length);
+	else
+		free((void*)data);
 }
 
 void Reader::start() {
-	pthread_create(&t, 0, Reader::process, (void*)this);
+	create(Reader::process, (void*)this);
 }
 
 void* Reader::process(void* arg) {
 	Reader* reader = (Reader*)arg;
 
-	while (reader->expected_lines--) {
-		Item *item = new Item;
-		reader->ifs >> *item;
-		reader->input_queue->enqueue(item);
+	const char* p = reader->data;
+	const char* end = reader->data + reader->length;
+
+	Item* items[DEFAULT_BATCH_SIZE];
+
+	if (reader->metrics)
+		reader->stats = reader->metrics->register_stage("reader");
+
+	while (reader->expected_lines > 0) {
+		int max = reader->expected_lines < DEFAULT_BATCH_SIZE ? reader->expected_lines : DEFAULT_BATCH_SIZE;
+		int n = 0;
+
+		bool ended = false;
+
+		while (n < max) {
+			Item* item = reader->pool->acquire();
+			if (!Item::parse(p, end, *item)) {
+				ItemPool::release(item);
+				ended = true;
+				break;
+			}
+
+			if (reader->reorder && !reader->reorder->try_admit(item->key)) {
+				// the key the writer waits for may be in this batch, so
+				// hand the batch over before blocking
+				if (n > 0)
+					reader->queue_items(items, n);
+				reader->expected_lines -= n;
+				max -= n;
+				n = 0;
+				reader->reorder->admit(item->key);
+			}
+			items[n++] = item;
+		}
+
+		if (n > 0)
+			reader->queue_items(items, n);
+		reader->expected_lines -= n;
+
+		if (ended) {
+			fprintf(stderr, "reader: input ended with %d lines still expected\n", reader->expected_lines);
+			break;
+		}
 	}
 
+	reader->input_queue->detach_source();
+
 	return nullptr;
 }
 
+void Reader::queue_items(Item** items, int n) {
+	if (stats)
+		stats->record_read(items, n, monotonic_ns());
+	input_queue->enqueue_bulk(items, n);
+}
+
 #endif // READER_HPP
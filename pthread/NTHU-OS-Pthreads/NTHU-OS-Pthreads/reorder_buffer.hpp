@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <atomic>
+#include "item.hpp"
+
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#define DEFAULT_REORDER_WINDOW 4096
+
+// A sliding window over Item::key that puts items back in key order.
+// Keys are expected to ascend from first_key, as auto_gen_input writes
+// them. The one thread that brings items into the pipeline admits each
+// key first and blocks while it lies a whole window past the next key to
+// emit, so at most window items are ever held and every admitted key has
+// a free slot. Everything except admitting belongs to the one thread
+// that emits, the writer.
+//
+// Keys need not be dense. Once every item admitted so far has reached
+// the emitting thread, a missing key can no longer arrive, so the blocked
+// key is let in past the window; the emitting thread sees it is_past,
+// drains what it holds in key order and skips the window ahead to it.
+// A key that arrives after the window has moved past it is not held and
+// has to be emitted as it is.
+class ReorderBuffer {
+public:
+	// constructor
+	explicit ReorderBuffer(int window = DEFAULT_REORDER_WINDOW, int first_key = 1);
+
+	// destructor
+	~ReorderBuffer();
+
+	// admit key if it fits the window, false if that would need to block
+	bool try_admit(int key);
+
+	// block until key fits the window, or until nothing admitted before it
+	// is still on the way to the emitting thread
+	void admit(int key);
+
+	// emitting thread only: whether item was let in past the window, so
+	// that everything held has to be drained and the window skipped to it
+	// before it is inserted
+	bool is_past(Item* item);
+
+	// emitting thread only: move the now empty window to start at key
+	void skip_to(long key);
+
+	// emitting thread only: count item as arrived and hold it until its
+	// turn, false if its key is behind the window or taken and the item
+	// has to be emitted as it is
+	bool insert(Item* item);
+
+	// emitting thread only: take up to max items continuing the keys
+	// emitted so far; return how many were taken
+	int take_run(Item** items, int max);
+
+	// emitting thread only: take up to max held items in key order,
+	// skipping over keys that never arrived
+	int drain(Item** items, int max);
+
+	// emitting thread only: return the number of items held
+	int get_held();
+
+	int get_window();
+
+private:
+	// move the window to start at key and wake an admitter waiting on it
+	void advance(long key);
+
+	// whether key fits the window
+	bool fits(int key);
+
+	int window;
+	long first_key;
+	Item** slots;
+	int held;
+
+	// the next key to emit, keys below next_key + window are admitted
+	std::atomic<long> next_key;
+
+	// how many keys were admitted, and how many items the emitting thread
+	// got; once they are equal nothing is on the way
+	std::atomic<long> admitted;
+	std::atomic<long> arrived;
+
+	// whether an admitter is blocked, so advance only signals when needed
+	std::atomic<bool> waiting;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_admit;
+};
+
+// Implementation start
+
+ReorderBuffer::ReorderBuffer(int window, int first_key)
+	: window(window > 0 ? window : 1), first_key(first_key), held(0) {
+	slots = new Item*[this->window];
+	for (int i = 0; i < this->window; i++)
+		slots[i] = nullptr;
+
+	next_key.store(first_key);
+	admitted.store(0);
+	arrived.store(0);
+	waiting.store(false);
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_admit, nullptr);
+}
+
+ReorderBuffer::~ReorderBuffer() {
+	delete[] slots;
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_admit);
+}
+
+bool ReorderBuffer::fits(int key) {
+	return key < next_key.load() + window;
+}
+
+bool ReorderBuffer::try_admit(int key) {
+	if (!fits(key))
+		return false;
+	admitted.store(admitted.load(std::memory_order_relaxed) + 1);
+	return true;
+}
+
+void ReorderBuffer::admit(int key) {
+	if (try_admit(key))
+		return;
+
+	pthread_mutex_lock(&mutex);
+	// seq_cst against advance and insert: either they see waiting or we
+	// see their key or arrival
+	waiting.store(true);
+	while (!fits(key) && arrived.load() != admitted.load())
+		pthread_cond_wait(&cond_admit, &mutex);
+	waiting.store(false);
+	pthread_mutex_unlock(&mutex);
+
+	admitted.store(admitted.load(std::memory_order_relaxed) + 1);
+}
+
+bool ReorderBuffer::is_past(Item* item) {
+	return item->key >= next_key.load(std::memory_order_relaxed) + window;
+}
+
+void ReorderBuffer::skip_to(long key) {
+	if (key > next_key.load(std::memory_order_relaxed))
+		advance(key);
+}
+
+bool ReorderBuffer::insert(Item* item) {
+	long count = arrived.load(std::memory_order_relaxed) + 1;
+	arrived.store(count);
+	// the admitter may be blocked on a key nothing admitted can lead to
+	if (waiting.load() && count == admitted.load()) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond_admit);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	long next = next_key.load(std::memory_order_relaxed);
+	if (item->key < next || item->key >= next + window)
+		return false;
+
+	Item*& slot = slots[(item->key - first_key) % window];
+	if (slot)
+		return false;
+
+	slot = item;
+	held++;
+	return true;
+}
+
+int ReorderBuffer::take_run(Item** items, int max) {
+	long key = next_key.load(std::memory_order_relaxed);
+	int n = 0;
+
+	while (n < max) {
+		Item*& slot = slots[(key - first_key) % window];
+		if (!slot)
+			break;
+		items[n++] = slot;
+		slot = nullptr;
+		key++;
+	}
+
+	if (n > 0) {
+		held -= n;
+		advance(key);
+	}
+	return n;
+}
+
+int ReorderBuffer::drain(Item** items, int max) {
+	long key = next_key.load(std::memory_order_relaxed);
+	long end = key + window;
+	int n = 0;
+
+	for (; key < end && n < max && held > 0; key++) {
+		Item*& slot = slots[(key - first_key) % window];
+		if (!slot)
+			continue;
+		items[n++] = slot;
+		slot = nullptr;
+		held--;
+	}
+
+	if (n > 0)
+		advance(key);
+	return n;
+}
+
+int ReorderBuffer::get_held() {
+	return held;
+}
+
+int ReorderBuffer::get_window() {
+	return window;
+}
+
+void ReorderBuffer::advance(long key) {
+	next_key.store(key);
+	if (waiting.load()) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond_admit);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+#endif // REORDER_BUFFER_HPP
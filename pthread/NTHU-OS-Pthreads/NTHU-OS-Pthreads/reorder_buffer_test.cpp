@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include "ts_queue.hpp"
+#include "reorder_buffer.hpp"
+
+/* Global shared variables */
+ReorderBuffer* reorder;
+TSQueue<Item*>* in_q;
+TSQueue<Item*>* out_q;
+int num_items;
+// keys run 1, 1 + stride, 1 + 2 * stride, ...; with stride > 1 the
+// writer never sees the keys in between
+int stride;
+int written, out_of_order;
+
+// admit keys in order like the reader, handing the batch over before blocking
+void* admit(void* arg) {
+	Item* items[DEFAULT_BATCH_SIZE];
+	int n = 0;
+
+	for (int i = 0; i < num_items; i++) {
+		int key = 1 + i * stride;
+		Item* item = new Item(key, key, 'A');
+		if (!reorder->try_admit(key)) {
+			in_q->enqueue_bulk(items, n);
+			n = 0;
+			reorder->admit(key);
+		}
+		items[n++] = item;
+		if (n == DEFAULT_BATCH_SIZE) {
+			in_q->enqueue_bulk(items, n);
+			n = 0;
+		}
+	}
+	in_q->enqueue_bulk(items, n);
+	in_q->detach_source();
+
+	return nullptr;
+}
+
+// pass batches on in a scrambled order, like consumers finishing at random
+void* shuffle(void* arg) {
+	unsigned int seed = (unsigned int)(long)arg;
+	Item* items[DEFAULT_BATCH_SIZE];
+
+	while (true) {
+		int n = in_q->dequeue_bulk(items, DEFAULT_BATCH_SIZE, -1);
+		if (n == 0)
+			break;
+		for (int i = n - 1; i > 0; i--) {
+			int j = rand_r(&seed) % (i + 1);
+			Item* tmp = items[i];
+			items[i] = items[j];
+			items[j] = tmp;
+		}
+		if (rand_r(&seed) % 8 == 0)
+			usleep(100);
+		out_q->enqueue_bulk(items, n);
+	}
+	out_q->detach_source();
+
+	return nullptr;
+}
+
+// write items, checking they continue the keys written so far
+void emit(Item** items, int n) {
+	for (int i = 0; i < n; i++) {
+		if (items[i]->key != 1 + written * stride)
+			out_of_order++;
+		written++;
+		delete items[i];
+	}
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 4 || argc == 5);
+
+	num_items = atoi(argv[1]);
+	int window = atoi(argv[2]);
+	int num_shufflers = atoi(argv[3]);
+	stride = argc == 5 ? atoi(argv[4]) : 1;
+
+	reorder = new ReorderBuffer(window);
+	in_q = new TSQueue<Item*>;
+	out_q = new TSQueue<Item*>;
+	in_q->attach_source();
+	for (int i = 0; i < num_shufflers; i++)
+		out_q->attach_source();
+
+	pthread_t admitter;
+	pthread_create(&admitter, 0, admit, nullptr);
+	pthread_t* shufflers = new pthread_t[num_shufflers];
+	for (int i = 0; i < num_shufflers; i++)
+		pthread_create(&shufflers[i], 0, shuffle, (void*)(long)(i + 1));
+
+	// the emitting side, like the writer
+	Item* items[DEFAULT_BATCH_SIZE];
+	Item* held[DEFAULT_BATCH_SIZE];
+	int direct = 0, max_held = 0, skips = 0;
+	int incoming = num_items;
+
+	while (incoming > 0) {
+		int n = out_q->dequeue_bulk(items, DEFAULT_BATCH_SIZE, -1);
+		incoming -= n;
+		for (int i = 0; i < n; i++) {
+			if (reorder->is_past(items[i])) {
+				int m;
+				while ((m = reorder->drain(held, DEFAULT_BATCH_SIZE)) > 0)
+					emit(held, m);
+				reorder->skip_to(items[i]->key);
+				skips++;
+			}
+			if (!reorder->insert(items[i]))
+				direct++;
+		}
+		if (reorder->get_held() > max_held)
+			max_held = reorder->get_held();
+
+		while ((n = reorder->take_run(items, DEFAULT_BATCH_SIZE)) > 0)
+			emit(items, n);
+	}
+
+	// the keys after the last skip wait on a gap that is never filled
+	int n;
+	while ((n = reorder->drain(held, DEFAULT_BATCH_SIZE)) > 0)
+		emit(held, n);
+
+	pthread_join(admitter, 0);
+	for (int i = 0; i < num_shufflers; i++)
+		pthread_join(shufflers[i], 0);
+	delete[] shufflers;
+	delete in_q;
+	delete out_q;
+	delete reorder;
+
+	printf("items: %d, written: %d, out of order: %d, not held: %d, max held: %d of %d, skips: %d\n",
+		num_items, written, out_of_order, direct, max_held, window, skips);
+
+	return out_of_order || direct || written != num_items || max_held > window || (stride == 1 && skips);
+}
@@ -3,60 +3,155 @@
 import click
 import json
 
-def generate_case(opcode, annotation, case_spec):
+def generate_spec(opcode, annotation, case_spec):
+	template = f'''
+	// {opcode}: {annotation}
+	{{ {case_spec['a']}, {case_spec['b']}, {case_spec['m']}, {case_spec['iterations']} }},'''
+
+	return template
+
+def generate_index(index, opcode):
 	template = f'''
-	// {annotation}
 	case '{opcode}':
-		spec->a = {case_spec['a']};
-		spec->b = {case_spec['b']};
-		spec->m = {case_spec['m']};
-		spec->iterations = {case_spec['iterations']};
-		break;
-'''
-	
+		return {index};'''
+
 	return template
 
 def generate_cpp(spec):
+	opcodes = ''.join(spec['annotation'])
+
 	producer_spec = ''
 	for opcode in spec['annotation']:
-		producer_spec += generate_case(opcode, spec['annotation'][opcode], spec['producer'][opcode])
+		producer_spec += generate_spec(opcode, spec['annotation'][opcode], spec['producer'][opcode])
 
 	consumer_spec = ''
 	for opcode in spec['annotation']:
-		consumer_spec += generate_case(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
+		consumer_spec += generate_spec(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
+
+	index = ''
+	for i, opcode in enumerate(spec['annotation']):
+		index += generate_index(i, opcode)
 
 	template = f'''// CODEGEN BY auto_gen_transformer.py; DO NOT EDIT.
 
 #include <assert.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+#define NUM_OPCODES {len(opcodes)}
+
+const char Transformer::opcodes[] = "{opcodes}";
+
+static constexpr TransformSpec producer_specs[NUM_OPCODES] = {{{producer_spec}
+}};
+
+static constexpr TransformSpec consumer_specs[NUM_OPCODES] = {{{consumer_spec}
+}};
+
+static int opcode_index(char opcode) {{
+	switch (opcode) {{{index}
 
-	switch (opcode) {{{producer_spec}
 	default:
 		assert(false);
+		return -1;
 	}}
+}}
 
-	return transform(spec, val);
+Transformer::Transformer(bool verify) : verify(verify) {{
+	kernel = affine_select_kernel();
+
+	producer_engines = new Engine[NUM_OPCODES];
+	consumer_engines = new Engine[NUM_OPCODES];
+
+	for (int i = 0; i < NUM_OPCODES; i++) {{
+		producer_engines[i] = prepare(producer_specs[i]);
+		consumer_engines[i] = prepare(consumer_specs[i]);
+	}}
+}}
+
+Transformer::~Transformer() {{
+	delete[] producer_engines;
+	delete[] consumer_engines;
+}}
+
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
+	int i = opcode_index(opcode);
+	return transform(producer_specs[i], producer_engines[i], val);
 }}
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+	int i = opcode_index(opcode);
+	return transform(consumer_specs[i], consumer_engines[i], val);
+}}
 
-	switch (opcode) {{{consumer_spec}
-	default:
-		assert(false);
+void Transformer::producer_transform_batch(char opcode, unsigned long long* vals, int n) {{
+	int i = opcode_index(opcode);
+	transform_batch(producer_specs[i], producer_engines[i], vals, n);
+}}
+
+void Transformer::consumer_transform_batch(char opcode, unsigned long long* vals, int n) {{
+	int i = opcode_index(opcode);
+	transform_batch(consumer_specs[i], consumer_engines[i], vals, n);
+}}
+
+Transformer::Engine Transformer::prepare(const TransformSpec& spec) {{
+	Engine engine;
+	AffineMap step = {{ spec.a % spec.m, spec.b % spec.m, spec.m }};
+
+	engine.rest = affine_power(step, spec.iterations > 1 ? spec.iterations - 1 : 0);
+
+	// after the first step val < m, so the loop can only wrap if
+	// (m - 1) * a + b does not fit in 64 bits
+	unsigned __int128 largest = (unsigned __int128)(spec.m - 1) * spec.a + spec.b;
+	engine.closed_form = largest >> 64 == 0;
+
+	return engine;
+}}
+
+unsigned long long Transformer::transform(const TransformSpec& spec, const Engine& engine, unsigned long long val) {{
+	if (spec.iterations <= 0)
+		return val;
+
+	if (!engine.closed_form)
+		return iterate(spec, val);
+
+	unsigned long long result = affine_apply(engine.rest, (val * spec.a + spec.b) % spec.m);
+
+	if (verify)
+		assert(result == iterate(spec, val));
+
+	return result;
+}}
+
+void Transformer::transform_batch(const TransformSpec& spec, const Engine& engine, unsigned long long* vals, int n) {{
+	if (!engine.closed_form || spec.iterations <= 0) {{
+		kernel(spec.a, spec.b, spec.m, spec.iterations, vals, n);
+		return;
+	}}
+
+	unsigned long long* expected = nullptr;
+	if (verify) {{
+		expected = new unsigned long long[n];
+		for (int i = 0; i < n; i++)
+			expected[i] = vals[i];
+		kernel(spec.a, spec.b, spec.m, spec.iterations, expected, n);
 	}}
 
-	return transform(spec, val);
+	for (int i = 0; i < n; i++)
+		vals[i] = affine_apply(engine.rest, (vals[i] * spec.a + spec.b) % spec.m);
+
+	if (verify) {{
+		for (int i = 0; i < n; i++)
+			assert(vals[i] == expected[i]);
+		delete[] expected;
+	}}
 }}
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {{
-	while (spec->iterations--) {{
-		val = (val * spec->a + spec->b) % spec->m;
+unsigned long long Transformer::iterate(const TransformSpec& spec, unsigned long long val) {{
+	int iterations = spec.iterations;
+	while (iterations--) {{
+		val = (val * spec.a + spec.b) % spec.m;
 	}}
-  return val;
+	return val;
 }}
 '''
 
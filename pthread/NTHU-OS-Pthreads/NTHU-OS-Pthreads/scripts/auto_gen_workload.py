@@ -0,0 +1,42 @@
+import click
+import random
+
+def opcode_weights(opcodes, mix, skew):
+	# explicit weights first, then a Zipf-like tilt towards the first opcodes
+	weights = [1.0] * len(opcodes)
+	if mix:
+		weights = [float(w) for w in mix.split(',')]
+		if len(weights) != len(opcodes):
+			raise click.BadParameter(f'{len(opcodes)} weights expected for opcodes {opcodes}', param_hint='--mix')
+	return [w / (rank + 1) ** skew for rank, w in enumerate(weights)]
+
+def generate_workload(f, n, opcodes, weights, burstiness, low, high, rng):
+	# With burstiness b an item repeats the previous opcode with probability
+	# b, so runs of one opcode last 1 / (1 - b) items on average and the
+	# transform cost of a batch swings with them.
+	opcode = None
+	for i in range(n):
+		if opcode is None or rng.random() >= burstiness:
+			opcode = rng.choices(opcodes, weights)[0]
+		print(i + 1, rng.randint(low, high), opcode, file=f)
+
+@click.command()
+@click.option('--n', default=100000, help='Number of items.')
+@click.option('--output', default='./tests/bench.in', help='Output file path.')
+@click.option('--opcodes', default='ABC', help='Opcodes to draw from, must be compiled into transformer.cpp.')
+@click.option('--mix', default='', help='Comma-separated weight per opcode, equal if empty.')
+@click.option('--skew', default=0.0, help='Zipf exponent tilting the mix towards the first opcodes.')
+@click.option('--burstiness', default=0.0, help='Probability in [0, 1) that an item repeats the previous opcode.')
+@click.option('--low', default=0, help='Smallest value.')
+@click.option('--high', default=1000000000, help='Largest value.')
+@click.option('--seed', default=0, help='Random seed, the same seed gives the same workload.')
+def generate(n, output, opcodes, mix, skew, burstiness, low, high, seed):
+	if not 0 <= burstiness < 1:
+		raise click.BadParameter('must be in [0, 1)', param_hint='--burstiness')
+
+	weights = opcode_weights(opcodes, mix, skew)
+	with open(output, 'w') as f:
+		generate_workload(f, n, opcodes, weights, burstiness, low, high, random.Random(seed))
+
+if __name__ == '__main__':
+	generate()
@@ -0,0 +1,134 @@
+import click
+import json
+import os
+import random
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+from auto_gen_workload import generate_workload, opcode_weights
+
+# Runs ./main over one generated workload for every combination of queue
+# size, producer count, consumer count and worker queue shards, and prints
+# one JSON object per run: throughput, writer end-to-end latency
+# percentiles from PIPELINE_METRICS and the CPU the run used.
+
+def int_list(value):
+	return [int(v) for v in value.split(',') if v]
+
+def run_pipeline(main, n, input_path, output_path, queue_size, producers, consumers, shards):
+	metrics_path = output_path + '.metrics'
+	if os.path.exists(metrics_path):
+		os.remove(metrics_path)
+
+	env = dict(os.environ)
+	env['PIPELINE_QUEUE_SIZE'] = str(queue_size)
+	env['PIPELINE_PRODUCERS'] = str(producers)
+	env['PIPELINE_CONSUMERS'] = str(consumers)
+	env['PIPELINE_WORKER_SHARDS'] = str(shards)
+	env['PIPELINE_METRICS'] = metrics_path
+
+	before = resource.getrusage(resource.RUSAGE_CHILDREN)
+	start = time.monotonic()
+	subprocess.run([main, str(n), input_path, output_path], env=env, stdout=subprocess.DEVNULL, check=True)
+	wall = time.monotonic() - start
+	after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+	cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime - before.ru_stime)
+
+	with open(output_path) as f:
+		lines = sum(1 for _ in f)
+	with open(metrics_path) as f:
+		snapshot = json.loads(f.readlines()[-1])
+	os.remove(metrics_path)
+
+	latency = snapshot['stages'].get('writer', {}).get('end_to_end_ns', {})
+
+	return {
+		'queue_size': queue_size,
+		'producers': producers,
+		'consumers': consumers,
+		'shards': shards,
+		'n': n,
+		'complete': lines == n,
+		'wall_s': wall,
+		'items_per_sec': n / wall,
+		'p50_ns': latency.get('p50', 0),
+		'p99_ns': latency.get('p99', 0),
+		'cpu_s': cpu,
+		# share of all online cores the run kept busy
+		'cpu_utilization': cpu / wall / os.cpu_count(),
+	}
+
+def key_of(result):
+	return (result['queue_size'], result['producers'], result['consumers'], result.get('shards', 0))
+
+def regressions(results, baseline_path, tolerance):
+	with open(baseline_path) as f:
+		baseline = {key_of(r): r for r in map(json.loads, f) if 'items_per_sec' in r}
+
+	slower = []
+	for r in results:
+		base = baseline.get(key_of(r))
+		if base and r['items_per_sec'] < base['items_per_sec'] * (1 - tolerance):
+			slower.append((r, base))
+	return slower
+
+@click.command()
+@click.option('--main', default='./main', help='Pipeline binary.')
+@click.option('--n', default=100000, help='Number of items per run.')
+@click.option('--queue-sizes', default='50,200,1000', help='Comma-separated reader and worker queue sizes.')
+@click.option('--producers', default='1,2,4', help='Comma-separated producer thread counts.')
+@click.option('--consumers', default='0', help='Comma-separated consumer limits, 0 is one per core.')
+@click.option('--shards', default='0', help='Comma-separated worker queue shard counts, 0 lets main decide.')
+@click.option('--opcodes', default='ABC', help='Opcodes to draw from, must be compiled into transformer.cpp.')
+@click.option('--mix', default='', help='Comma-separated weight per opcode, equal if empty.')
+@click.option('--skew', default=0.0, help='Zipf exponent tilting the mix towards the first opcodes.')
+@click.option('--burstiness', default=0.0, help='Probability in [0, 1) that an item repeats the previous opcode.')
+@click.option('--seed', default=0, help='Random seed of the workload.')
+@click.option('--repeat', default=1, help='Runs per configuration, the fastest is reported.')
+@click.option('--output', default='-', help='Where to write the JSON lines, - for stdout.')
+@click.option('--baseline', default='', help='Earlier output to compare items/sec against.')
+@click.option('--tolerance', default=0.1, help='Fraction of baseline throughput a run may lose before it fails.')
+def bench(main, n, queue_sizes, producers, consumers, shards, opcodes, mix, skew, burstiness, seed, repeat, output,
+	baseline, tolerance):
+	workload = {'n': n, 'opcodes': opcodes, 'mix': mix, 'skew': skew, 'burstiness': burstiness, 'seed': seed}
+
+	results = []
+	with tempfile.TemporaryDirectory() as tmp:
+		input_path = os.path.join(tmp, 'bench.in')
+		output_path = os.path.join(tmp, 'bench.out')
+
+		with open(input_path, 'w') as f:
+			weights = opcode_weights(opcodes, mix, skew)
+			generate_workload(f, n, opcodes, weights, burstiness, 0, 1000000000, random.Random(seed))
+
+		out = sys.stdout if output == '-' else open(output, 'w')
+		for queue_size in int_list(queue_sizes):
+			for p in int_list(producers):
+				for c in int_list(consumers):
+					for s in int_list(shards):
+						runs = [run_pipeline(main, n, input_path, output_path, queue_size, p, c, s)
+							for _ in range(repeat)]
+						result = max(runs, key=lambda r: r['items_per_sec'])
+						result['workload'] = workload
+						results.append(result)
+						print(json.dumps(result), file=out, flush=True)
+		if out is not sys.stdout:
+			out.close()
+
+	failed = [r for r in results if not r['complete']]
+	for r in failed:
+		print(f'incomplete output: {key_of(r)}', file=sys.stderr)
+
+	slower = regressions(results, baseline, tolerance) if baseline else []
+	for r, base in slower:
+		print(f'regression: {key_of(r)} {r["items_per_sec"]:.0f} items/s, baseline {base["items_per_sec"]:.0f}',
+			file=sys.stderr)
+
+	sys.exit(1 if failed or slower else 0)
+
+if __name__ == '__main__':
+	bench()
@@ -1,10 +1,13 @@
 #include <pthread.h>
+#include <sched.h>
 
 #ifndef THREAD_HPP
 #define THREAD_HPP
 
 class Thread {
 public:
+	Thread();
+
 	// to start a new pthread work
 	virtual void start() = 0;
 
@@ -13,10 +16,23 @@ public:
 
 	// to cancel the pthread work
 	virtual int cancel();
+
+	// to run the pthread work on cpus only, set before start
+	void set_affinity(const cpu_set_t& cpus);
 protected:
+	// to create the pthread running routine(arg) with the affinity set so far
+	int create(void* (*routine)(void*), void* arg);
+
 	pthread_t t;
+
+	bool pinned;
+	cpu_set_t affinity;
 };
 
+Thread::Thread() : pinned(false) {
+	CPU_ZERO(&affinity);
+}
+
 int Thread::join() {
 	return pthread_join(t, 0);
 }
@@ -25,4 +41,22 @@ int Thread::cancel() {
 	return pthread_cancel(t);
 }
 
+void Thread::set_affinity(const cpu_set_t& cpus) {
+	affinity = cpus;
+	pinned = CPU_COUNT(&cpus) > 0;
+}
+
+int Thread::create(void* (*routine)(void*), void* arg) {
+	if (!pinned)
+		return pthread_create(&t, 0, routine, arg);
+
+	// the thread starts on its cpus instead of migrating there afterwards
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(affinity), &affinity);
+	int err = pthread_create(&t, &attr, routine, arg);
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
 #endif // THREAD_HPP
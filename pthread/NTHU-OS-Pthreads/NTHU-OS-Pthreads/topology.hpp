@@ -0,0 +1,282 @@
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <string>
+#include <vector>
+
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+// from <numaif.h>, which comes with libnuma rather than libc
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+// The online cpus as sysfs describes them: grouped into domains of cpus
+// sharing an L3 cache (or a package, where the caches are not listed),
+// and mapped to their NUMA nodes. Without sysfs every cpu sysconf reports
+// is in one domain on node 0.
+class Topology {
+public:
+	// constructor, reads sysfs
+	Topology();
+
+	// return the domains, each a sorted list of cpus, in order of their
+	// lowest cpu
+	const std::vector<std::vector<int> >& get_domains();
+
+	// return the NUMA node of cpu
+	int node_of(int cpu);
+
+	// return the number of NUMA nodes with cpus
+	int get_num_nodes();
+
+	// parse a sysfs cpu list such as "0-3,8,10-11" into cpus
+	static bool parse_cpu_list(const std::string& list, std::vector<int>& cpus);
+
+private:
+	// read the first line of path into line
+	static bool read_line(const std::string& path, std::string& line);
+
+	// return the lowest cpu of the L3 or package cpu belongs to
+	static int domain_of(int cpu);
+
+	std::vector<std::vector<int> > domains;
+	// node of every cpu, indexed by cpu
+	std::vector<int> nodes;
+	int num_nodes;
+};
+
+// Where the pipeline threads run. The reader, producers and writer share
+// the largest L3 domain, the home domain, so the input and writer queues
+// stay in one cache. Consumer workers are pinned to single cpus, home
+// domain first, so the workers the controller activates first share that
+// cache as well; later ones spill to the domains on the home node and then
+// to the rest.
+class Placement {
+public:
+	explicit Placement(Topology* topology);
+
+	// set cpus to the home domain
+	void home_cpus(cpu_set_t& cpus);
+
+	// set cpus to the one cpu consumer worker id runs on
+	void consumer_cpus(int id, cpu_set_t& cpus);
+
+	// return the NUMA node of the home domain, where the queues the
+	// producers and the writer drain belong
+	int home_node();
+
+	// return the NUMA node of the cpu consumer worker id runs on
+	int consumer_node(int id);
+
+private:
+	Topology* topology;
+	int home;
+	// every cpu in the order consumer workers are pinned to them
+	std::vector<int> consumer_order;
+};
+
+// allocate length bytes on pages of their own, so that binding them to a
+// node moves nothing else; release with free
+static inline void* alloc_pages(size_t length);
+
+// prefer node for the pages at addr, from alloc_pages(length), moving the
+// ones already touched; a no-op where mbind is unavailable
+static inline void bind_to_node(void* addr, size_t length, int node);
+
+// Implementation start
+
+Topology::Topology() : num_nodes(1) {
+	std::string line;
+	std::vector<int> cpus;
+	if (!read_line(SYSFS_CPU "/online", line) || !parse_cpu_list(line, cpus) || cpus.empty()) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		cpus.clear();
+		for (int i = 0; i < (n > 0 ? n : 1); i++)
+			cpus.push_back(i);
+	}
+
+	// cpus come sorted, so a domain is created by its lowest cpu
+	std::vector<int> domain_ids;
+	for (size_t i = 0; i < cpus.size(); i++) {
+		int id = domain_of(cpus[i]);
+		size_t d = 0;
+		while (d < domain_ids.size() && domain_ids[d] != id)
+			d++;
+		if (d == domain_ids.size()) {
+			domain_ids.push_back(id);
+			domains.push_back(std::vector<int>());
+		}
+		domains[d].push_back(cpus[i]);
+	}
+
+	nodes.assign(cpus.back() + 1, 0);
+	DIR* dir = opendir(SYSFS_NODE);
+	if (!dir)
+		return;
+	num_nodes = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		int node;
+		char rest;
+		if (sscanf(entry->d_name, "node%d%c", &node, &rest) != 1)
+			continue;
+		std::vector<int> node_cpus;
+		if (!read_line(std::string(SYSFS_NODE "/") + entry->d_name + "/cpulist", line)
+			|| !parse_cpu_list(line, node_cpus) || node_cpus.empty())
+			continue;
+		num_nodes++;
+		for (size_t i = 0; i < node_cpus.size(); i++) {
+			if (node_cpus[i] < (int)nodes.size())
+				nodes[node_cpus[i]] = node;
+		}
+	}
+	closedir(dir);
+	if (num_nodes == 0)
+		num_nodes = 1;
+}
+
+const std::vector<std::vector<int> >& Topology::get_domains() {
+	return domains;
+}
+
+int Topology::node_of(int cpu) {
+	return cpu >= 0 && cpu < (int)nodes.size() ? nodes[cpu] : 0;
+}
+
+int Topology::get_num_nodes() {
+	return num_nodes;
+}
+
+bool Topology::parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+	const char* p = list.c_str();
+	while (*p && *p != '\n') {
+		char* end;
+		long from = strtol(p, &end, 10);
+		if (end == p || from < 0)
+			return false;
+		long to = from;
+		p = end;
+		if (*p == '-') {
+			to = strtol(p + 1, &end, 10);
+			if (end == p + 1 || to < from)
+				return false;
+			p = end;
+		}
+		for (long cpu = from; cpu <= to; cpu++)
+			cpus.push_back((int)cpu);
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return false;
+	}
+	return true;
+}
+
+bool Topology::read_line(const std::string& path, std::string& line) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+		return false;
+	char buffer[4096];
+	bool ok = fgets(buffer, sizeof(buffer), f) != nullptr;
+	fclose(f);
+	if (ok)
+		line = buffer;
+	return ok;
+}
+
+int Topology::domain_of(int cpu) {
+	char path[128];
+	std::string line;
+
+	for (int index = 0; ; index++) {
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, index);
+		if (!read_line(path, line))
+			break;
+		if (atoi(line.c_str()) != 3)
+			continue;
+
+		std::vector<int> shared;
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+		if (read_line(path, line) && parse_cpu_list(line, shared) && !shared.empty())
+			return shared[0];
+	}
+
+	// no L3 listed, the package is the next best thing; packages are
+	// numbered apart from cpus, so keep their ids out of the cpu range
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+	if (read_line(path, line))
+		return -1 - atoi(line.c_str());
+	return 0;
+}
+
+Placement::Placement(Topology* topology) : topology(topology), home(0) {
+	const std::vector<std::vector<int> >& domains = topology->get_domains();
+	for (size_t d = 1; d < domains.size(); d++) {
+		if (domains[d].size() > domains[home].size())
+			home = d;
+	}
+
+	int node = home_node();
+	consumer_order = domains[home];
+	for (int near = 1; near >= 0; near--) {
+		for (size_t d = 0; d < domains.size(); d++) {
+			if ((int)d == home || (topology->node_of(domains[d][0]) == node) != (bool)near)
+				continue;
+			consumer_order.insert(consumer_order.end(), domains[d].begin(), domains[d].end());
+		}
+	}
+}
+
+void Placement::home_cpus(cpu_set_t& cpus) {
+	const std::vector<int>& domain = topology->get_domains()[home];
+	CPU_ZERO(&cpus);
+	for (size_t i = 0; i < domain.size(); i++)
+		CPU_SET(domain[i], &cpus);
+}
+
+void Placement::consumer_cpus(int id, cpu_set_t& cpus) {
+	CPU_ZERO(&cpus);
+	CPU_SET(consumer_order[id % consumer_order.size()], &cpus);
+}
+
+int Placement::home_node() {
+	return topology->node_of(topology->get_domains()[home][0]);
+}
+
+int Placement::consumer_node(int id) {
+	return topology->node_of(consumer_order[id % consumer_order.size()]);
+}
+
+static inline void* alloc_pages(size_t length) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	void* addr;
+	if (posix_memalign(&addr, page, (length + page - 1) & ~(page - 1)) != 0)
+		return nullptr;
+	return addr;
+}
+
+static inline void bind_to_node(void* addr, size_t length, int node) {
+#ifdef SYS_mbind
+	if (node < 0 || node >= (int)(8 * sizeof(unsigned long)) || length == 0)
+		return;
+
+	// mbind takes whole pages, the rest of the last one is ours as well
+	size_t page = sysconf(_SC_PAGESIZE);
+	unsigned long mask = 1UL << node;
+	syscall(SYS_mbind, (unsigned long)addr, (length + page - 1) & ~(page - 1), MPOL_PREFERRED, &mask, 8 * sizeof(mask), MPOL_MF_MOVE);
+#endif
+}
+
+#endif // TOPOLOGY_HPP
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sched.h>
+#include "thread.hpp"
+#include "topology.hpp"
+
+// records the cpus it was allowed to run on
+class Probe : public Thread {
+public:
+	virtual void start() override {
+		create(Probe::process, (void*)this);
+	}
+
+	cpu_set_t seen;
+	int cpu;
+private:
+	static void* process(void* arg) {
+		Probe* probe = (Probe*)arg;
+		sched_getaffinity(0, sizeof(probe->seen), &probe->seen);
+		probe->cpu = sched_getcpu();
+		return nullptr;
+	}
+};
+
+int main() {
+	std::vector<int> cpus;
+	assert(Topology::parse_cpu_list("0-3,8,10-11\n", cpus));
+	int expected[] = { 0, 1, 2, 3, 8, 10, 11 };
+	assert(cpus.size() == sizeof(expected) / sizeof(expected[0]));
+	for (size_t i = 0; i < cpus.size(); i++)
+		assert(cpus[i] == expected[i]);
+
+	cpus.clear();
+	assert(!Topology::parse_cpu_list("3-1", cpus));
+	assert(!Topology::parse_cpu_list("1,x", cpus));
+
+	// every online cpu is in exactly one domain
+	Topology topology;
+	const std::vector<std::vector<int> >& domains = topology.get_domains();
+	int total = 0;
+	cpu_set_t all;
+	CPU_ZERO(&all);
+	for (size_t d = 0; d < domains.size(); d++) {
+		printf("domain %zu (node %d):", d, topology.node_of(domains[d][0]));
+		for (size_t i = 0; i < domains[d].size(); i++) {
+			assert(!CPU_ISSET(domains[d][i], &all));
+			CPU_SET(domains[d][i], &all);
+			printf(" %d", domains[d][i]);
+			total++;
+		}
+		printf("\n");
+	}
+	assert(total == sysconf(_SC_NPROCESSORS_ONLN));
+
+	// a pinned thread starts on its cpu, consumers wrap around the cpus
+	Placement placement(&topology);
+	for (int id = 0; id < 2 * total; id++) {
+		cpu_set_t pin;
+		placement.consumer_cpus(id, pin);
+		assert(CPU_COUNT(&pin) == 1);
+
+		Probe probe;
+		probe.set_affinity(pin);
+		probe.start();
+		probe.join();
+		assert(CPU_EQUAL(&probe.seen, &pin));
+		assert(CPU_ISSET(probe.cpu, &pin));
+		assert(placement.consumer_node(id) == topology.node_of(probe.cpu));
+	}
+
+	// buffers to bind start a page of their own
+	void* buffer = alloc_pages(100);
+	assert(((unsigned long)buffer & (sysconf(_SC_PAGESIZE) - 1)) == 0);
+	bind_to_node(buffer, 100, placement.home_node());
+	free(buffer);
+
+	cpu_set_t home;
+	placement.home_cpus(home);
+	Probe probe;
+	probe.set_affinity(home);
+	probe.start();
+	probe.join();
+	assert(CPU_EQUAL(&probe.seen, &home));
+
+	return 0;
+}
@@ -3,79 +3,137 @@
 #include <assert.h>
 #include "transformer.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
+#define NUM_OPCODES 3
+
+const char Transformer::opcodes[] = "ABC";
+
+static constexpr TransformSpec producer_specs[NUM_OPCODES] = {
+	// A: same speed
+	{ 11, 1111, 1000000007, 10000000 },
+	// B: same speed
+	{ 13, 1313, 1000000007, 10000000 },
+	// C: same speed
+	{ 17, 1717, 1000000007, 10000000 },
+};
 
+static constexpr TransformSpec consumer_specs[NUM_OPCODES] = {
+	// A: same speed
+	{ 19, 1919, 1000000007, 10000000 },
+	// B: same speed
+	{ 23, 2323, 1000000007, 10000000 },
+	// C: same speed
+	{ 29, 2929, 1000000007, 10000000 },
+};
+
+static int opcode_index(char opcode) {
 	switch (opcode) {
-	// same speed
 	case 'A':
-		spec->a = 11;
-		spec->b = 1111;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
-
-	// same speed
+		return 0;
 	case 'B':
-		spec->a = 13;
-		spec->b = 1313;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
-
-	// same speed
+		return 1;
 	case 'C':
-		spec->a = 17;
-		spec->b = 1717;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
+		return 2;
 
 	default:
 		assert(false);
+		return -1;
 	}
+}
+
+Transformer::Transformer(bool verify) : verify(verify) {
+	kernel = affine_select_kernel();
 
-	return transform(spec, val);
+	producer_engines = new Engine[NUM_OPCODES];
+	consumer_engines = new Engine[NUM_OPCODES];
+
+	for (int i = 0; i < NUM_OPCODES; i++) {
+		producer_engines[i] = prepare(producer_specs[i]);
+		consumer_engines[i] = prepare(consumer_specs[i]);
+	}
+}
+
+Transformer::~Transformer() {
+	delete[] producer_engines;
+	delete[] consumer_engines;
+}
+
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
+	int i = opcode_index(opcode);
+	return transform(producer_specs[i], producer_engines[i], val);
 }
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
+	int i = opcode_index(opcode);
+	return transform(consumer_specs[i], consumer_engines[i], val);
+}
 
-	switch (opcode) {
-	// same speed
-	case 'A':
-		spec->a = 19;
-		spec->b = 1919;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
+void Transformer::producer_transform_batch(char opcode, unsigned long long* vals, int n) {
+	int i = opcode_index(opcode);
+	transform_batch(producer_specs[i], producer_engines[i], vals, n);
+}
 
-	// same speed
-	case 'B':
-		spec->a = 23;
-		spec->b = 2323;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
+void Transformer::consumer_transform_batch(char opcode, unsigned long long* vals, int n) {
+	int i = opcode_index(opcode);
+	transform_batch(consumer_specs[i], consumer_engines[i], vals, n);
+}
 
-	// same speed
-	case 'C':
-		spec->a = 29;
-		spec->b = 2929;
-		spec->m = 1000000007;
-		spec->iterations = 10000000;
-		break;
+Transformer::Engine Transformer::prepare(const TransformSpec& spec) {
+	Engine engine;
+	AffineMap step = { spec.a % spec.m, spec.b % spec.m, spec.m };
 
-	default:
-		assert(false);
+	engine.rest = affine_power(step, spec.iterations > 1 ? spec.iterations - 1 : 0);
+
+	// after the first step val < m, so the loop can only wrap if
+	// (m - 1) * a + b does not fit in 64 bits
+	unsigned __int128 largest = (unsigned __int128)(spec.m - 1) * spec.a + spec.b;
+	engine.closed_form = largest >> 64 == 0;
+
+	return engine;
+}
+
+unsigned long long Transformer::transform(const TransformSpec& spec, const Engine& engine, unsigned long long val) {
+	if (spec.iterations <= 0)
+		return val;
+
+	if (!engine.closed_form)
+		return iterate(spec, val);
+
+	unsigned long long result = affine_apply(engine.rest, (val * spec.a + spec.b) % spec.m);
+
+	if (verify)
+		assert(result == iterate(spec, val));
+
+	return result;
+}
+
+void Transformer::transform_batch(const TransformSpec& spec, const Engine& engine, unsigned long long* vals, int n) {
+	if (!engine.closed_form || spec.iterations <= 0) {
+		kernel(spec.a, spec.b, spec.m, spec.iterations, vals, n);
+		return;
 	}
 
-	return transform(spec, val);
+	unsigned long long* expected = nullptr;
+	if (verify) {
+		expected = new unsigned long long[n];
+		for (int i = 0; i < n; i++)
+			expected[i] = vals[i];
+		kernel(spec.a, spec.b, spec.m, spec.iterations, expected, n);
+	}
+
+	for (int i = 0; i < n; i++)
+		vals[i] = affine_apply(engine.rest, (vals[i] * spec.a + spec.b) % spec.m);
+
+	if (verify) {
+		for (int i = 0; i < n; i++)
+			assert(vals[i] == expected[i]);
+		delete[] expected;
+	}
 }
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {
-	while (spec->iterations--) {
-		val = (val * spec->a + spec->b) % spec->m;
+unsigned long long Transformer::iterate(const TransformSpec& spec, unsigned long long val) {
+	int iterations = spec.iterations;
+	while (iterations--) {
+		val = (val * spec.a + spec.b) % spec.m;
 	}
-  return val;
+	return val;
 }
@@ -1,3 +1,4 @@
+#include "affine.hpp"
 
 #ifndef TRANSFORMER_HPP
 #define TRANSFORMER_HPP
@@ -11,8 +12,10 @@ struct TransformSpec {
 
 class Transformer {
 public:
-  Transformer() {};
-  ~Transformer() {};
+  // in verify mode every transform is also computed by iterating the
+  // recurrence, and the two results must agree
+  explicit Transformer(bool verify = false);
+  ~Transformer();
 
   // the producer's work
   unsigned long long producer_transform(char opcode, unsigned long long val);
@@ -20,8 +23,41 @@ public:
   // the consumer's work
   unsigned long long consumer_transform(char opcode, unsigned long long val);
 
+  // the producer's work on n values sharing one opcode, in place
+  void producer_transform_batch(char opcode, unsigned long long* vals, int n);
+
+  // the consumer's work on n values sharing one opcode, in place
+  void consumer_transform_batch(char opcode, unsigned long long* vals, int n);
+
+  // every opcode the generated specs handle
+  static const char opcodes[];
+
 private:
-  unsigned long long transform(TransformSpec* spec, unsigned long long val);
+  // A spec's iterations collapsed into one affine map. The first step is
+  // still done on the raw value, since the loop's val * a + b may wrap
+  // around before it is reduced; every later step starts below m.
+  struct Engine {
+    AffineMap rest;
+    // false if a later step could wrap too, then only iterating is exact
+    bool closed_form;
+  };
+
+  static Engine prepare(const TransformSpec& spec);
+
+  unsigned long long transform(const TransformSpec& spec, const Engine& engine, unsigned long long val);
+
+  void transform_batch(const TransformSpec& spec, const Engine& engine, unsigned long long* vals, int n);
+
+  // the reference semantics, one step at a time
+  static unsigned long long iterate(const TransformSpec& spec, unsigned long long val);
+
+  bool verify;
+
+  // steps the recurrence for a whole batch, picked for this CPU at startup
+  AffineBatchKernel kernel;
+
+  Engine* producer_engines;
+  Engine* consumer_engines;
 };
 
 #endif // TRANSFORMER_HPP
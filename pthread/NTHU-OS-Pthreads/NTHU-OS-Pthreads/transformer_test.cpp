@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "transformer.hpp"
+
+// Runs every opcode through both stages in verify mode, which asserts
+// that the closed form agrees with iterating the recurrence, one value at
+// a time and in batches through the vector kernel.
+int main() {
+	Transformer* transformer = new Transformer(true);
+
+	unsigned long long vals[] = { 0, 1, 57192, 123456, 1000000006, 18446744073709551615ULL };
+	int n = sizeof(vals) / sizeof(vals[0]);
+
+	for (int i = 0; i < (int)strlen(Transformer::opcodes); i++) {
+		char opcode = Transformer::opcodes[i];
+		for (int j = 0; j < n; j++) {
+			unsigned long long p = transformer->producer_transform(opcode, vals[j]);
+			unsigned long long c = transformer->consumer_transform(opcode, p);
+			printf("%c %llu %llu %llu\n", opcode, vals[j], p, c);
+		}
+	}
+
+	// odd batch sizes exercise the vector loops and their scalar tails
+	for (int i = 0; i < (int)strlen(Transformer::opcodes); i++) {
+		for (int n = 1; n <= 19; n += 6) {
+			unsigned long long batch[19];
+			for (int j = 0; j < n; j++)
+				batch[j] = vals[j % 6] + j;
+			transformer->producer_transform_batch(Transformer::opcodes[i], batch, n);
+			transformer->consumer_transform_batch(Transformer::opcodes[i], batch, n);
+		}
+	}
+
+	// the kernel picked for this CPU against the scalar loop, including
+	// specs too wide for the vector path
+	unsigned long long specs[][3] = {
+		{ 2003, 183492, 1000000007 },
+		{ 29, 2929, 4294967291ULL },
+		{ 4294967311ULL, 7, 1000000009 },
+		{ 1ULL << 40, 3, 998244353 },
+	};
+	AffineBatchKernel kernel = affine_select_kernel();
+	for (int s = 0; s < 4; s++) {
+		unsigned long long expected[19], actual[19];
+		for (int j = 0; j < 19; j++)
+			expected[j] = actual[j] = vals[j % 6] * (j + 1);
+		affine_iterate_scalar(specs[s][0], specs[s][1], specs[s][2], 1000, expected, 19);
+		kernel(specs[s][0], specs[s][1], specs[s][2], 1000, actual, 19);
+		for (int j = 0; j < 19; j++)
+			assert(actual[j] == expected[j]);
+	}
+
+	delete transformer;
+
+	return 0;
+}
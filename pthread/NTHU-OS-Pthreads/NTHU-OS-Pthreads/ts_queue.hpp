@@ -1,20 +1,55 @@
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 #include <cstdlib>
 #include <stdlib.h>
+#include <assert.h>
+#include <atomic>
+#include "topology.hpp"
+#include "cancel_token.hpp"
 
 #ifndef TS_QUEUE_HPP
 #define TS_QUEUE_HPP
 
 #define DEFAULT_BUFFER_SIZE 200
 
-template <class T>
-class TSQueue
+// how many items a pipeline stage moves per bulk call
+#define DEFAULT_BATCH_SIZE 16
+
+#define CACHE_LINE_SIZE 64
+
+// The ring backing every TSQueue unless one is named explicitly.
+// Build with -DTS_QUEUE_DEFAULT_RING=LockFreeRing to switch the
+// whole pipeline to the lock-free backend.
+#ifndef TS_QUEUE_DEFAULT_RING
+#define TS_QUEUE_DEFAULT_RING MutexRing
+#endif
+
+// bounded ring guarded by one pthread mutex and two condvars
+template <class T> class MutexRing;
+// bounded lock-free MPMC ring, see lock_free_ring.hpp
+template <class T> class LockFreeRing;
+
+// Every TSQueue carries an end of stream: the threads that enqueue into
+// it attach as sources up front, and once the last one detaches the queue
+// is closed. Dequeues from a closed queue still get what is left, then
+// return 0 instead of blocking, so each stage can drain, detach from the
+// next queue and exit. Dequeues also return 0 as soon as the token they
+// were given is cancelled; enqueues are never cut short, so no element is
+// lost on the way down.
+template <class T, template <class> class Ring = TS_QUEUE_DEFAULT_RING>
+class TSQueue : public Interruptible
 {
 public:
 	// constructor
 	TSQueue();
 
-	explicit TSQueue(int max_buffer_size);
+	// a queue of shards rings splitting max_buffer_size between them;
+	// enqueues spread batches over the shards and every dequeue drains
+	// its home shard before it takes from the others. A dequeue that
+	// finds every shard empty waits on the queue, not on a shard, so an
+	// element arriving on any shard wakes it
+	explicit TSQueue(int max_buffer_size, int shards = 1);
 
 	// destructor
 	~TSQueue();
@@ -22,19 +57,137 @@ public:
 	// add an element to the end of the queue
 	void enqueue(T item);
 
-	// remove and return the first element of the queue
+	// remove and return the first element of the queue, blocking until
+	// there is one; only for queues that are never drained, as nothing
+	// could be returned from those (asserted)
 	T dequeue();
 
-	// return the number of elements in the queue
+	// add n elements to the end of the queue, blocking until all are in;
+	// with several shards each call goes to the calling thread's next one
+	void enqueue_bulk(T* items, int n);
+
+	// add n elements to the end of shard % get_shards()
+	void enqueue_bulk_to(int shard, T* items, int n);
+
+	// remove up to max elements into items and return how many were removed;
+	// waits at most timeout microseconds for the first one (forever if the
+	// timeout is negative) and returns 0 if none arrived, the queue is
+	// drained or token got cancelled. The calling thread's home shard is
+	// picked for it.
+	int dequeue_bulk(T* items, int max, long timeout, const CancelToken* token = nullptr);
+
+	// dequeue_bulk from home % get_shards() first, and from the other
+	// shards only when that one is empty
+	int dequeue_bulk_from(int home, T* items, int max, long timeout, const CancelToken* token = nullptr);
+
+	// register one more thread that will enqueue, before any source detaches
+	void attach_source();
+
+	// the calling source enqueues no more; the last one closes the queue
+	void detach_source();
+
+	// end the stream now, whatever sources are attached
+	void close();
+
+	// return whether the queue is closed and empty, nothing will come anymore
+	bool is_drained();
+
+	// wake every blocked dequeue so it rechecks its token
+	virtual void interrupt() override;
+
+	// return the number of elements in all shards
+	int get_size();
+
+	// return the number of shards
+	int get_shards();
+
+	// return how many elements were ever enqueued, for rate measurements
+	unsigned long long get_enqueued();
+
+	// return how many elements were ever dequeued
+	unsigned long long get_dequeued();
+
+	// keep the buffer on NUMA node, the one its consumers run on
+	void bind_to_node(int node);
+
+	// keep the buffer of one shard on NUMA node, the one the consumers
+	// draining it first run on
+	void bind_shard_to_node(int shard, int node);
+
+private:
+	// a number fixed for the calling thread, spreading threads over shards
+	static unsigned int thread_hint();
+
+	// take up to max elements from any shard, starting after home, without
+	// blocking
+	int steal_bulk(int home, T* items, int max);
+
+	// wake sharded dequeues waiting for n new elements, if there are any
+	void wake(int n);
+
+	// the backends doing the actual synchronization, one per shard
+	Ring<T>** rings;
+	int shards;
+
+	std::atomic<int> sources;
+	std::atomic<bool> closed;
+
+	// each counter on its own line, producers and consumers bump them
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<unsigned long long> enqueued;
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<unsigned long long>)];
+	std::atomic<unsigned long long> dequeued;
+	char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<unsigned long long>)];
+
+	// with several shards, dequeues that found all of them empty wait on
+	// cond_dequeue; waiters tells enqueues whether to signal it
+	std::atomic<int> waiters;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_dequeue;
+};
+
+template <class T>
+class MutexRing
+{
+public:
+	// constructor
+	explicit MutexRing(int max_buffer_size);
+
+	// destructor
+	~MutexRing();
+
+	// append n elements, blocking whenever the ring is full
+	void enqueue_bulk(T* items, int n);
+
+	// remove up to max elements, see TSQueue::dequeue_bulk
+	int dequeue_bulk(T* items, int max, long timeout, const CancelToken* token);
+
+	// remove up to max elements if there are any, never blocks
+	int try_dequeue_bulk(T* items, int max);
+
+	// return the number of elements in the ring
 	int get_size();
 
+	// keep the buffer on NUMA node
+	void bind_to_node(int node);
+
+	// stop dequeues from waiting once the ring is empty
+	void close();
+
+	// wake every blocked dequeue so it rechecks its token
+	void interrupt();
+
 private:
+	// set by close, read by waiters under the mutex
+	std::atomic<bool> closed;
+
 	// the maximum buffer size
 	int buffer_size;
 	// the buffer containing values of the queue
 	T *buffer;
-	// the current size of the buffer
-	int size;
+	// the current size of the buffer, written under the mutex only but
+	// read without it by try_dequeue_bulk and get_size
+	std::atomic<int> size;
 	// the index of first item in the queue
 	int head;
 	// the index of last item in the queue
@@ -48,87 +201,444 @@ private:
 
 // Implementation start
 
-template <class T>
-TSQueue<T>::TSQueue() : TSQueue(DEFAULT_BUFFER_SIZE)
+// absolute CLOCK_MONOTONIC time timeout microseconds from now
+static inline struct timespec deadline_after(long timeout)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout / 1000000;
+	ts.tv_nsec += (timeout % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+// wake the threads waiting on cond for n new items or slots
+static inline void notify(pthread_cond_t* cond, int n)
+{
+	if (n == 1)
+		pthread_cond_signal(cond);
+	else if (n > 1)
+		pthread_cond_broadcast(cond);
+}
+
+template <class T, template <class> class Ring>
+TSQueue<T, Ring>::TSQueue() : TSQueue(DEFAULT_BUFFER_SIZE)
+{
+}
+
+template <class T, template <class> class Ring>
+TSQueue<T, Ring>::TSQueue(int buffer_size, int shards) : shards(shards > 0 ? shards : 1)
+{
+	// every shard gets its own allocation, so no two share a cache line
+	rings = new Ring<T>*[this->shards];
+	for (int i = 0; i < this->shards; i++)
+		rings[i] = new Ring<T>((buffer_size + this->shards - 1) / this->shards);
+
+	sources.store(0);
+	closed.store(false);
+	enqueued.store(0, std::memory_order_relaxed);
+	dequeued.store(0, std::memory_order_relaxed);
+	waiters.store(0, std::memory_order_relaxed);
+
+	// timed waits are measured on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_dequeue, &attr);
+
+	pthread_condattr_destroy(&attr);
+}
+
+template <class T, template <class> class Ring>
+TSQueue<T, Ring>::~TSQueue()
+{
+	for (int i = 0; i < shards; i++)
+		delete rings[i];
+	delete[] rings;
+
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_dequeue);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::enqueue(T item)
+{
+	enqueue_bulk(&item, 1);
+}
+
+template <class T, template <class> class Ring>
+T TSQueue<T, Ring>::dequeue()
+{
+	T item;
+	int n = dequeue_bulk(&item, 1, -1);
+	assert(n == 1);
+	(void)n;
+	return item;
+}
+
+template <class T, template <class> class Ring>
+unsigned int TSQueue<T, Ring>::thread_hint()
+{
+	// the address of a thread-local differs between threads
+	static thread_local char anchor;
+	return (unsigned int)((unsigned long)&anchor / CACHE_LINE_SIZE * 2654435761u >> 8);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::enqueue_bulk(T* items, int n)
+{
+	if (shards == 1)
+	{
+		enqueue_bulk_to(0, items, n);
+		return;
+	}
+
+	// round robin per thread, starting threads at different shards
+	static thread_local unsigned int next = thread_hint();
+	enqueue_bulk_to(next++ % shards, items, n);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::enqueue_bulk_to(int shard, T* items, int n)
+{
+	rings[shard % shards]->enqueue_bulk(items, n);
+	enqueued.fetch_add(n, std::memory_order_relaxed);
+	if (shards > 1)
+		wake(n);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::wake(int n)
+{
+	// pairs with the fence in dequeue_bulk_from: either the waiter sees
+	// the elements just enqueued, or we see it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) == 0)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	notify(&cond_dequeue, n);
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T, template <class> class Ring>
+int TSQueue<T, Ring>::dequeue_bulk(T* items, int max, long timeout, const CancelToken* token)
+{
+	return dequeue_bulk_from(shards == 1 ? 0 : thread_hint() % shards, items, max, timeout, token);
+}
+
+template <class T, template <class> class Ring>
+int TSQueue<T, Ring>::dequeue_bulk_from(int home, T* items, int max, long timeout, const CancelToken* token)
 {
+	home %= shards;
+
+	int n;
+	if (shards == 1)
+	{
+		n = rings[0]->dequeue_bulk(items, max, timeout, token);
+	}
+	else
+	{
+		// wait on the queue, which every enqueue to any shard signals
+		struct timespec deadline;
+		if (timeout >= 0)
+			deadline = deadline_after(timeout);
+
+		bool timed_out = false;
+		while ((n = steal_bulk(home, items, max)) == 0)
+		{
+			if (timed_out || is_drained() || (token && token->is_cancelled()))
+				break;
+
+			pthread_mutex_lock(&mutex);
+			waiters.fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			// enqueues from here on see us waiting, look once more for
+			// one that came before
+			if (get_size() == 0 && !closed.load() && !(token && token->is_cancelled()))
+			{
+				if (timeout < 0)
+					pthread_cond_wait(&cond_dequeue, &mutex);
+				else
+					timed_out = pthread_cond_timedwait(&cond_dequeue, &mutex, &deadline) == ETIMEDOUT;
+			}
+			waiters.fetch_sub(1);
+			pthread_mutex_unlock(&mutex);
+		}
+	}
+
+	if (n > 0)
+		dequeued.fetch_add(n, std::memory_order_relaxed);
+	return n;
+}
+
+template <class T, template <class> class Ring>
+int TSQueue<T, Ring>::steal_bulk(int home, T* items, int max)
+{
+	for (int i = 0; i < shards; i++)
+	{
+		int n = rings[(home + i) % shards]->try_dequeue_bulk(items, max);
+		if (n > 0)
+			return n;
+	}
+	return 0;
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::attach_source()
+{
+	sources.fetch_add(1);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::detach_source()
+{
+	if (sources.fetch_sub(1) == 1)
+		close();
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::close()
+{
+	closed.store(true);
+	for (int i = 0; i < shards; i++)
+		rings[i]->close();
+
+	pthread_mutex_lock(&mutex);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T, template <class> class Ring>
+bool TSQueue<T, Ring>::is_drained()
+{
+	// closed first: once it reads true every enqueue is visible, so the
+	// sizes are not read from before the last one
+	return closed.load() && get_size() == 0;
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::interrupt()
+{
+	for (int i = 0; i < shards; i++)
+		rings[i]->interrupt();
+
+	pthread_mutex_lock(&mutex);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T, template <class> class Ring>
+int TSQueue<T, Ring>::get_size()
+{
+	int size = 0;
+	for (int i = 0; i < shards; i++)
+		size += rings[i]->get_size();
+	return size;
+}
+
+template <class T, template <class> class Ring>
+int TSQueue<T, Ring>::get_shards()
+{
+	return shards;
+}
+
+template <class T, template <class> class Ring>
+unsigned long long TSQueue<T, Ring>::get_enqueued()
+{
+	return enqueued.load(std::memory_order_relaxed);
+}
+
+template <class T, template <class> class Ring>
+unsigned long long TSQueue<T, Ring>::get_dequeued()
+{
+	return dequeued.load(std::memory_order_relaxed);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::bind_to_node(int node)
+{
+	for (int i = 0; i < shards; i++)
+		rings[i]->bind_to_node(node);
+}
+
+template <class T, template <class> class Ring>
+void TSQueue<T, Ring>::bind_shard_to_node(int shard, int node)
+{
+	rings[shard % shards]->bind_to_node(node);
 }
 
 template <class T>
-TSQueue<T>::TSQueue(int buffer_size) : buffer_size(buffer_size)
+MutexRing<T>::MutexRing(int buffer_size) : buffer_size(buffer_size)
 {
-	// TODO: implements TSQueue constructor
-	buffer = (T*) malloc(buffer_size * sizeof(T));
+	// on pages of its own, see bind_to_node
+	buffer = (T*) alloc_pages(buffer_size * sizeof(T));
 	head = 0;
 	tail = 0;
-	size = 0;
+	size.store(0, std::memory_order_relaxed);
+	closed.store(false);
+
+	// timed waits are measured on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond_enqueue, &attr);
+	pthread_cond_init(&cond_dequeue, &attr);
+
+	pthread_condattr_destroy(&attr);
+}
+
+template <class T>
+MutexRing<T>::~MutexRing()
+{
+	// every thread using the queue has to be joined by now
+	free(buffer);
+
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_enqueue);
+	pthread_cond_destroy(&cond_dequeue);
 }
 
 template <class T>
-TSQueue<T>::~TSQueue()
+void MutexRing<T>::enqueue_bulk(T* items, int n)
 {
-	// TODO: implenents TSQueue destructor
-	//free(buffer);
-	//delete(this);
+	pthread_mutex_lock(&mutex);
+
+	while (n > 0)
+	{
+		while (size.load(std::memory_order_relaxed) == buffer_size)
+		{
+			pthread_cond_wait(&cond_enqueue, &mutex);
+		}
+
+		int count = buffer_size - size.load(std::memory_order_relaxed);
+		if (count > n)
+			count = n;
+
+		for (int i = 0; i < count; i++)
+		{
+			buffer[tail] = items[i];
+			tail = (tail + 1) % buffer_size;
+		}
+		size.fetch_add(count, std::memory_order_relaxed);
+		items += count;
+		n -= count;
+
+		notify(&cond_dequeue, count);
+	}
+
+	pthread_mutex_unlock(&mutex);
 }
 
 template <class T>
-void TSQueue<T>::enqueue(T item)
+int MutexRing<T>::dequeue_bulk(T* items, int max, long timeout, const CancelToken* token)
 {
-	// TODO: enqueues an element to the end of the queue
+	struct timespec deadline;
+	if (timeout >= 0)
+		deadline = deadline_after(timeout);
 
 	pthread_mutex_lock(&mutex);
 
-	while (size == buffer_size)
+	while (size.load(std::memory_order_relaxed) == 0)
 	{
-		pthread_cond_wait(&cond_enqueue, &mutex);
+		// nothing more is coming, or the caller has to go
+		if (closed.load() || (token && token->is_cancelled()))
+		{
+			pthread_mutex_unlock(&mutex);
+			return 0;
+		}
+
+		if (timeout < 0)
+		{
+			pthread_cond_wait(&cond_dequeue, &mutex);
+		}
+		else if (pthread_cond_timedwait(&cond_dequeue, &mutex, &deadline) == ETIMEDOUT
+			&& size.load(std::memory_order_relaxed) == 0)
+		{
+			pthread_mutex_unlock(&mutex);
+			return 0;
+		}
 	}
 
-	buffer[tail] = item;
-	if(tail == buffer_size)
-		tail = 0;
-	else
-		tail++;
-	size++;
+	int count = size.load(std::memory_order_relaxed);
+	if (count > max)
+		count = max;
+	for (int i = 0; i < count; i++)
+	{
+		items[i] = buffer[head];
+		head = (head + 1) % buffer_size;
+	}
+	size.fetch_sub(count, std::memory_order_relaxed);
 
-	if(size != 0)	
-		pthread_cond_signal(&cond_dequeue);
+	notify(&cond_enqueue, count);
 
 	pthread_mutex_unlock(&mutex);
 
+	return count;
 }
 
 template <class T>
-T TSQueue<T>::dequeue()
+int MutexRing<T>::try_dequeue_bulk(T* items, int max)
 {
-	// TODO: dequeues the first element of the queue
+	// an unlocked peek, so empty shards cost no lock
+	if (size.load(std::memory_order_relaxed) == 0)
+		return 0;
+
 	pthread_mutex_lock(&mutex);
 
-	while (size == 0)
+	int count = size.load(std::memory_order_relaxed);
+	if (count > max)
+		count = max;
+	for (int i = 0; i < count; i++)
 	{
-		pthread_cond_wait(&cond_dequeue, &mutex);
+		items[i] = buffer[head];
+		head = (head + 1) % buffer_size;
 	}
+	size.fetch_sub(count, std::memory_order_relaxed);
 
-	T item = buffer[head];
+	notify(&cond_enqueue, count);
 
-	if(head != buffer_size)
-		head++;
-	else 
-		head = 0;
-	size--;
+	pthread_mutex_unlock(&mutex);
 
-	if(size != buffer_size)
-		pthread_cond_signal(&cond_enqueue);
+	return count;
+}
 
-	pthread_mutex_unlock(&mutex);
+template <class T>
+int MutexRing<T>::get_size()
+{
+	return size.load(std::memory_order_relaxed);
+}
 
-	return item;
+template <class T>
+void MutexRing<T>::bind_to_node(int node)
+{
+	::bind_to_node(buffer, buffer_size * sizeof(T), node);
 }
 
 template <class T>
-int TSQueue<T>::get_size()
+void MutexRing<T>::close()
 {
-	// TODO: returns the size of the queue
-	return size;
+	pthread_mutex_lock(&mutex);
+	closed.store(true);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
 }
 
+template <class T>
+void MutexRing<T>::interrupt()
+{
+	pthread_mutex_lock(&mutex);
+	pthread_cond_broadcast(&cond_dequeue);
+	pthread_mutex_unlock(&mutex);
+}
+
+#include "lock_free_ring.hpp"
+
 #endif // TS_QUEUE_HPP
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+#include "ts_queue.hpp"
+
+// Contention benchmark: N producers and N consumers push ITEMS integers
+// through one queue of each backend and report throughput.
+
+#define BENCH_QUEUE_SIZE 200
+#define BENCH_DEFAULT_ITEMS (1 << 20)
+#define BENCH_MAX_THREADS 32
+
+template <template <class> class Ring>
+struct Bench {
+	TSQueue<long, Ring>* q;
+	long items_per_thread;
+	long sums[BENCH_MAX_THREADS];
+};
+
+template <template <class> class Ring>
+struct Worker {
+	Bench<Ring>* bench;
+	pthread_t t;
+	int id;
+};
+
+template <template <class> class Ring>
+void* produce(void* arg) {
+	Worker<Ring>* w = (Worker<Ring>*)arg;
+
+	long from = w->id * w->bench->items_per_thread;
+	long to = from + w->bench->items_per_thread;
+	for (long i = from; i < to; i++)
+		w->bench->q->enqueue(i);
+
+	return nullptr;
+}
+
+template <template <class> class Ring>
+void* consume(void* arg) {
+	Worker<Ring>* w = (Worker<Ring>*)arg;
+
+	long sum = 0;
+	for (long i = 0; i < w->bench->items_per_thread; i++)
+		sum += w->bench->q->dequeue();
+	w->bench->sums[w->id] = sum;
+
+	return nullptr;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// returns millions of items per second with n producers and n consumers
+template <template <class> class Ring>
+double run(int n, long items) {
+	Bench<Ring> bench;
+	bench.q = new TSQueue<long, Ring>(BENCH_QUEUE_SIZE);
+	bench.items_per_thread = items / n;
+
+	Worker<Ring> producers[BENCH_MAX_THREADS];
+	Worker<Ring> consumers[BENCH_MAX_THREADS];
+
+	double start = now();
+
+	for (int i = 0; i < n; i++) {
+		producers[i].bench = consumers[i].bench = &bench;
+		producers[i].id = consumers[i].id = i;
+		pthread_create(&consumers[i].t, 0, consume<Ring>, (void*)&consumers[i]);
+		pthread_create(&producers[i].t, 0, produce<Ring>, (void*)&producers[i]);
+	}
+
+	for (int i = 0; i < n; i++) {
+		pthread_join(producers[i].t, 0);
+		pthread_join(consumers[i].t, 0);
+	}
+
+	double elapsed = now() - start;
+
+	// every produced value must come out exactly once
+	long total = bench.items_per_thread * n;
+	long sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += bench.sums[i];
+	assert(sum == total * (total - 1) / 2);
+
+	delete bench.q;
+
+	return total / elapsed / 1e6;
+}
+
+int main(int argc, char** argv) {
+	long items = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_ITEMS;
+
+	printf("%12s %16s %16s %8s\n", "threads/side", "mutex Mops/s", "lock-free Mops/s", "speedup");
+
+	for (int n = 1; n <= BENCH_MAX_THREADS; n *= 2) {
+		double mutex = run<MutexRing>(n, items);
+		double lock_free = run<LockFreeRing>(n, items);
+		printf("%12d %16.2f %16.2f %7.2fx\n", n, mutex, lock_free, lock_free / mutex);
+	}
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include <unistd.h>
 #include "ts_queue.hpp"
 
 /* Global shared variables */
@@ -33,22 +34,33 @@ void* consume(void* arg) {
 	return nullptr;
 }
 
+void* consume_bulk(void* arg) {
+	int tid = *(int*)arg;
+
+	// with shards every consumer drains its own first
+	for (int i = 0; i < num_producer; )
+		i += q->dequeue_bulk_from(tid, &result[tid][i], num_producer - i, -1);
+
+	return nullptr;
+}
+
+void* wait_cancelled(void* arg) {
+	int val;
+	// blocks on the empty queue until the token is cancelled
+	int n = q->dequeue_bulk(&val, 1, -1, (CancelToken*)arg);
+	assert(n == 0);
+	(void)n;
+
+	return nullptr;
+}
+
 struct Thread {
 	pthread_t t;
 	int id;
 };
 
-int main(int argc, char** argv) {
-	assert(argc == 3);
-
-	q = new TSQueue<int>(20);
-	num_producer = atoi(argv[1]);
-	num_consumer = atoi(argv[2]);
-
-	result = new int*[num_consumer];
-	for (int i = 0; i < num_consumer; i++)
-		result[i] = new int[num_producer];
-
+// run the producers against num_consumer threads running routine
+void run(void* (*routine)(void*)) {
 	Thread* producers = new Thread[num_producer];
 	Thread* consumers = new Thread[num_consumer];
 
@@ -59,7 +71,7 @@ int main(int argc, char** argv) {
 
 	for (int i = 0; i < num_consumer; i++) {
 		consumers[i].id = i;
-		pthread_create(&consumers[i].t, 0, consume, (void*)&consumers[i].id);
+		pthread_create(&consumers[i].t, 0, routine, (void*)&consumers[i].id);
 	}
 
 	for (int i = 0; i < num_producer; i++) {
@@ -69,6 +81,35 @@ int main(int argc, char** argv) {
 		pthread_join(consumers[i].t, 0);
 	}
 
+	delete[] producers;
+	delete[] consumers;
+}
+
+// assert every value came out exactly once
+void check_results() {
+	bool* seen = new bool[num_producer * num_consumer]();
+	for (int i = 0; i < num_consumer; i++) {
+		for (int j = 0; j < num_producer; j++) {
+			assert(!seen[result[i][j]]);
+			seen[result[i][j]] = true;
+		}
+	}
+	delete[] seen;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 3 || argc == 4);
+
+	num_producer = atoi(argv[1]);
+	num_consumer = atoi(argv[2]);
+	q = new TSQueue<int>(20, argc == 4 ? atoi(argv[3]) : 1);
+
+	result = new int*[num_consumer];
+	for (int i = 0; i < num_consumer; i++)
+		result[i] = new int[num_producer];
+
+	run(consume);
+
 	for (int i = 0; i < num_consumer; i++) {
 		printf("consumer %d:", i);
 		for (int j = 0; j < num_producer; j++)
@@ -76,5 +117,60 @@ int main(int argc, char** argv) {
 		printf("\n");
 	}
 
+	check_results();
+
+	// the same through dequeue_bulk_from, taking as many as there are
+	run(consume_bulk);
+	check_results();
+
+	// a timed dequeue gives up on an empty queue
+	int val;
+	int n = q->dequeue_bulk(&val, 1, 1000);
+	assert(n == 0);
+
+	// a cancel wakes a blocked dequeue, and once the last source detaches
+	// dequeues return 0 instead of blocking
+	CancelToken token;
+	token.attach(q);
+	q->attach_source();
+
+	pthread_t waiter;
+	pthread_create(&waiter, 0, wait_cancelled, (void*)&token);
+	usleep(10000);
+	token.cancel();
+	pthread_join(waiter, 0);
+
+	q->enqueue(-1);
+	q->detach_source();
+	n = q->dequeue_bulk(&val, 1, -1);
+	assert(n == 1 && val == -1);
+	assert(q->is_drained());
+	n = q->dequeue_bulk_from(num_consumer - 1, &val, 1, -1);
+	assert(n == 0);
+
+	// the smallest lock-free ring still refuses once full, and gives the
+	// elements back in order
+	LockFreeRing<int> ring(1);
+	bool ok = ring.try_enqueue(1);
+	assert(ok);
+	ok = ring.try_enqueue(2);
+	assert(ok);
+	ok = ring.try_enqueue(3);
+	assert(!ok);
+	ok = ring.try_dequeue(val);
+	assert(ok && val == 1);
+	ok = ring.try_dequeue(val);
+	assert(ok && val == 2);
+	ok = ring.try_dequeue(val);
+	assert(!ok);
+	// only read by the asserts
+	(void)n;
+	(void)ok;
+
+	for (int i = 0; i < num_consumer; i++)
+		delete[] result[i];
+	delete[] result;
+	delete q;
+
 	return 0;
 }
@@ -0,0 +1,151 @@
+#include <atomic>
+#include <vector>
+#include "lock_free_ring.hpp"
+
+#ifndef WORK_STEALING_DEQUE_HPP
+#define WORK_STEALING_DEQUE_HPP
+
+#define DEFAULT_DEQUE_CAPACITY 64
+
+// Chase-Lev work-stealing deque, with the memory orderings from Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models".
+// The owner pushes and pops at the bottom without contention; other
+// threads steal from the top and only race the owner for the last element.
+template <class T>
+class WorkStealingDeque
+{
+public:
+	// constructor, the capacity is rounded up to a power of two
+	explicit WorkStealingDeque(int capacity = DEFAULT_DEQUE_CAPACITY);
+
+	// destructor
+	~WorkStealingDeque();
+
+	// owner only: add an element at the bottom, growing if needed
+	void push(T item);
+
+	// owner only: remove the bottom element into item, false if empty
+	bool pop(T& item);
+
+	// any thread: remove the top element into item, false if the deque
+	// was empty or another thread won the race for it
+	bool steal(T& item);
+
+	// return the number of elements, only a hint while others steal
+	int get_size();
+
+private:
+	struct Array {
+		long mask;
+		std::atomic<T>* slots;
+
+		explicit Array(long capacity) : mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+		~Array() { delete[] slots; }
+
+		T get(long i) { return slots[i & mask].load(std::memory_order_relaxed); }
+		void put(long i, T item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+	};
+
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<long> top;
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<long>)];
+	std::atomic<long> bottom;
+	std::atomic<Array*> array;
+	char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<long>) - sizeof(std::atomic<Array*>)];
+
+	// arrays replaced by a grow, a thief may still be reading them
+	std::vector<Array*> retired;
+};
+
+// Implementation start
+
+template <class T>
+WorkStealingDeque<T>::WorkStealingDeque(int capacity)
+{
+	long size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	top.store(0, std::memory_order_relaxed);
+	bottom.store(0, std::memory_order_relaxed);
+	array.store(new Array(size), std::memory_order_relaxed);
+}
+
+template <class T>
+WorkStealingDeque<T>::~WorkStealingDeque()
+{
+	delete array.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < retired.size(); i++)
+		delete retired[i];
+}
+
+template <class T>
+void WorkStealingDeque<T>::push(T item)
+{
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_acquire);
+	Array* a = array.load(std::memory_order_relaxed);
+
+	if (b - t > a->mask) {
+		Array* bigger = new Array(2 * (a->mask + 1));
+		for (long i = t; i < b; i++)
+			bigger->put(i, a->get(i));
+		retired.push_back(a);
+		a = bigger;
+		array.store(a, std::memory_order_release);
+	}
+
+	a->put(b, item);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+template <class T>
+bool WorkStealingDeque<T>::pop(T& item)
+{
+	long b = bottom.load(std::memory_order_relaxed) - 1;
+	Array* a = array.load(std::memory_order_relaxed);
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long t = top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		// empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	item = a->get(b);
+	if (t == b) {
+		// last element, race the thieves for it
+		bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+template <class T>
+bool WorkStealingDeque<T>::steal(T& item)
+{
+	long t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	long b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return false;
+
+	Array* a = array.load(std::memory_order_acquire);
+	item = a->get(t);
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template <class T>
+int WorkStealingDeque<T>::get_size()
+{
+	long b = bottom.load(std::memory_order_relaxed);
+	long t = top.load(std::memory_order_relaxed);
+	return b > t ? (int)(b - t) : 0;
+}
+
+#endif // WORK_STEALING_DEQUE_HPP
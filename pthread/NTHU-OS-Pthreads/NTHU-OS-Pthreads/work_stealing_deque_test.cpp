@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <atomic>
+#include "work_stealing_deque.hpp"
+
+/* Global shared variables */
+WorkStealingDeque<int*>* deque;
+int num_items;
+int num_thieves;
+int* values;
+std::atomic<int>* taken;
+std::atomic<bool> owner_done;
+
+void* steal(void* arg) {
+	int* item;
+
+	while (!owner_done.load() || deque->get_size() > 0) {
+		if (deque->steal(item))
+			taken[item - values]++;
+	}
+
+	return nullptr;
+}
+
+int main(int argc, char** argv) {
+	assert(argc == 3);
+
+	// start small so the owner has to grow the array under the thieves
+	deque = new WorkStealingDeque<int*>(4);
+	num_items = atoi(argv[1]);
+	num_thieves = atoi(argv[2]);
+
+	values = new int[num_items];
+	taken = new std::atomic<int>[num_items];
+	for (int i = 0; i < num_items; i++)
+		taken[i].store(0);
+	owner_done.store(false);
+
+	pthread_t* thieves = new pthread_t[num_thieves];
+	for (int i = 0; i < num_thieves; i++)
+		pthread_create(&thieves[i], 0, steal, nullptr);
+
+	// the owner pushes everything and pops every third step
+	int* item;
+	for (int i = 0; i < num_items; i++) {
+		deque->push(&values[i]);
+		if (i % 3 == 0 && deque->pop(item))
+			taken[item - values]++;
+	}
+	while (deque->pop(item))
+		taken[item - values]++;
+	owner_done.store(true);
+
+	for (int i = 0; i < num_thieves; i++)
+		pthread_join(thieves[i], 0);
+
+	int stolen_twice = 0, lost = 0;
+	for (int i = 0; i < num_items; i++) {
+		if (taken[i] > 1)
+			stolen_twice++;
+		if (taken[i] == 0)
+			lost++;
+	}
+
+	printf("items: %d, taken twice: %d, lost: %d\n", num_items, stolen_twice, lost);
+
+	return stolen_twice || lost;
+}
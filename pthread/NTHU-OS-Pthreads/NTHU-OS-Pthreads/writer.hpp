@@ -1,16 +1,31 @@
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <string>
 #include "thread.hpp"
 #include "ts_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_buffer.hpp"
+#include "metrics.hpp"
 
 #ifndef WRITER_HPP
 #define WRITER_HPP
 
+// the writer formats lines into WRITER_BUFFERS buffers of
+// WRITER_BUFFER_SIZE bytes and hands them all to one writev once full
+#define WRITER_BUFFER_SIZE (64 * 1024)
+#define WRITER_BUFFERS 8
+
 class Writer : public Thread
 {
 public:
-	// constructor
-	Writer(int expected_lines, std::string output_file, TSQueue<Item *> *output_queue);
+	// constructor, with a reorder buffer the lines are written in key order;
+	// with metrics the thread records under the "writer" stage
+	Writer(int expected_lines, std::string output_file, TSQueue<Item *> *output_queue,
+		ReorderBuffer *reorder = nullptr, Metrics *metrics = nullptr);
 
 	// destructor
 	~Writer();
@@ -22,30 +37,63 @@ private:
 	// the writer thread finished after output expected lines of item
 	int expected_lines;
 
-	std::ofstream ofs;
+	int fd;
 	TSQueue<Item *> *output_queue;
 
+	ReorderBuffer *reorder;
+
+	Metrics *metrics;
+	StageMetrics *stats;
+
+	char *buffers[WRITER_BUFFERS];
+	struct iovec iov[WRITER_BUFFERS];
+	// the buffer being filled, the ones before it are full
+	int current;
+
+	// format one item into the buffers, flushing when they are all full
+	void append(const Item &item);
+
+	// append n items and give them back to their pool
+	void write_items(Item **items, int n);
+
+	// write out everything buffered so far
+	void flush();
+
 	// the method for pthread to create a writer thread
 	static void *process(void *arg);
 };
 
 // Implementation start
 
-Writer::Writer(int expected_lines, std::string output_file, TSQueue<Item *> *output_queue)
-	: expected_lines(expected_lines), output_queue(output_queue)
+Writer::Writer(int expected_lines, std::string output_file, TSQueue<Item *> *output_queue,
+	ReorderBuffer *reorder, Metrics *metrics)
+	: expected_lines(expected_lines), output_queue(output_queue), reorder(reorder), metrics(metrics),
+	  stats(nullptr), current(0)
 {
-	ofs = std::ofstream(output_file);
+	fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		perror(output_file.c_str());
+
+	for (int i = 0; i < WRITER_BUFFERS; i++)
+	{
+		buffers[i] = new char[WRITER_BUFFER_SIZE];
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = 0;
+	}
 }
 
 Writer::~Writer()
 {
-	ofs.close();
+	if (fd >= 0)
+		close(fd);
+	for (int i = 0; i < WRITER_BUFFERS; i++)
+		delete[] buffers[i];
 }
 
 void Writer::start()
 {
 	// TODO: starts a Writer thread
-	pthread_create(&t, 0, Writer::process, (void *)this);
+	create(Writer::process, (void*)this);
 }
 
 void *Writer::process(void *arg)
@@ -53,14 +101,131 @@ void *Writer::process(void *arg)
 	// TODO: implements the Writer's work
 	Writer *writer = (Writer *)arg;
 
-	while (writer->expected_lines--)
+	Item* items[DEFAULT_BATCH_SIZE];
+	Item* held[DEFAULT_BATCH_SIZE];
+
+	if (writer->metrics)
+		writer->stats = writer->metrics->register_stage("writer");
+
+	// lines that have not been dequeued yet, the rest of expected_lines
+	// is held by the reorder buffer
+	int incoming = writer->expected_lines;
+
+	while (incoming > 0)
 	{
-		Item *item = new Item;
-		item = writer->output_queue->dequeue();
-		writer->ofs << *item;
+		int max = incoming < DEFAULT_BATCH_SIZE ? incoming : DEFAULT_BATCH_SIZE;
+		int n = writer->output_queue->dequeue_bulk(items, max, -1);
+		// every consumer is gone, whatever is missing will not come
+		if (n == 0)
+			break;
+		incoming -= n;
+
+		if (writer->stats)
+			writer->stats->record_taken(items, n, monotonic_ns());
+
+		if (!writer->reorder)
+		{
+			writer->write_items(items, n);
+			continue;
+		}
+
+		// items that cannot be held go out right away, the others wait
+		// until the run before them is complete
+		int direct = 0;
+		for (int i = 0; i < n; i++)
+		{
+			// everything before a key past the window has arrived, the
+			// gaps in what is held will not be filled
+			if (writer->reorder->is_past(items[i]))
+			{
+				int m;
+				while ((m = writer->reorder->drain(held, DEFAULT_BATCH_SIZE)) > 0)
+					writer->write_items(held, m);
+				writer->reorder->skip_to(items[i]->key);
+			}
+			if (!writer->reorder->insert(items[i]))
+				items[direct++] = items[i];
+		}
+		writer->write_items(items, direct);
+
+		while ((n = writer->reorder->take_run(items, DEFAULT_BATCH_SIZE)) > 0)
+			writer->write_items(items, n);
 	}
 
+	// every line has arrived or the stream ended, whatever is held sits
+	// behind a missing key
+	if (writer->reorder)
+	{
+		int n;
+		while ((n = writer->reorder->drain(items, DEFAULT_BATCH_SIZE)) > 0)
+			writer->write_items(items, n);
+	}
+
+	writer->flush();
+
 	return nullptr;
 }
 
+void Writer::write_items(Item **items, int n)
+{
+	for (int i = 0; i < n; i++)
+		append(*items[i]);
+	// a line counts as written once it is buffered
+	if (stats)
+		stats->record_written(items, n, monotonic_ns());
+	// the lines are in the buffers now, the items can be reused
+	ItemPool::release_bulk(items, n);
+	expected_lines -= n;
+}
+
+void Writer::append(const Item &item)
+{
+	if (iov[current].iov_len + ITEM_MAX_LINE > WRITER_BUFFER_SIZE)
+	{
+		if (current + 1 == WRITER_BUFFERS)
+			flush();
+		else
+			current++;
+	}
+
+	iov[current].iov_len += Item::format(buffers[current] + iov[current].iov_len, item);
+}
+
+void Writer::flush()
+{
+	struct iovec pending[WRITER_BUFFERS];
+	int count = current + 1;
+	for (int i = 0; i < count; i++)
+		pending[i] = iov[i];
+
+	// writev may stop short, so resume from wherever it got to
+	struct iovec *next = pending;
+	while (fd >= 0 && count > 0)
+	{
+		ssize_t written = writev(fd, next, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("writer");
+			break;
+		}
+		while (count > 0 && (size_t)written >= next->iov_len)
+		{
+			written -= next->iov_len;
+			next++;
+			count--;
+		}
+		if (count > 0)
+		{
+			next->iov_base = (char *)next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+
+	for (int i = 0; i < WRITER_BUFFERS; i++)
+		iov[i].iov_len = 0;
+	current = 0;
+}
+
 #endif // WRITER_HPP